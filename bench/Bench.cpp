@@ -0,0 +1,1542 @@
+// Asset pipeline and rendering benchmarks. Run from the repository root:
+//
+//     bin/bench.exe --json=bench.json
+//
+// GL benchmarks run in a hidden window; they are reported as skipped when no
+// context can be created (e.g. on a build server without a GPU).
+#include "Benchmark.h"
+
+#include "../src/Arena.h"
+#include "../src/CommandList.h"
+#include "../src/FrameCapture.h"
+#include "../src/KeyframeResidency.h"
+#include "../src/Md2.h"
+#include "../src/MemoryTracker.h"
+#include "../src/OcclusionCuller.h"
+#include "../src/PoseCache.h"
+#include "../src/PoseKernel.h"
+#include "../src/ShaderProgram.h"
+#include "../src/SoftwareMd2.h"
+#include "../src/SpatialIndex.h"
+#include "../src/StreamBuffer.h"
+#include "../src/Texture2D.h"
+#include "../src/TgaLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <thread>
+
+namespace
+{
+    struct Asset
+    {
+        const char *name;
+        const char *model;
+        const char *texture;
+    };
+
+    constexpr Asset ASSETS[] = {
+        {"cyborg", "data/cyborg.md2", "data/cyborg1.tga"},
+        {"female", "data/female.md2", "data/female.tga"},
+        {"grunt", "data/grunt.md2", "data/grunt.tga"},
+        {"tris", "data/tris.md2", "data/tris.tga"},
+    };
+
+    constexpr int WINDOW_WIDTH = 1024;
+    constexpr int WINDOW_HEIGHT = 768;
+
+    // Draw replay script
+    constexpr unsigned int REPLAY_SEED = 1234;
+    constexpr float REPLAY_SECONDS = 10.0f;
+    constexpr float REPLAY_TIMESTEP = 1.0f / 60.0f; // simulated, so every run draws the same frames
+    constexpr int REPLAY_ENTITIES = 16;
+    constexpr float CAMERA_PERIOD = 5.0f;           // seconds for one dolly in and out
+    constexpr float CAMERA_NEAR_Z = 20.0f;          // 5 units in front of the model
+    constexpr float CAMERA_FAR_Z = -50.0f;          // 75 units in front of the model
+    constexpr float ANIMATION_VELOCITY = 5.0f;      // same as main.cpp
+    constexpr float TWO_PI = 6.28318530718f;
+
+    GLFWwindow *CreateHiddenContext()
+    {
+        if (!glfwInit())
+        {
+            return nullptr;
+        }
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+        GLFWwindow *window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "bench", NULL, NULL);
+        if (!window)
+        {
+            return nullptr;
+        }
+        glfwMakeContextCurrent(window);
+        glewExperimental = GL_TRUE;
+        if (glewInit() != GLEW_OK)
+        {
+            return nullptr;
+        }
+        glfwSwapInterval(0);
+        glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+        glEnable(GL_DEPTH_TEST);
+        return window;
+    }
+
+    // The animations of every bundled model, as in the chart in main.cpp, under the names
+    // LoadModelData gives them
+    struct ChartClip
+    {
+        const char *name;
+        int firstFrame;
+        int lastFrame;
+    };
+
+    constexpr ChartClip CLIP_CHART[] = {
+        {"stand", 0, 39},
+        {"run", 40, 45},
+        {"attack", 46, 53},
+        {"pain1", 54, 57},
+        {"pain2", 58, 61},
+        {"pain3", 62, 65},
+        {"jump", 66, 71},
+        {"flip", 72, 83},
+        {"salute", 84, 94},
+        {"taunt", 95, 111},
+        {"wave", 112, 122},
+        {"point", 123, 134},
+        {"crstnd", 135, 153},
+        {"crwalk", 154, 159},
+        {"crattak", 160, 168},
+        {"crpain", 169, 172},
+        {"crdeath", 173, 177},
+        {"death1", 178, 183},
+        {"death2", 184, 189},
+        {"death3", 190, 197},
+    };
+    constexpr size_t CHART_CLIPS = sizeof(CLIP_CHART) / sizeof(CLIP_CHART[0]);
+
+    // Empty when the clips found by LoadModelData match the chart
+    std::string CompareClipsToChart(const md2model::modData &model)
+    {
+        if (model.clips.size() != CHART_CLIPS)
+        {
+            return std::to_string(model.clips.size()) + " clips, the chart has " + std::to_string(CHART_CLIPS);
+        }
+        for (size_t i = 0; i < CHART_CLIPS; i++)
+        {
+            const md2model::animationClip &clip = model.clips[i];
+            const ChartClip &expected = CLIP_CHART[i];
+            if (clip.name != expected.name || clip.firstFrame != expected.firstFrame || clip.firstFrame + clip.frameCount - 1 != expected.lastFrame)
+            {
+                return "clip " + clip.name + " " + std::to_string(clip.firstFrame) + "-" + std::to_string(clip.firstFrame + clip.frameCount - 1) +
+                       ", the chart has " + expected.name + " " + std::to_string(expected.firstFrame) + "-" + std::to_string(expected.lastFrame);
+            }
+        }
+        return "";
+    }
+
+    // Empty when every clip's pose cache loop bound is the motion from the chart's last
+    // frame of that clip back to its first, measured here from the positions
+    std::string CompareLoopMotionToChart(const md2model::modData &model)
+    {
+        for (size_t i = 0; i < std::min(model.clips.size(), CHART_CLIPS); i++)
+        {
+            const ChartClip &expected = CLIP_CHART[i];
+            const md2model::vector *last = &model.pointList[static_cast<size_t>(model.numPoints) * expected.lastFrame];
+            const md2model::vector *first = &model.pointList[static_cast<size_t>(model.numPoints) * expected.firstFrame];
+            float motion = 0.0f;
+            for (int v = 0; v < model.numPoints; v++)
+            {
+                glm::vec3 delta(first[v].point[0] - last[v].point[0], first[v].point[1] - last[v].point[1], first[v].point[2] - last[v].point[2]);
+                motion = std::max(motion, glm::length(delta));
+            }
+            const float stored = md2model::KeyframeMotion(model, expected.lastFrame, expected.firstFrame);
+            if (stored != model.clips[i].loopMotion || std::fabs(stored - motion) > 1e-4f * std::max(1.0f, motion))
+            {
+                return "loop motion of " + std::string(expected.name) + " is " + std::to_string(model.clips[i].loopMotion) + ", frames " +
+                       std::to_string(expected.lastFrame) + "->" + std::to_string(expected.firstFrame) + " move " + std::to_string(motion);
+            }
+        }
+        return "";
+    }
+
+    void LoadModelBenchmark(bench::State &state, const Asset &asset)
+    {
+        std::unique_ptr<md2model::modData> model;
+        for (auto _ : state)
+        {
+            model = md2model::LoadModelData(asset.model);
+            if (!model)
+            {
+                state.SkipWithError(std::string("could not load ") + asset.model);
+                return;
+            }
+        }
+
+        std::string mismatch = CompareClipsToChart(*model);
+        if (mismatch.empty())
+        {
+            mismatch = CompareLoopMotionToChart(*model);
+        }
+        if (!mismatch.empty())
+        {
+            state.SkipWithError(mismatch);
+            return;
+        }
+        state.counters["clips"] = static_cast<double>(model->clips.size());
+    }
+
+    void LoadTgaBenchmark(bench::State &state, const Asset &asset)
+    {
+        std::vector<unsigned char> data;
+        unsigned short width, height;
+        for (auto _ : state)
+        {
+            if (!LoadTGA(asset.texture, data, width, height))
+            {
+                state.SkipWithError(std::string("could not load ") + asset.texture);
+            }
+        }
+        state.counters["bytes"] = static_cast<double>(data.size());
+    }
+
+    void PoseKernelBenchmark(bench::State &state, const Asset &asset)
+    {
+        std::unique_ptr<md2model::modData> model = md2model::LoadModelData(asset.model);
+        if (!model)
+        {
+            state.SkipWithError(std::string("could not load ") + asset.model);
+            return;
+        }
+
+        std::vector<float> positions(model->numPoints * md2model::POSITION_COMPONENTS);
+        std::vector<float> normals(model->numPoints * md2model::POSITION_COMPONENTS);
+        int frame = 0;
+        for (auto _ : state)
+        {
+            int next = (frame + 1) % model->numFrames;
+            md2model::InterpolatePose(*model, frame, next, 0.5f, positions.data(), normals.data());
+            frame = next;
+        }
+        state.counters["vertices_per_second_per_core"] = state.iterations() * model->numPoints / state.elapsedSeconds();
+        state.SetLabel(md2model::PoseKernelName());
+    }
+
+    // Md2's construction stages are private, the object records how long each one took
+    void Md2ConstructBenchmark(bench::State &state, const Asset &asset)
+    {
+        md2model::LoadTimings total{};
+        unsigned long long allocations = 0;
+        for (auto _ : state)
+        {
+            unsigned long long allocationsBefore = getHeapAllocationCount();
+            md2model::Md2 model(asset.model, asset.texture);
+            allocations += getHeapAllocationCount() - allocationsBefore;
+            if (!model.isValid())
+            {
+                state.SkipWithError(std::string("could not create ") + asset.name);
+                return;
+            }
+            const md2model::LoadTimings &timings = model.GetLoadTimings();
+            total.loadModel += timings.loadModel;
+            total.loadTexture += timings.loadTexture;
+            total.buildLods += timings.buildLods;
+            total.optimizeIndices += timings.optimizeIndices;
+            total.initBuffer += timings.initBuffer;
+            total.loadShaders += timings.loadShaders;
+            state.PauseTiming();
+            glFinish();
+            state.ResumeTiming();
+        }
+
+        double iterations = static_cast<double>(state.iterations());
+        state.counters["LoadModel_ms"] = total.loadModel / iterations;
+        state.counters["LoadTexture_ms"] = total.loadTexture / iterations;
+        state.counters["BuildLods_ms"] = total.buildLods / iterations;
+        state.counters["OptimizeIndices_ms"] = total.optimizeIndices / iterations;
+        state.counters["InitBuffer_ms"] = total.initBuffer / iterations;
+        state.counters["LoadShaders_ms"] = total.loadShaders / iterations;
+        state.counters["heap_allocs"] = allocations / iterations;
+
+        // Peaks survive the destruction of the models
+        MemoryTracker &memory = MemoryTracker::global();
+        MemoryUsage model = memory.getUsage(MemoryTracker::MODEL, asset.model);
+        MemoryUsage mesh = memory.getUsage(MemoryTracker::MESH, asset.model);
+        MemoryUsage texture = memory.getUsage(MemoryTracker::TEXTURE, asset.texture);
+        state.counters["model_cpu_KB"] = model.peakCpuBytes / 1024.0;
+        state.counters["mesh_cpu_KB"] = mesh.peakCpuBytes / 1024.0;
+        state.counters["gpu_KB"] = (mesh.peakGpuBytes + texture.peakGpuBytes) / 1024.0;
+        state.counters["peak_transient_KB"] = std::max(model.peakTransientBytes, texture.peakTransientBytes) / 1024.0;
+    }
+
+    void LoadTextureBenchmark(bench::State &state, const Asset &asset)
+    {
+        for (auto _ : state)
+        {
+            Texture2D texture;
+            if (!texture.loadTexture(asset.texture, true))
+            {
+                state.SkipWithError(std::string("could not load ") + asset.texture);
+            }
+            glFinish();
+        }
+    }
+
+    void LoadShadersBenchmark(bench::State &state)
+    {
+        for (auto _ : state)
+        {
+            ShaderProgram program;
+            if (!program.loadShaders("shaders/basic.vert", "shaders/basic.frag"))
+            {
+                state.SkipWithError("could not load shaders/basic.*");
+            }
+            glFinish();
+        }
+    }
+
+    // Fixed camera path and fixed random entity phases, so every run issues exactly the same draws
+    void DrawReplayBenchmark(bench::State &state, const Asset &asset)
+    {
+        md2model::Md2 model(asset.model, asset.texture);
+        if (!model.isValid())
+        {
+            state.SkipWithError(std::string("could not create ") + asset.name);
+            return;
+        }
+
+        std::mt19937 random(REPLAY_SEED);
+        std::uniform_int_distribution<int> frameDistribution(0, model.GetFrameCount() - 1);
+        std::uniform_real_distribution<float> unitDistribution(0.0f, 1.0f);
+        int frames[REPLAY_ENTITIES];
+        float angles[REPLAY_ENTITIES];
+        float interpolations[REPLAY_ENTITIES];
+        for (int i = 0; i < REPLAY_ENTITIES; i++)
+        {
+            frames[i] = frameDistribution(random);
+            angles[i] = unitDistribution(random) * 360.0f;
+            interpolations[i] = unitDistribution(random);
+        }
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+        const int frameCount = static_cast<int>(REPLAY_SECONDS / REPLAY_TIMESTEP);
+        md2model::KeyframeResidency &residency = md2model::KeyframeResidency::Global();
+        const md2model::ResidencyStats before = residency.GetStats();
+        unsigned long long steadyFrames = 0;
+        unsigned long long steadyAllocations = 0;
+
+        for (auto _ : state)
+        {
+            for (int step = 0; step < frameCount; step++)
+            {
+                float time = step * REPLAY_TIMESTEP;
+                float dolly = 0.5f - 0.5f * std::cos(TWO_PI * time / CAMERA_PERIOD);
+                glm::vec3 camPos(0.0f, 0.0f, CAMERA_NEAR_Z + (CAMERA_FAR_Z - CAMERA_NEAR_Z) * dolly);
+                glm::mat4 view = glm::lookAt(camPos, camPos + glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+
+                unsigned long long allocationsBefore = getHeapAllocationCount();
+                LinearArena::frameArena().reset();
+                residency.BeginFrame();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                for (int i = 0; i < REPLAY_ENTITIES; i++)
+                {
+                    model.Draw(frames[i], angles[i], interpolations[i], view, projection);
+                    interpolations[i] += ANIMATION_VELOCITY * REPLAY_TIMESTEP;
+                    if (interpolations[i] >= 1.0f)
+                    {
+                        interpolations[i] = 0.0f;
+                        frames[i] = (frames[i] + 1) % model.GetFrameCount();
+                    }
+                }
+                // Include the GPU work, otherwise only command submission is measured
+                glFinish();
+
+                if (residency.GetStats().uploadsThisFrame == 0)
+                {
+                    steadyFrames++;
+                    steadyAllocations += getHeapAllocationCount() - allocationsBefore;
+                }
+            }
+        }
+
+        state.counters["frames"] = frameCount;
+        state.counters["ms_per_frame"] = state.elapsedSeconds() * 1000.0 / (frameCount * state.iterations());
+        for (int lod = 0; lod < model.GetLodCount(); lod++)
+        {
+            state.counters["lod" + std::to_string(lod) + "_draws"] = model.GetLodStats()[lod].draws;
+        }
+
+        const md2model::ResidencyStats &after = residency.GetStats();
+        state.counters["keyframe_peak_KB"] = after.peakResidentBytes / 1024.0;
+        state.counters["keyframe_uploads"] = static_cast<double>(after.uploads - before.uploads);
+        state.counters["keyframe_misses"] = static_cast<double>(after.misses - before.misses);
+        state.counters["keyframe_evictions"] = static_cast<double>(after.evictions - before.evictions);
+        state.counters["heap_allocs_per_steady_frame"] = steadyFrames > 0 ? static_cast<double>(steadyAllocations) / steadyFrames : 0.0;
+    }
+
+    // CPU half of Md2::Draw: frame lookup, transforms and LOD selection, no GL calls once resident
+    void DrawPrepBenchmark(bench::State &state, const Asset &asset)
+    {
+        md2model::Md2 model(asset.model, asset.texture);
+        if (!model.isValid())
+        {
+            state.SkipWithError(std::string("could not create ") + asset.name);
+            return;
+        }
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        md2model::DrawPacket packet;
+        for (int frame = 0; frame < model.GetFrameCount(); frame++)
+        {
+            model.PrepareDraw(frame, 0.0f, view, projection, packet);
+        }
+
+        int frame = 0;
+        unsigned int lods = 0;
+        for (auto _ : state)
+        {
+            model.PrepareDraw(frame, 30.0f, view, projection, packet);
+            lods += packet.lod;
+            frame = frame + 1 == model.GetFrameCount() ? 0 : frame + 1;
+        }
+        state.counters["draws_per_second"] = state.iterations() / state.elapsedSeconds();
+        state.counters["lod_sum"] = lods;
+    }
+
+    // The frame table Md2 used to keep against the flat array it keeps now
+    constexpr int LOOKUP_FRAMES = 198; // frames of the largest sample model
+    constexpr int LOOKUP_SEQUENCE = 4096;
+
+    std::vector<int> LookupSequence()
+    {
+        std::mt19937 random(REPLAY_SEED);
+        std::uniform_int_distribution<int> frameDistribution(0, LOOKUP_FRAMES - 1);
+        std::vector<int> sequence(LOOKUP_SEQUENCE);
+        for (int &frame : sequence)
+        {
+            frame = frameDistribution(random);
+        }
+        return sequence;
+    }
+
+    void FrameLookupMapBenchmark(bench::State &state)
+    {
+        std::map<int, std::pair<int, int>> table;
+        for (int frame = 0; frame < LOOKUP_FRAMES; frame++)
+        {
+            table[frame] = {frame + 1, frame / 10};
+        }
+        std::vector<int> sequence = LookupSequence();
+
+        size_t position = 0;
+        unsigned long long sum = 0;
+        for (auto _ : state)
+        {
+            sum += table[sequence[position]].first;
+            position = (position + 1) & (LOOKUP_SEQUENCE - 1);
+        }
+        state.counters["checksum"] = static_cast<double>(sum);
+    }
+
+    void FrameLookupFlatBenchmark(bench::State &state)
+    {
+        md2model::RuntimeFrame table[LOOKUP_FRAMES];
+        for (int frame = 0; frame < LOOKUP_FRAMES; frame++)
+        {
+            table[frame] = {static_cast<GLuint>(frame + 1), frame / 10};
+        }
+        std::vector<int> sequence = LookupSequence();
+
+        size_t position = 0;
+        unsigned long long sum = 0;
+        for (auto _ : state)
+        {
+            sum += table[sequence[position]].vao;
+            position = (position + 1) & (LOOKUP_SEQUENCE - 1);
+        }
+        state.counters["checksum"] = static_cast<double>(sum);
+    }
+
+    // Render-thread cost of capturing every frame from an offscreen target, as in a headless run
+    void FrameCaptureBenchmark(bench::State &state, const char *extension)
+    {
+        md2model::Md2 model(ASSETS[0].model, ASSETS[0].texture);
+        FrameCapture capture;
+        if (!model.isValid() || !capture.init(WINDOW_WIDTH, WINDOW_HEIGHT, true))
+        {
+            state.SkipWithError("could not set up the capture target");
+            return;
+        }
+
+        std::string filename = (std::filesystem::temp_directory_path() / (std::string("md2_capture") + extension)).string();
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        int frame = 0;
+
+        capture.bindFramebuffer();
+        for (auto _ : state)
+        {
+            md2model::KeyframeResidency::Global().BeginFrame();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            model.Draw(frame, 0.0f, 0.0f, view, projection);
+            capture.capture(filename.c_str());
+            capture.update();
+            frame = (frame + 1) % model.GetFrameCount();
+        }
+        state.PauseTiming();
+        capture.finish();
+        state.ResumeTiming();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        std::filesystem::remove(filename);
+
+        const CaptureStats &stats = capture.getStats();
+        state.counters["render_thread_ms_per_capture"] = stats.renderThreadMilliseconds / std::max<double>(1.0, static_cast<double>(stats.requested));
+        state.counters["written"] = static_cast<double>(stats.written);
+        state.counters["dropped"] = static_cast<double>(stats.dropped);
+    }
+
+    // Packet building spread over worker threads, merged and replayed into the null backend.
+    // Synthetic entities, so the recording and submission overhead is all that is measured.
+    constexpr int RECORD_ENTITIES = 4096;
+    constexpr int RECORD_PROGRAMS = 4;
+    constexpr int RECORD_TEXTURES = 8;
+
+    void CommandListBenchmark(bench::State &state, int threadCount)
+    {
+        std::vector<CommandList> lists(threadCount);
+        std::vector<CommandList *> listPointers;
+        for (CommandList &list : lists)
+        {
+            listPointers.push_back(&list);
+        }
+        CommandExecutor executor;
+        NullCommandBackend backend;
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+
+        auto record = [&](int thread)
+        {
+            CommandList &list = lists[thread];
+            list.reset();
+            for (int entity = thread; entity < RECORD_ENTITIES; entity += threadCount)
+            {
+                const unsigned int program = 1 + entity % RECORD_PROGRAMS;
+                const unsigned int texture = 1 + entity % RECORD_TEXTURES;
+                glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(entity % 64 - 32.0f, entity / 64 - 32.0f, -50.0f));
+                glm::mat4 modelView = view * model;
+                list.beginPacket(CommandList::makeSortKey(program, texture, -modelView[3][2]));
+                list.bindTexture(0, texture);
+                list.bindProgram(program);
+                list.setUniform(0, model);
+                list.setUniform(1, view);
+                list.setUniform(2, projection);
+                list.setUniform(3, modelView);
+                list.setUniform(4, 0.5f);
+                list.bindVertexArray(1 + entity % 64);
+                list.drawIndexed(1024, 0);
+            }
+        };
+
+        unsigned long long steadyAllocations = 0;
+        double submitSeconds = 0.0;
+        for (auto _ : state)
+        {
+            std::vector<std::thread> workers;
+            for (int thread = 1; thread < threadCount; thread++)
+            {
+                workers.emplace_back(record, thread);
+            }
+            record(0);
+            for (std::thread &worker : workers)
+            {
+                worker.join();
+            }
+
+            unsigned long long allocations = getHeapAllocationCount();
+            auto submitStart = std::chrono::steady_clock::now();
+            backend.clear();
+            executor.execute(listPointers, backend);
+            submitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - submitStart).count();
+            steadyAllocations += getHeapAllocationCount() - allocations;
+        }
+
+        if (backend.getCallCount(NullCommandBackend::CALL_DRAW) != RECORD_ENTITIES)
+        {
+            state.SkipWithError("replay lost draws");
+            return;
+        }
+        const CommandStats &stats = executor.getStats();
+        const double frames = static_cast<double>(state.iterations());
+        state.counters["packets_per_second"] = RECORD_ENTITIES * frames / state.elapsedSeconds();
+        state.counters["submit_ms"] = submitSeconds * 1000.0 / frames;
+        state.counters["program_binds_per_frame"] = static_cast<double>(backend.getCallCount(NullCommandBackend::CALL_BIND_PROGRAM));
+        state.counters["texture_binds_per_frame"] = static_cast<double>(backend.getCallCount(NullCommandBackend::CALL_BIND_TEXTURE));
+        state.counters["redundant_bindings_per_frame"] = stats.redundantBindings / frames;
+        state.counters["list_KB"] = lists[0].getByteSize() / 1024.0;
+        state.counters["heap_allocs_per_submit"] = steadyAllocations / frames;
+    }
+
+    // One model recorded several times through Md2::RecordDraw and replayed into a tracing
+    // null backend. The first packet binds texture, program and vertex array; the later
+    // ones share all three, so the executor must reduce them to uniforms and the draw.
+    // Uniform locations and the vertex array are taken from the first packet, everything
+    // else from the model.
+    constexpr int REPLAY_CHECK_DRAWS = 8;
+
+    void CommandReplayBenchmark(bench::State &state)
+    {
+        md2model::Md2 model(ASSETS[0].model, ASSETS[0].texture);
+        if (!model.isValid())
+        {
+            state.SkipWithError("failed to load model");
+            return;
+        }
+        model.SetForcedLod(0);
+        CommandList list;
+        const CommandList *lists[] = {&list};
+        CommandExecutor executor;
+        NullCommandBackend backend(true);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+        model.SetPosition(glm::vec3(0.0f, 0.0f, -60.0f));
+
+        const int frame = 0;
+        auto recordFrame = [&]()
+        {
+            list.reset();
+            for (int i = 0; i < REPLAY_CHECK_DRAWS; i++)
+            {
+                if (!model.PrepareRecord(frame, view, projection) || !model.RecordDraw(list, frame, i * 45.0f, i / static_cast<float>(REPLAY_CHECK_DRAWS), view, projection))
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        for (auto _ : state)
+        {
+            if (!recordFrame())
+            {
+                state.SkipWithError("recording failed");
+                return;
+            }
+            backend.clear();
+            executor.execute(lists, 1, backend);
+        }
+
+        using Call = NullCommandBackend::Call;
+        const std::vector<Call> &trace = backend.getTrace();
+        constexpr size_t FIRST_PACKET_CALLS = 9; // texture, program, 5 uniforms, vertex array, draw
+        constexpr size_t UNIFORM_CALLS = 5;
+        if (trace.size() < FIRST_PACKET_CALLS)
+        {
+            state.SkipWithError("replay trace too short");
+            return;
+        }
+
+        std::vector<Call> uniforms;
+        for (size_t i = 0; i < UNIFORM_CALLS; i++)
+        {
+            uniforms.push_back({NullCommandBackend::CALL_UNIFORM, 0, trace[2 + i].argument});
+        }
+        const Call draw = {NullCommandBackend::CALL_DRAW, static_cast<unsigned int>(model.GetLodStats()[0].triangles * 3), 0};
+        std::vector<Call> expected;
+        expected.push_back({NullCommandBackend::CALL_BIND_TEXTURE, model.GetTexture(), 0});
+        expected.push_back({NullCommandBackend::CALL_BIND_PROGRAM, model.GetProgram(), 0});
+        expected.insert(expected.end(), uniforms.begin(), uniforms.end());
+        expected.push_back({NullCommandBackend::CALL_BIND_VERTEX_ARRAY, trace[7].handle, 0});
+        expected.push_back(draw);
+        for (int i = 1; i < REPLAY_CHECK_DRAWS; i++)
+        {
+            expected.insert(expected.end(), uniforms.begin(), uniforms.end());
+            expected.push_back(draw);
+        }
+
+        if (trace.size() != expected.size())
+        {
+            state.SkipWithError(("replay made " + std::to_string(trace.size()) + " calls, expected " + std::to_string(expected.size())).c_str());
+            return;
+        }
+        for (size_t i = 0; i < trace.size(); i++)
+        {
+            if (trace[i].type != expected[i].type || trace[i].handle != expected[i].handle || trace[i].argument != expected[i].argument)
+            {
+                state.SkipWithError(("replay call " + std::to_string(i) + " differs from the expected sequence").c_str());
+                return;
+            }
+        }
+
+        // A draw given the LOD's timer query is wrapped in it on replay
+        GLuint timerQuery = 0;
+        list.reset();
+        if (!model.PrepareRecord(frame, view, projection, &timerQuery) || timerQuery == 0 || !model.RecordDraw(list, frame, 0.0f, 0.0f, view, projection, timerQuery))
+        {
+            state.SkipWithError("timed recording failed");
+            return;
+        }
+        NullCommandBackend timedBackend(true);
+        executor.execute(lists, 1, timedBackend);
+        const std::vector<Call> &timedTrace = timedBackend.getTrace();
+        if (timedTrace.size() != FIRST_PACKET_CALLS + 2 || timedTrace[FIRST_PACKET_CALLS - 1].type != NullCommandBackend::CALL_BEGIN_TIMER || timedTrace[FIRST_PACKET_CALLS - 1].handle != timerQuery || timedTrace[FIRST_PACKET_CALLS].type != NullCommandBackend::CALL_DRAW || timedTrace[FIRST_PACKET_CALLS + 1].type != NullCommandBackend::CALL_END_TIMER)
+        {
+            state.SkipWithError("timed draw is not wrapped in its timer query");
+            return;
+        }
+
+        const double frames = static_cast<double>(state.iterations());
+        state.counters["calls_per_frame"] = static_cast<double>(trace.size());
+        state.counters["redundant_bindings_per_frame"] = executor.getStats().redundantBindings / frames;
+    }
+
+    // Software rendered images of fixed frames at every level of detail, drawn by
+    // SoftwareRasterBenchmark. Poses are bit-identical for every CPU kernel and the build
+    // turns off floating point contraction, so a different checksum means interpolation,
+    // LOD building, clipping or rasterization changed. After an intended change, copy the
+    // checksums the failing benchmark reports.
+    struct GoldenImage
+    {
+        const char *asset;
+        int frame;
+        int lod;
+        uint64_t checksum;
+    };
+
+    constexpr GoldenImage GOLDEN_IMAGES[] = {
+        {"cyborg", 0, 0, 0x5c749567c6d698e3ull},
+        {"cyborg", 0, 1, 0x425873047177ec5aull},
+        {"cyborg", 0, 2, 0x0a5b435a3da23ecbull},
+        {"cyborg", 0, 3, 0xab866e08fcff5762ull},
+        {"cyborg", 40, 0, 0xfdf5a8087dea3e36ull},
+        {"cyborg", 40, 1, 0x6ce9c3b78bbe043bull},
+        {"cyborg", 40, 2, 0x427a2f5e2b206ed2ull},
+        {"cyborg", 40, 3, 0x7f30bccf1ae1094full},
+        {"female", 0, 0, 0xbeb7a1e0074f469eull},
+        {"female", 0, 1, 0x52022947bb1a6788ull},
+        {"female", 0, 2, 0x96d57b9ace040f6bull},
+        {"female", 0, 3, 0xb1a5594b0a98aa9bull},
+        {"female", 40, 0, 0x4cb9017853a02721ull},
+        {"female", 40, 1, 0xecac6915282f4167ull},
+        {"female", 40, 2, 0xa939d01ad482cc26ull},
+        {"female", 40, 3, 0x9bd9c8d896425043ull},
+        {"grunt", 0, 0, 0xf7d219cd8b0a003full},
+        {"grunt", 0, 1, 0x0e2f003f7c21a4e7ull},
+        {"grunt", 0, 2, 0xd4975f5888bde076ull},
+        {"grunt", 0, 3, 0x9b1f3e6abe3bda6full},
+        {"grunt", 40, 0, 0xec5eac82b602cf87ull},
+        {"grunt", 40, 1, 0x6bac11ff7d880414ull},
+        {"grunt", 40, 2, 0xc6d3ae114e580530ull},
+        {"grunt", 40, 3, 0x6586db5159001167ull},
+        {"tris", 0, 0, 0x2d2d0ca94f63a652ull},
+        {"tris", 0, 1, 0xe97df37b9184a22bull},
+        {"tris", 0, 2, 0xa41e236369b63d76ull},
+        {"tris", 0, 3, 0xb760a8ff2eadc09aull},
+        {"tris", 40, 0, 0x0df08fe23afa3ab4ull},
+        {"tris", 40, 1, 0x74e56aed17e7c0d8ull},
+        {"tris", 40, 2, 0xe2fe3ae10d188fafull},
+        {"tris", 40, 3, 0xe2cb39ef71267570ull},
+    };
+
+    // The software rasterizer drawing the same camera as DrawPrep, one model per frame.
+    // The image must not depend on the number of threads and must match GOLDEN_IMAGES.
+    void SoftwareRasterBenchmark(bench::State &state, const Asset &asset)
+    {
+        SoftwareRasterizer rasterizer;
+        md2model::SoftwareMd2 model(asset.model, asset.texture, rasterizer);
+        if (!model.isValid() || !rasterizer.init(WINDOW_WIDTH, WINDOW_HEIGHT))
+        {
+            state.SkipWithError(std::string("could not create ") + asset.name);
+            return;
+        }
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        const glm::vec4 clearColor(0.25f, 0.2f, 0.15f, 1.0f);
+        int frame = 0;
+        for (auto _ : state)
+        {
+            rasterizer.clear(clearColor);
+            model.Draw(frame, 30.0f, 0.5f, view, projection);
+            rasterizer.finish();
+            frame = (frame + 1) % model.GetFrameCount();
+        }
+        const RasterStats stats = rasterizer.getStats();
+
+        state.PauseTiming();
+        uint64_t checksums[2];
+        SoftwareRasterizer singleThreaded(1);
+        singleThreaded.init(WINDOW_WIDTH, WINDOW_HEIGHT);
+        md2model::SoftwareMd2 reference(asset.model, asset.texture, singleThreaded);
+        SoftwareRasterizer *targets[2] = {&rasterizer, &singleThreaded};
+        md2model::SoftwareMd2 *models[2] = {&model, &reference};
+        for (int i = 0; i < 2; i++)
+        {
+            targets[i]->clear(clearColor);
+            models[i]->Draw(0, 30.0f, 0.5f, view, projection);
+            targets[i]->finish();
+            checksums[i] = targets[i]->getChecksum();
+        }
+        if (checksums[0] != checksums[1])
+        {
+            state.SkipWithError("image depends on the thread count");
+            return;
+        }
+
+        int goldenImages = 0;
+        for (const GoldenImage &golden : GOLDEN_IMAGES)
+        {
+            if (std::string(golden.asset) != asset.name)
+            {
+                continue;
+            }
+            rasterizer.clear(clearColor);
+            model.SetForcedLod(golden.lod);
+            model.Draw(golden.frame, 30.0f, 0.5f, view, projection);
+            rasterizer.finish();
+            const uint64_t checksum = rasterizer.getChecksum();
+            if (checksum != golden.checksum)
+            {
+                char message[128];
+                std::snprintf(message, sizeof(message), "frame %d LOD %d: checksum 0x%016llx, golden 0x%016llx", golden.frame, golden.lod,
+                              static_cast<unsigned long long>(checksum), static_cast<unsigned long long>(golden.checksum));
+                state.SkipWithError(message);
+                return;
+            }
+            goldenImages++;
+        }
+        model.SetForcedLod(-1);
+        state.ResumeTiming();
+        if (goldenImages == 0)
+        {
+            state.SkipWithError(std::string("no golden images for ") + asset.name);
+            return;
+        }
+
+        const double frames = static_cast<double>(state.iterations());
+        state.counters["ms_per_frame"] = state.elapsedSeconds() * 1000.0 / frames;
+        state.counters["threads"] = rasterizer.getThreadCount();
+        state.counters["triangles_per_frame"] = stats.rasterized / frames;
+        state.counters["clipped_per_frame"] = stats.clippedTriangles / frames;
+        state.counters["fragments_per_frame"] = stats.fragments / frames;
+        state.counters["golden_images"] = goldenImages;
+    }
+
+    // Crowd of walking characters: every frame moves all of them, then culls four cameras
+    // and answers a batch of picking rays and proximity queries. The linear variant tests
+    // every entity against every query; both must find the same entities.
+    constexpr float CROWD_SPACING = 20.0f; // world units per entity along each axis
+    constexpr float CROWD_RADIUS = 8.0f;   // about an Md2 bounding sphere at MODEL_SCALE
+    constexpr float CROWD_SPEED = 0.1f;    // per frame, a walk at 60 Hz
+    constexpr int CROWD_CAMERAS = 4;
+    constexpr int CROWD_PICKS = 64;
+    constexpr int CROWD_PROXIMITY = 64;
+
+    struct CrowdResults
+    {
+        size_t visible;
+        size_t nearby;
+        uint64_t picked; // sum of the picked entities + 1, 0 for a miss
+    };
+
+    CrowdResults LinearCrowdQueries(const std::vector<Sphere> &bounds, const Frustum *cameras, const Sphere *proximity, const Ray *picks)
+    {
+        CrowdResults results = {0, 0, 0};
+        for (int i = 0; i < CROWD_CAMERAS; i++)
+        {
+            for (const Sphere &sphere : bounds)
+            {
+                bool inside = true;
+                for (const glm::vec4 &plane : cameras[i].planes)
+                {
+                    inside = inside && plane.x * sphere.center.x + plane.y * sphere.center.y + plane.z * sphere.center.z + plane.w >= -sphere.radius;
+                }
+                results.visible += inside;
+            }
+        }
+        for (int i = 0; i < CROWD_PROXIMITY; i++)
+        {
+            for (const Sphere &sphere : bounds)
+            {
+                glm::vec3 d = sphere.center - proximity[i].center;
+                float r = sphere.radius + proximity[i].radius;
+                results.nearby += glm::dot(d, d) <= r * r;
+            }
+        }
+        for (int i = 0; i < CROWD_PICKS; i++)
+        {
+            const Ray &ray = picks[i];
+            float closest = ray.maxDistance;
+            uint64_t picked = 0;
+            for (size_t entity = 0; entity < bounds.size(); entity++)
+            {
+                glm::vec3 m = ray.origin - bounds[entity].center;
+                float b = glm::dot(m, ray.direction);
+                float c = glm::dot(m, m) - bounds[entity].radius * bounds[entity].radius;
+                float discriminant = b * b - c;
+                if ((c > 0.0f && b > 0.0f) || discriminant < 0.0f)
+                {
+                    continue;
+                }
+                float distance = std::max(-b - std::sqrt(discriminant), 0.0f);
+                if (distance < closest)
+                {
+                    closest = distance;
+                    picked = entity + 1;
+                }
+            }
+            results.picked += picked;
+        }
+        return results;
+    }
+
+    void SpatialIndexBenchmark(bench::State &state, int entityCount, bool linear)
+    {
+        std::mt19937 rng(REPLAY_SEED);
+        const float extent = std::sqrt(static_cast<float>(entityCount)) * CROWD_SPACING * 0.5f;
+        std::uniform_real_distribution<float> place(-extent, extent);
+        std::uniform_real_distribution<float> heading(0.0f, TWO_PI);
+
+        std::vector<Sphere> bounds(entityCount);
+        std::vector<glm::vec3> velocities(entityCount);
+        std::vector<int> handles(entityCount);
+        SpatialIndex index;
+        for (int i = 0; i < entityCount; i++)
+        {
+            float angle = heading(rng);
+            bounds[i] = {glm::vec3(place(rng), 0.0f, place(rng)), CROWD_RADIUS};
+            velocities[i] = glm::vec3(std::cos(angle), 0.0f, std::sin(angle)) * CROWD_SPEED;
+            handles[i] = linear ? -1 : index.insert(bounds[i], static_cast<uint32_t>(i));
+        }
+
+        // Cameras look down on the crowd from above, picks are cast from the same height
+        Frustum cameras[CROWD_CAMERAS];
+        Ray picks[CROWD_PICKS];
+        Sphere proximity[CROWD_PROXIMITY];
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 300.0f);
+        for (int i = 0; i < CROWD_CAMERAS; i++)
+        {
+            float angle = heading(rng);
+            glm::vec3 eye(place(rng), 40.0f, place(rng));
+            glm::vec3 target(eye.x + 60.0f * std::cos(angle), 0.0f, eye.z + 60.0f * std::sin(angle));
+            cameras[i] = Frustum::fromMatrix(projection * glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f)));
+        }
+        for (int i = 0; i < CROWD_PICKS; i++)
+        {
+            float angle = heading(rng);
+            glm::vec3 direction(std::cos(angle), -0.5f, std::sin(angle));
+            picks[i] = {glm::vec3(place(rng), 40.0f, place(rng)), direction * (1.0f / glm::length(direction)), 500.0f};
+        }
+        for (int i = 0; i < CROWD_PROXIMITY; i++)
+        {
+            proximity[i] = {glm::vec3(place(rng), 0.0f, place(rng)), 3.0f * CROWD_RADIUS};
+        }
+
+        QueryResults visible, nearby;
+        RayHit hits[CROWD_PICKS];
+        CrowdResults results = {0, 0, 0};
+        double moveSeconds = 0.0;
+        for (auto _ : state)
+        {
+            auto moveStart = std::chrono::steady_clock::now();
+            for (int i = 0; i < entityCount; i++)
+            {
+                glm::vec3 &center = bounds[i].center;
+                center = center + velocities[i];
+                if (std::fabs(center.x) > extent || std::fabs(center.z) > extent)
+                {
+                    velocities[i] = velocities[i] * -1.0f;
+                }
+                if (!linear)
+                {
+                    index.move(handles[i], bounds[i]);
+                }
+            }
+            moveSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - moveStart).count();
+
+            if (linear)
+            {
+                results = LinearCrowdQueries(bounds, cameras, proximity, picks);
+                continue;
+            }
+            index.queryFrusta(cameras, CROWD_CAMERAS, visible);
+            index.querySpheres(proximity, CROWD_PROXIMITY, nearby);
+            index.raycast(picks, CROWD_PICKS, hits);
+            results = {visible.items.size(), nearby.items.size(), 0};
+            for (const RayHit &hit : hits)
+            {
+                results.picked += hit.handle < 0 ? 0 : hit.userData + 1;
+            }
+        }
+
+        state.PauseTiming();
+        const CrowdResults expected = LinearCrowdQueries(bounds, cameras, proximity, picks);
+        state.ResumeTiming();
+        if (results.visible != expected.visible || results.nearby != expected.nearby || results.picked != expected.picked)
+        {
+            state.SkipWithError("queries disagree with the linear scan");
+            return;
+        }
+
+        const double frames = static_cast<double>(state.iterations());
+        state.counters["ms_per_frame"] = state.elapsedSeconds() * 1000.0 / frames;
+        state.counters["move_ms"] = moveSeconds * 1000.0 / frames;
+        state.counters["query_ms"] = (state.elapsedSeconds() - moveSeconds) * 1000.0 / frames;
+        state.counters["visible_per_camera"] = static_cast<double>(results.visible) / CROWD_CAMERAS;
+        if (!linear)
+        {
+            const SpatialStats &stats = index.getStats();
+            const double queries = frames * (CROWD_CAMERAS + CROWD_PICKS + CROWD_PROXIMITY);
+            state.counters["reinserts_per_frame"] = stats.reinserts / frames;
+            state.counters["node_tests_per_query"] = stats.nodeTests / queries;
+            state.counters["tree_height"] = index.getHeight();
+        }
+    }
+
+    // Rows of characters one behind the other, seen from the front by a camera that sways
+    // sideways, so many of the back rows are hidden and visibility keeps changing
+    constexpr int OCCLUSION_COLUMNS = 10;
+    constexpr int OCCLUSION_ROWS = 16;
+    constexpr float OCCLUSION_COLUMN_SPACING = 4.0f;
+    constexpr float OCCLUSION_ROW_SPACING = 6.0f;
+    constexpr float OCCLUSION_FRONT_Z = -25.0f; // where the model stands in main.cpp
+    constexpr float OCCLUSION_SWAY = 8.0f;
+    constexpr int OCCLUSION_FRAMES = 60;       // per iteration, one sway period
+    const Asset &OCCLUSION_ASSET = ASSETS[0];
+
+    struct OcclusionCrowd
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<OcclusionCandidate> candidates; // everyone, the whole crowd is in view
+        glm::mat4 projection;
+
+        // Proxies are the model's box over every frame, tighter than its bounding sphere
+        template <typename Model>
+        explicit OcclusionCrowd(Model &model)
+            : projection(glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 300.0f))
+        {
+            // The camera's up is +x, as in main.cpp, so columns spread along y
+            for (int row = 0; row < OCCLUSION_ROWS; row++)
+            {
+                for (int column = 0; column < OCCLUSION_COLUMNS; column++)
+                {
+                    glm::vec3 position(0.0f, (column - (OCCLUSION_COLUMNS - 1) * 0.5f) * OCCLUSION_COLUMN_SPACING, OCCLUSION_FRONT_Z - row * OCCLUSION_ROW_SPACING);
+                    OcclusionCandidate candidate = {static_cast<uint32_t>(positions.size()), {}};
+                    model.SetPosition(position);
+                    model.GetBounds(0.0f, candidate.box.min, candidate.box.max);
+                    candidates.push_back(candidate);
+                    positions.push_back(position);
+                }
+            }
+        }
+
+        glm::vec3 eye(int step) const
+        {
+            return glm::vec3(0.0f, OCCLUSION_SWAY * std::sin(TWO_PI * step / OCCLUSION_FRAMES), 20.0f);
+        }
+
+        glm::mat4 view(int step) const
+        {
+            glm::vec3 position = eye(step);
+            return glm::lookAt(position, position + glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        }
+
+        int animationFrame(uint32_t id, int step, int frameCount) const
+        {
+            return static_cast<int>((id * 7 + step / 4) % frameCount);
+        }
+    };
+
+    // Without culling every candidate is drawn and there are no stats
+    void ReportOcclusion(bench::State &state, const OcclusionStats *stats, double frames)
+    {
+        state.counters["ms_per_frame"] = state.elapsedSeconds() * 1000.0 / frames;
+        state.counters["candidates_per_frame"] = OCCLUSION_COLUMNS * OCCLUSION_ROWS;
+        if (stats)
+        {
+            state.counters["drawn_per_frame"] = stats->drawn / frames;
+            state.counters["occluded_per_frame"] = stats->occluded / frames;
+            state.counters["queries_per_frame"] = stats->queries / frames;
+            state.counters["mean_latency_frames"] = stats->results ? static_cast<double>(stats->latencyFrames) / stats->results : 0.0;
+            state.counters["reappeared_per_frame"] = stats->reappeared / frames;
+        }
+    }
+
+    // Software rasterizer and software depth queries. Once the camera stops and the culler
+    // has caught up, the culled image must equal the image with every character drawn.
+    void OcclusionSoftwareBenchmark(bench::State &state, bool cull)
+    {
+        SoftwareRasterizer rasterizer;
+        md2model::SoftwareMd2 model(OCCLUSION_ASSET.model, OCCLUSION_ASSET.texture, rasterizer);
+        if (!model.isValid() || !rasterizer.init(WINDOW_WIDTH, WINDOW_HEIGHT))
+        {
+            state.SkipWithError(std::string("could not create ") + OCCLUSION_ASSET.name);
+            return;
+        }
+        OcclusionCrowd crowd(model);
+        SoftwareOcclusionBackend backend(rasterizer);
+        OcclusionCuller culler(backend);
+        const glm::vec4 clearColor(0.25f, 0.2f, 0.15f, 1.0f);
+        std::vector<uint32_t> draw;
+
+        auto renderFrame = [&](int step, bool useCuller)
+        {
+            glm::mat4 view = crowd.view(step);
+            if (useCuller)
+            {
+                culler.beginFrame(crowd.candidates.data(), crowd.candidates.size(), draw);
+            }
+            else
+            {
+                draw.clear();
+                for (const OcclusionCandidate &candidate : crowd.candidates)
+                {
+                    draw.push_back(candidate.id);
+                }
+            }
+            rasterizer.clear(clearColor);
+            for (uint32_t id : draw)
+            {
+                model.SetPosition(crowd.positions[id]);
+                model.Draw(crowd.animationFrame(id, step, model.GetFrameCount()), 0.0f, 0.0f, view, crowd.projection);
+            }
+            rasterizer.finish();
+            if (useCuller)
+            {
+                culler.issueQueries(crowd.projection * view, crowd.eye(step));
+            }
+        };
+
+        for (auto _ : state)
+        {
+            for (int step = 0; step < OCCLUSION_FRAMES; step++)
+            {
+                renderFrame(step, cull);
+            }
+        }
+        const double frames = static_cast<double>(state.iterations()) * OCCLUSION_FRAMES;
+
+        state.PauseTiming();
+        const OcclusionStats timed = culler.getStats();
+        for (uint32_t settle = 0; settle < 2 * OcclusionCuller::VISIBLE_PERSISTENCE; settle++)
+        {
+            renderFrame(OCCLUSION_FRAMES / 4, true);
+        }
+        const uint64_t culled = rasterizer.getChecksum();
+        renderFrame(OCCLUSION_FRAMES / 4, false);
+        const uint64_t reference = rasterizer.getChecksum();
+        state.ResumeTiming();
+        if (culled != reference)
+        {
+            state.SkipWithError("occlusion culling changed the image");
+            return;
+        }
+
+        ReportOcclusion(state, cull ? &timed : nullptr, frames);
+    }
+
+    void OcclusionGlBenchmark(bench::State &state, bool cull)
+    {
+        md2model::Md2 model(OCCLUSION_ASSET.model, OCCLUSION_ASSET.texture);
+        GlOcclusionBackend backend;
+        if (!model.isValid() || !backend.init())
+        {
+            state.SkipWithError(std::string("could not create ") + OCCLUSION_ASSET.name + " or the proxy shaders");
+            return;
+        }
+        OcclusionCrowd crowd(model);
+        OcclusionCuller culler(backend);
+        std::vector<uint32_t> draw;
+
+        for (auto _ : state)
+        {
+            for (int step = 0; step < OCCLUSION_FRAMES; step++)
+            {
+                glm::mat4 view = crowd.view(step);
+                md2model::KeyframeResidency::Global().BeginFrame();
+                if (cull)
+                {
+                    culler.beginFrame(crowd.candidates.data(), crowd.candidates.size(), draw);
+                }
+                else
+                {
+                    draw.clear();
+                    for (const OcclusionCandidate &candidate : crowd.candidates)
+                    {
+                        draw.push_back(candidate.id);
+                    }
+                }
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                for (uint32_t id : draw)
+                {
+                    model.SetPosition(crowd.positions[id]);
+                    model.Draw(crowd.animationFrame(id, step, model.GetFrameCount()), 0.0f, 0.0f, view, crowd.projection);
+                }
+                if (cull)
+                {
+                    culler.issueQueries(crowd.projection * view, crowd.eye(step));
+                }
+                // Include the GPU work, otherwise only command submission is measured
+                glFinish();
+            }
+        }
+        ReportOcclusion(state, cull ? &culler.getStats() : nullptr, static_cast<double>(state.iterations()) * OCCLUSION_FRAMES);
+    }
+
+    // A grid of copies of one model receding from the camera, each at its own point of the
+    // animation. Md2::DrawCrowd draws it with one instanced draw per frame and LOD, with one
+    // multi-draw indirect per clip, or with poses from a PoseCache in one instanced draw per
+    // LOD; the reference is one Md2::Draw per copy.
+    enum class CrowdPath
+    {
+        PER_DRAW,
+        INSTANCED,
+        MULTI_DRAW,
+        POSE_CACHE
+    };
+
+    constexpr int INSTANCED_COLUMNS = 32;
+    constexpr int INSTANCED_INSTANCES = INSTANCED_COLUMNS * INSTANCED_COLUMNS;
+    constexpr float INSTANCED_SPACING = 4.0f;
+    constexpr float INSTANCED_NEAR_Z = -40.0f;
+    constexpr float INSTANCED_ROW_DEPTH = 3.0f;
+    constexpr int INSTANCED_FRAMES = 60; // per iteration
+    const Asset &INSTANCED_ASSET = ASSETS[1];
+
+    void CrowdBenchmark(bench::State &state, CrowdPath path)
+    {
+        md2model::Md2 model(INSTANCED_ASSET.model, INSTANCED_ASSET.texture);
+        GpuRingBuffer ring;
+        GpuRingBuffer poseRing;
+        IndirectDrawBuffer commands;
+        md2model::PoseCache cache;
+        // At worst every copy has its own pose
+        const GLsizeiptr poseBytes = static_cast<GLsizeiptr>(INSTANCED_INSTANCES) * model.GetVertexCount() * md2model::POSITION_COMPONENTS * sizeof(float);
+        if (!model.isValid() || !ring.init(GL_ARRAY_BUFFER, INSTANCED_INSTANCES * md2model::CROWD_INSTANCE_BYTES) ||
+            (path == CrowdPath::POSE_CACHE && !poseRing.init(GL_TEXTURE_BUFFER, poseBytes)))
+        {
+            state.SkipWithError(std::string("could not create ") + INSTANCED_ASSET.name + " or the stream buffer");
+            return;
+        }
+        if (path == CrowdPath::MULTI_DRAW && (!IndirectDrawBuffer::isSupported() || !commands.init(INSTANCED_INSTANCES)))
+        {
+            state.SkipWithError("multi-draw indirect is not supported");
+            return;
+        }
+
+        std::mt19937 random(REPLAY_SEED);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<md2model::CrowdInstance> crowd(INSTANCED_INSTANCES);
+        std::vector<float> phases(INSTANCED_INSTANCES);
+        for (int i = 0; i < INSTANCED_INSTANCES; i++)
+        {
+            const int row = i / INSTANCED_COLUMNS;
+            const int column = i % INSTANCED_COLUMNS;
+            crowd[i].position = glm::vec3((row - INSTANCED_COLUMNS / 2) * INSTANCED_SPACING, (column - INSTANCED_COLUMNS / 2) * INSTANCED_SPACING, INSTANCED_NEAR_Z - row * INSTANCED_ROW_DEPTH);
+            crowd[i].angle = unit(random) * 360.0f;
+            phases[i] = unit(random) * model.GetFrameCount();
+        }
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 200.0f);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        md2model::KeyframeResidency &residency = md2model::KeyframeResidency::Global();
+
+        auto drawFrame = [&](int step)
+        {
+            for (int i = 0; i < INSTANCED_INSTANCES; i++)
+            {
+                const float phase = phases[i] + step * ANIMATION_VELOCITY * REPLAY_TIMESTEP;
+                const int whole = static_cast<int>(phase);
+                crowd[i].frame = whole % model.GetFrameCount();
+                crowd[i].interpolation = phase - whole;
+            }
+            LinearArena::frameArena().reset();
+            residency.BeginFrame();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            if (path == CrowdPath::INSTANCED)
+            {
+                ring.beginFrame();
+                bool drawn = model.DrawCrowd(crowd.data(), INSTANCED_INSTANCES, view, projection, ring);
+                ring.endFrame();
+                return drawn;
+            }
+            if (path == CrowdPath::MULTI_DRAW)
+            {
+                ring.beginFrame();
+                commands.beginFrame();
+                bool drawn = model.DrawCrowd(crowd.data(), INSTANCED_INSTANCES, view, projection, ring, &commands);
+                ring.endFrame();
+                commands.endFrame();
+                return drawn;
+            }
+            if (path == CrowdPath::POSE_CACHE)
+            {
+                cache.BeginFrame();
+                ring.beginFrame();
+                poseRing.beginFrame();
+                bool drawn = model.DrawCrowd(crowd.data(), INSTANCED_INSTANCES, view, projection, ring, cache, poseRing);
+                ring.endFrame();
+                poseRing.endFrame();
+                return drawn;
+            }
+            for (const md2model::CrowdInstance &instance : crowd)
+            {
+                model.SetPosition(instance.position);
+                model.Draw(instance.frame, instance.angle, instance.interpolation, view, projection);
+            }
+            return true;
+        };
+
+        // Uploads the clips and compiles the instancing variant before the measurement
+        for (int step = 0; step < INSTANCED_FRAMES; step++)
+        {
+            if (!drawFrame(step))
+            {
+                state.SkipWithError("the crowd does not fit the stream buffer");
+                return;
+            }
+        }
+        glFinish();
+        cache.ResetStats();
+
+        for (auto _ : state)
+        {
+            for (int step = 0; step < INSTANCED_FRAMES; step++)
+            {
+                drawFrame(step);
+                // Include the GPU work, otherwise only command submission is measured
+                glFinish();
+            }
+        }
+
+        const double frames = static_cast<double>(state.iterations()) * INSTANCED_FRAMES;
+        state.counters["instances"] = INSTANCED_INSTANCES;
+        state.counters["ms_per_frame"] = state.elapsedSeconds() * 1000.0 / frames;
+        state.counters["instances_per_second"] = INSTANCED_INSTANCES * frames / state.elapsedSeconds();
+        if (path != CrowdPath::PER_DRAW)
+        {
+            state.counters["stream_KB_per_frame"] = (ring.getUsedBytes() + poseRing.getUsedBytes() + commands.getUsedBytes()) / 1024.0;
+            state.counters["persistent"] = ring.isPersistent() ? 1 : 0;
+        }
+        if (path == CrowdPath::MULTI_DRAW)
+        {
+            state.counters["commands_per_frame"] = commands.getCommandCount();
+            state.counters["draw_calls_per_frame"] = commands.getDrawCallCount();
+        }
+        if (path == CrowdPath::POSE_CACHE)
+        {
+            state.counters["poses_per_frame"] = cache.GetStats().posesEvaluated / frames;
+            state.counters["max_error"] = cache.GetStats().maxError;
+        }
+    }
+
+    // A crowd in groups: everyone in a group plays the same clip, a little out of phase with
+    // the others. Each frame evaluates one pose per entity, directly with the CPU kernel
+    // (buckets = 0) or through a PoseCache with that many steps between keyframes.
+    constexpr int POSE_CROWD = 2000;
+    constexpr int POSE_GROUPS = 8;
+    constexpr float POSE_JITTER = 0.2f;     // phase spread within a group, in keyframes
+    constexpr int POSE_FRAMES = 60;         // per iteration
+
+    void PoseCacheBenchmark(bench::State &state, int buckets)
+    {
+        const Asset &asset = ASSETS[0];
+        std::unique_ptr<md2model::modData> model = md2model::LoadModelData(asset.model);
+        if (!model || model->clips.empty())
+        {
+            state.SkipWithError(std::string("could not load ") + asset.model);
+            return;
+        }
+
+        std::mt19937 random(REPLAY_SEED);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float groupPhases[POSE_GROUPS];
+        for (float &phase : groupPhases)
+        {
+            phase = unit(random) * 100.0f;
+        }
+        std::vector<float> phases(POSE_CROWD);
+        for (int i = 0; i < POSE_CROWD; i++)
+        {
+            phases[i] = groupPhases[i % POSE_GROUPS] + unit(random) * POSE_JITTER;
+        }
+
+        md2model::PoseCache cache(std::max(buckets, 1));
+        std::vector<float> positions(static_cast<size_t>(model->numPoints) * md2model::POSITION_COMPONENTS);
+        unsigned long long allocations = 0;
+        for (auto _ : state)
+        {
+            for (int step = 0; step < POSE_FRAMES; step++)
+            {
+                unsigned long long allocationsBefore = getHeapAllocationCount();
+                cache.BeginFrame();
+                for (int i = 0; i < POSE_CROWD; i++)
+                {
+                    const md2model::animationClip &clip = model->clips[(i % POSE_GROUPS) % model->clips.size()];
+                    const float phase = phases[i] + step * ANIMATION_VELOCITY * REPLAY_TIMESTEP;
+                    const int whole = static_cast<int>(phase);
+                    const int frameA = clip.firstFrame + whole % clip.frameCount;
+                    const int frameB = clip.firstFrame + (whole + 1) % clip.frameCount;
+                    const float t = phase - whole;
+                    if (buckets == 0)
+                    {
+                        md2model::InterpolatePose(*model, frameA, frameB, t, positions.data());
+                    }
+                    else
+                    {
+                        cache.Acquire(*model, frameA, frameB, t);
+                    }
+                }
+                allocations += getHeapAllocationCount() - allocationsBefore;
+            }
+        }
+
+        const double frames = static_cast<double>(state.iterations()) * POSE_FRAMES;
+        state.counters["ms_per_frame"] = state.elapsedSeconds() * 1000.0 / frames;
+        if (buckets == 0)
+        {
+            state.counters["vertices_evaluated_per_frame"] = static_cast<double>(POSE_CROWD) * model->numPoints;
+            return;
+        }
+        const md2model::PoseCacheStats &stats = cache.GetStats();
+        state.counters["hit_rate"] = static_cast<double>(stats.hits) / stats.requests;
+        state.counters["poses_per_frame"] = stats.posesEvaluated / frames;
+        state.counters["vertices_evaluated_per_frame"] = stats.verticesEvaluated / frames;
+        state.counters["vertices_saved_per_frame"] = stats.verticesSaved / frames;
+        state.counters["max_error"] = stats.maxError;
+        state.counters["mean_error"] = stats.errorSum / stats.requests;
+        state.counters["pool_KB"] = cache.GetPoolBytes() / 1024.0;
+        // The first frame sizes the pool and the table
+        state.counters["heap_allocs_per_frame"] = allocations / frames;
+    }
+
+    void RegisterAssetBenchmarks()
+    {
+        for (const Asset &asset : ASSETS)
+        {
+            std::string suffix = std::string("/") + asset.name;
+            bench::Register({"Md2::LoadModel" + suffix, [&asset](bench::State &state)
+                             { LoadModelBenchmark(state, asset); },
+                             false, 0});
+            bench::Register({"LoadTGA" + suffix, [&asset](bench::State &state)
+                             { LoadTgaBenchmark(state, asset); },
+                             false, 0});
+            bench::Register({"InterpolatePose" + suffix, [&asset](bench::State &state)
+                             { PoseKernelBenchmark(state, asset); },
+                             false, 0});
+            bench::Register({"Md2::Md2" + suffix, [&asset](bench::State &state)
+                             { Md2ConstructBenchmark(state, asset); },
+                             true, 5});
+            bench::Register({"Texture2D::loadTexture" + suffix, [&asset](bench::State &state)
+                             { LoadTextureBenchmark(state, asset); },
+                             true, 0});
+            bench::Register({"DrawReplay" + suffix, [&asset](bench::State &state)
+                             { DrawReplayBenchmark(state, asset); },
+                             true, 1});
+            bench::Register({"DrawPrep" + suffix, [&asset](bench::State &state)
+                             { DrawPrepBenchmark(state, asset); },
+                             true, 0});
+            bench::Register({"SoftwareRaster" + suffix, [&asset](bench::State &state)
+                             { SoftwareRasterBenchmark(state, asset); },
+                             false, 0});
+        }
+        bench::Register({"ShaderProgram::loadShaders", LoadShadersBenchmark, true, 0});
+        bench::Register({"FrameLookup/map", FrameLookupMapBenchmark, false, 0});
+        bench::Register({"FrameLookup/flat", FrameLookupFlatBenchmark, false, 0});
+        bench::Register({"CommandList/threads:1", [](bench::State &state)
+                         { CommandListBenchmark(state, 1); },
+                         false, 0});
+        bench::Register({"CommandList/threads:4", [](bench::State &state)
+                         { CommandListBenchmark(state, 4); },
+                         false, 0});
+        bench::Register({"CommandList/md2_replay", CommandReplayBenchmark, true, 0});
+        for (int entityCount : {10000, 100000})
+        {
+            std::string suffix = "/" + std::to_string(entityCount);
+            bench::Register({"SpatialIndex/tree" + suffix, [entityCount](bench::State &state)
+                             { SpatialIndexBenchmark(state, entityCount, false); },
+                             false, 0});
+            bench::Register({"SpatialIndex/linear" + suffix, [entityCount](bench::State &state)
+                             { SpatialIndexBenchmark(state, entityCount, true); },
+                             false, 0});
+        }
+        bench::Register({"Occlusion/software/off", [](bench::State &state)
+                         { OcclusionSoftwareBenchmark(state, false); },
+                         false, 0});
+        bench::Register({"Occlusion/software/on", [](bench::State &state)
+                         { OcclusionSoftwareBenchmark(state, true); },
+                         false, 0});
+        bench::Register({"Occlusion/gl/off", [](bench::State &state)
+                         { OcclusionGlBenchmark(state, false); },
+                         true, 0});
+        bench::Register({"Occlusion/gl/on", [](bench::State &state)
+                         { OcclusionGlBenchmark(state, true); },
+                         true, 0});
+        bench::Register({"Crowd/per_draw", [](bench::State &state)
+                         { CrowdBenchmark(state, CrowdPath::PER_DRAW); },
+                         true, 0});
+        bench::Register({"Crowd/instanced", [](bench::State &state)
+                         { CrowdBenchmark(state, CrowdPath::INSTANCED); },
+                         true, 0});
+        bench::Register({"Crowd/multi_draw", [](bench::State &state)
+                         { CrowdBenchmark(state, CrowdPath::MULTI_DRAW); },
+                         true, 0});
+        bench::Register({"Crowd/pose_cache", [](bench::State &state)
+                         { CrowdBenchmark(state, CrowdPath::POSE_CACHE); },
+                         true, 0});
+        for (int buckets : {0, 4, 16, 64})
+        {
+            bench::Register({"PoseCache/buckets:" + std::to_string(buckets), [buckets](bench::State &state)
+                             { PoseCacheBenchmark(state, buckets); },
+                             false, 0});
+        }
+        bench::Register({"FrameCapture/tga", [](bench::State &state)
+                         { FrameCaptureBenchmark(state, ".tga"); },
+                         true, 300});
+        bench::Register({"FrameCapture/png", [](bench::State &state)
+                         { FrameCaptureBenchmark(state, ".png"); },
+                         true, 300});
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool glAvailable = true;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--gl=0")
+        {
+            glAvailable = false;
+        }
+    }
+
+    GLFWwindow *window = glAvailable ? CreateHiddenContext() : nullptr;
+    glAvailable = window != nullptr;
+
+    std::map<std::string, std::string> context;
+    std::time_t now = std::time(nullptr);
+    char date[32];
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+    context["date"] = date;
+    context["pose_kernel"] = md2model::PoseKernelName();
+    context["gl_renderer"] = glAvailable ? reinterpret_cast<const char *>(glGetString(GL_RENDERER)) : "none";
+    context["replay_seed"] = std::to_string(REPLAY_SEED);
+
+    RegisterAssetBenchmarks();
+    int result = bench::RunAll(argc, argv, glAvailable, context);
+
+    if (window)
+    {
+        glfwDestroyWindow(window);
+    }
+    glfwTerminate();
+    return result;
+}
@@ -0,0 +1,262 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace bench;
+
+namespace
+{
+    constexpr double DEFAULT_MIN_TIME = 0.5; // seconds
+    constexpr int64_t MAX_ITERATIONS = 1000000000;
+
+    std::vector<Registration> &Registry()
+    {
+        static std::vector<Registration> registry;
+        return registry;
+    }
+
+    double CpuNow()
+    {
+        return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+    }
+
+    struct Result
+    {
+        std::string name;
+        int64_t iterations;
+        double realNanoseconds; // per iteration
+        double cpuNanoseconds;
+        std::string label;
+        std::string error;
+        std::map<std::string, double> counters;
+    };
+
+    std::string Escape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    std::string FormatTime(double nanoseconds)
+    {
+        std::ostringstream outs;
+        outs << std::fixed << std::setprecision(2);
+        if (nanoseconds >= 1.0e6)
+        {
+            outs << nanoseconds / 1.0e6 << " ms";
+        }
+        else if (nanoseconds >= 1.0e3)
+        {
+            outs << nanoseconds / 1.0e3 << " us";
+        }
+        else
+        {
+            outs << nanoseconds << " ns";
+        }
+        return outs.str();
+    }
+
+    void WriteJson(const std::string &fileName, const std::map<std::string, std::string> &context, const std::vector<Result> &results)
+    {
+        std::ofstream file(fileName);
+        if (!file)
+        {
+            std::cerr << "Could not write benchmark results to " << fileName << std::endl;
+            return;
+        }
+
+        file << "{\n  \"context\": {\n";
+        size_t i = 0;
+        for (const auto &entry : context)
+        {
+            file << "    \"" << Escape(entry.first) << "\": \"" << Escape(entry.second) << "\"" << (++i < context.size() ? "," : "") << "\n";
+        }
+        file << "  },\n  \"benchmarks\": [\n";
+
+        for (size_t r = 0; r < results.size(); r++)
+        {
+            const Result &result = results[r];
+            file << "    {\n      \"name\": \"" << Escape(result.name) << "\",\n";
+            if (!result.error.empty())
+            {
+                file << "      \"error_occurred\": true,\n      \"error_message\": \"" << Escape(result.error) << "\"\n";
+            }
+            else
+            {
+                file << "      \"iterations\": " << result.iterations << ",\n"
+                     << "      \"real_time\": " << std::setprecision(10) << result.realNanoseconds << ",\n"
+                     << "      \"cpu_time\": " << result.cpuNanoseconds << ",\n"
+                     << "      \"time_unit\": \"ns\"";
+                if (!result.label.empty())
+                {
+                    file << ",\n      \"label\": \"" << Escape(result.label) << "\"";
+                }
+                for (const auto &counter : result.counters)
+                {
+                    file << ",\n      \"" << Escape(counter.first) << "\": " << counter.second;
+                }
+                file << "\n";
+            }
+            file << "    }" << (r + 1 < results.size() ? "," : "") << "\n";
+        }
+        file << "  ]\n}\n";
+    }
+}
+
+State::State(int64_t iterations)
+    : _iterations(iterations),
+      _running(false),
+      _cpuStart(0.0),
+      _elapsed(0.0),
+      _cpuElapsed(0.0)
+{
+}
+
+State::Iterator State::begin()
+{
+    ResumeTiming();
+    return {this, _iterations};
+}
+
+bool State::Iterator::operator!=(const Iterator &) const
+{
+    if (remaining > 0 && state->_error.empty())
+    {
+        return true;
+    }
+    state->Stop();
+    return false;
+}
+
+void State::PauseTiming()
+{
+    Stop();
+}
+
+void State::ResumeTiming()
+{
+    _start = std::chrono::steady_clock::now();
+    _cpuStart = CpuNow();
+    _running = true;
+}
+
+void State::Stop()
+{
+    if (_running)
+    {
+        _elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+        _cpuElapsed += CpuNow() - _cpuStart;
+        _running = false;
+    }
+}
+
+int bench::Register(const Registration &registration)
+{
+    Registry().push_back(registration);
+    return static_cast<int>(Registry().size());
+}
+
+int bench::RunAll(int argc, char **argv, bool glAvailable, const std::map<std::string, std::string> &context)
+{
+    std::string jsonFile;
+    std::string filter;
+    double minTime = DEFAULT_MIN_TIME;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument.rfind("--json=", 0) == 0)
+        {
+            jsonFile = argument.substr(7);
+        }
+        else if (argument.rfind("--filter=", 0) == 0)
+        {
+            filter = argument.substr(9);
+        }
+        else if (argument.rfind("--min_time=", 0) == 0)
+        {
+            minTime = std::stod(argument.substr(11));
+        }
+    }
+
+    std::vector<Result> results;
+    std::cout << std::left << std::setw(44) << "Benchmark" << std::setw(16) << "Time" << std::setw(16) << "CPU" << "Iterations" << std::endl;
+
+    for (const Registration &registration : Registry())
+    {
+        if (!filter.empty() && registration.name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+
+        Result result{registration.name, 0, 0.0, 0.0, "", "", {}};
+        if (registration.needsGl && !glAvailable)
+        {
+            result.error = "skipped: no OpenGL context";
+            std::cout << std::setw(44) << registration.name << result.error << std::endl;
+            results.push_back(result);
+            continue;
+        }
+
+        // Same strategy as Google Benchmark: grow the iteration count until the
+        // measured time covers min_time
+        int64_t iterations = registration.iterations > 0 ? registration.iterations : 1;
+        while (true)
+        {
+            State state(iterations);
+            registration.function(state);
+
+            result.iterations = state.iterations();
+            result.realNanoseconds = state.elapsedSeconds() * 1.0e9 / iterations;
+            result.cpuNanoseconds = state.cpuSeconds() * 1.0e9 / iterations;
+            result.label = state.label();
+            result.error = state.error();
+            result.counters = state.counters;
+
+            if (registration.iterations > 0 || !result.error.empty() || state.elapsedSeconds() >= minTime || iterations >= MAX_ITERATIONS)
+            {
+                break;
+            }
+            double multiplier = state.elapsedSeconds() > 0.0 ? minTime * 1.4 / state.elapsedSeconds() : 10.0;
+            multiplier = std::min(std::max(multiplier, 2.0), 10.0);
+            iterations = std::min(static_cast<int64_t>(iterations * multiplier), MAX_ITERATIONS);
+        }
+
+        std::cout << std::setw(44) << result.name;
+        if (!result.error.empty())
+        {
+            std::cout << "ERROR: " << result.error << std::endl;
+        }
+        else
+        {
+            std::cout << std::setw(16) << FormatTime(result.realNanoseconds) << std::setw(16) << FormatTime(result.cpuNanoseconds) << result.iterations;
+            for (const auto &counter : result.counters)
+            {
+                std::cout << "  " << counter.first << "=" << counter.second;
+            }
+            std::cout << (result.label.empty() ? "" : "  " + result.label) << std::endl;
+        }
+        results.push_back(result);
+    }
+
+    if (!jsonFile.empty())
+    {
+        WriteJson(jsonFile, context, results);
+    }
+
+    bool failed = std::any_of(results.begin(), results.end(), [](const Result &result)
+                              { return !result.error.empty() && result.error.rfind("skipped", 0) != 0; });
+    return failed ? 1 : 0;
+}
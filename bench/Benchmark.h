@@ -0,0 +1,99 @@
+#pragma once
+
+// Minimal benchmark harness with the shape of Google Benchmark:
+//
+//     void BM_Something(bench::State &state)
+//     {
+//         for (auto _ : state)
+//         {
+//             ...
+//         }
+//         state.counters["items"] = 42;
+//     }
+//     BENCHMARK(BM_Something);
+//
+// Results are printed as a table and optionally written as JSON (--json=<file>) in
+// the same layout Google Benchmark uses, so runs from two commits can be diffed.
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    class State
+    {
+    public:
+        explicit State(int64_t iterations);
+
+        // `for (auto _ : state)` must not trigger unused variable warnings
+        struct [[maybe_unused]] Value
+        {
+        };
+
+        struct Iterator
+        {
+            State *state;
+            int64_t remaining;
+            bool operator!=(const Iterator &) const;
+            void operator++() { remaining--; }
+            Value operator*() const { return Value(); }
+        };
+
+        Iterator begin();
+        Iterator end() { return {this, 0}; }
+
+        // Excludes setup work inside the loop from the measurement
+        void PauseTiming();
+        void ResumeTiming();
+        void SkipWithError(const std::string &message) { _error = message; }
+        void SetLabel(const std::string &label) { _label = label; }
+
+        int64_t iterations() const { return _iterations; }
+        double elapsedSeconds() const { return _elapsed; }
+        double cpuSeconds() const { return _cpuElapsed; }
+        const std::string &error() const { return _error; }
+        const std::string &label() const { return _label; }
+
+        std::map<std::string, double> counters;
+
+    private:
+        void Stop();
+
+        int64_t _iterations;
+        bool _running;
+        std::chrono::steady_clock::time_point _start;
+        double _cpuStart;
+        double _elapsed;
+        double _cpuElapsed;
+        std::string _error;
+        std::string _label;
+    };
+
+    struct Registration
+    {
+        std::string name;
+        std::function<void(State &)> function;
+        bool needsGl;        // skipped when no OpenGL context could be created
+        int64_t iterations;  // 0 lets the runner pick a count that fills the minimum time
+    };
+
+    int Register(const Registration &registration);
+    // Parses --json=, --filter= and --min_time=, then runs every matching benchmark
+    int RunAll(int argc, char **argv, bool glAvailable, const std::map<std::string, std::string> &context);
+}
+
+#define BENCHMARK_CONCAT_INNER(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_INNER(a, b)
+#define BENCHMARK_REGISTER(function, gl, iterations) \
+    static int BENCHMARK_CONCAT(benchmarkRegistration, __LINE__) = bench::Register({#function, function, gl, iterations})
+
+// CPU-only benchmark
+#define BENCHMARK(function) BENCHMARK_REGISTER(function, false, 0)
+// Needs the hidden GL context created by the runner
+#define BENCHMARK_GL(function) BENCHMARK_REGISTER(function, true, 0)
+// Runs exactly `iterations` times, for benchmarks that are expensive or stateful
+#define BENCHMARK_GL_ITERATIONS(function, iterations) BENCHMARK_REGISTER(function, true, iterations)
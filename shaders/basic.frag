@@ -1,11 +1,22 @@
 #version 330 core
 
 in vec2 TexCoord;
+#ifdef FEATURE_FOG
+in float ViewDistance;
+#endif
 out vec4 frag_color;
 
 uniform sampler2D texSampler1;
+#ifdef FEATURE_FOG
+uniform vec3 fogColor = vec3(0.25, 0.2, 0.15);  // matches the clear color
+uniform float fogDensity = 0.02;
+#endif
 
 void main()
 {
 	frag_color = texture(texSampler1, TexCoord);
+#ifdef FEATURE_FOG
+	float visibility = clamp(exp(-fogDensity * ViewDistance), 0.0, 1.0);
+	frag_color.rgb = mix(fogColor, frag_color.rgb, visibility);
+#endif
 }
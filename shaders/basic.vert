@@ -3,8 +3,20 @@
 layout (location = 0) in vec3 pos;  // in local coords
 layout (location = 1) in vec3 nextPos;  // in local coords
 layout (location = 2) in vec2 texCoord;
+#ifdef FEATURE_INSTANCING
+layout (location = 3) in mat4 instanceModel;  // per-instance, locations 3-6
+layout (location = 7) in float instanceInterpolation;  // per-instance
+#endif
+#ifdef FEATURE_POSE_BUFFER
+layout (location = 8) in int pointIndex;  // model vertex of this wedge
+layout (location = 9) in int instancePose;  // per-instance, first float of the pose in `poses`
+uniform samplerBuffer poses;  // x, y, z per model vertex, evaluated on the CPU (PoseCache)
+#endif
 
 out vec2 TexCoord;
+#ifdef FEATURE_FOG
+out float ViewDistance;
+#endif
 
 uniform mat4 model;			// model matrix
 uniform mat4 view;			// view matrix
@@ -14,10 +26,28 @@ uniform float interpolation;
 
 void main()
 {
-	float InterpolatedDeltaX = (nextPos.x - pos.x) * interpolation;
-	float InterpolatedDeltaY = (nextPos.y - pos.y) * interpolation;
-	float InterpolatedDeltaZ = (nextPos.z - pos.z) * interpolation;
+#ifdef FEATURE_POSE_BUFFER
+	int base = instancePose + pointIndex * 3;
+	vec3 interpolatedPos = vec3(texelFetch(poses, base).r, texelFetch(poses, base + 1).r, texelFetch(poses, base + 2).r);
+#else
+#ifdef FEATURE_INSTANCING
+	float blend = instanceInterpolation;
+#else
+	float blend = interpolation;
+#endif
+	float InterpolatedDeltaX = (nextPos.x - pos.x) * blend;
+	float InterpolatedDeltaY = (nextPos.y - pos.y) * blend;
+	float InterpolatedDeltaZ = (nextPos.z - pos.z) * blend;
 	vec3 interpolatedPos = vec3(pos.x + InterpolatedDeltaX, pos.y + InterpolatedDeltaY, pos.z + InterpolatedDeltaZ);
-	gl_Position = projection * modelView * vec4(interpolatedPos, 1.0f);
+#endif
+#ifdef FEATURE_INSTANCING
+	vec4 viewPos = view * instanceModel * vec4(interpolatedPos, 1.0f);
+#else
+	vec4 viewPos = modelView * vec4(interpolatedPos, 1.0f);
+#endif
+	gl_Position = projection * viewPos;
 	TexCoord = texCoord;
+#ifdef FEATURE_FOG
+	ViewDistance = length(viewPos.xyz);
+#endif
 }
@@ -0,0 +1,12 @@
+#version 330 core
+
+layout (location = 0) in vec3 corner;  // unit cube, 0 or 1 per axis
+
+uniform mat4 viewProjection;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main()
+{
+	gl_Position = viewProjection * vec4(mix(boxMin, boxMax, corner), 1.0f);
+}
@@ -0,0 +1,163 @@
+#include "Arena.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<unsigned long long> heapAllocations(0);
+}
+
+// Replacing the global operator new is the only way to see every allocation made by
+// the standard containers. The array and nothrow forms call this one by default.
+void *operator new(std::size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0)
+    {
+        size = 1;
+    }
+    while (true)
+    {
+        void *pointer = std::malloc(size);
+        if (pointer)
+        {
+            return pointer;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+unsigned long long getHeapAllocationCount()
+{
+    return heapAllocations.load(std::memory_order_relaxed);
+}
+
+LinearArena::LinearArena(size_t blockSize)
+    : _blockSize(blockSize),
+      _current(0),
+      _offset(0),
+      _used(0),
+      _peak(0)
+{
+}
+
+LinearArena::~LinearArena()
+{
+    release();
+}
+
+void *LinearArena::allocate(size_t size, size_t alignment)
+{
+    while (true)
+    {
+        if (_current < _blocks.size())
+        {
+            const Block &block = _blocks[_current];
+            std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data);
+            size_t aligned = static_cast<size_t>(((base + _offset + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1)) - base);
+            if (aligned + size <= block.size)
+            {
+                _used += aligned + size - _offset;
+                _offset = aligned + size;
+                _peak = std::max(_peak, _used);
+                return block.data + aligned;
+            }
+
+            // The rest of this block stays unused until the arena is rewound
+            if (_current + 1 < _blocks.size() && size + alignment <= _blocks[_current + 1].size)
+            {
+                _current++;
+                _offset = 0;
+                continue;
+            }
+        }
+
+        size_t blockSize = std::max(_blockSize, size + alignment);
+        Block block{static_cast<unsigned char *>(::operator new(blockSize)), blockSize};
+        if (_blocks.empty())
+        {
+            _blocks.push_back(block);
+        }
+        else
+        {
+            _blocks.insert(_blocks.begin() + _current + 1, block);
+            _current++;
+        }
+        _offset = 0;
+    }
+}
+
+void LinearArena::rewind(const Marker &marker)
+{
+    if (marker.block == 0 && marker.offset == 0)
+    {
+        reset();
+        return;
+    }
+    _current = marker.block;
+    _offset = marker.offset;
+    _used = marker.used;
+}
+
+void LinearArena::reset()
+{
+    // Merge the chain, the next round then fits in one block
+    if (_blocks.size() > 1)
+    {
+        size_t capacity = getCapacity();
+        release();
+        _blocks.push_back({static_cast<unsigned char *>(::operator new(capacity)), capacity});
+    }
+    _current = 0;
+    _offset = 0;
+    _used = 0;
+}
+
+size_t LinearArena::getCapacity() const
+{
+    size_t capacity = 0;
+    for (const Block &block : _blocks)
+    {
+        capacity += block.size;
+    }
+    return capacity;
+}
+
+LinearArena &LinearArena::loadArena()
+{
+    thread_local LinearArena arena;
+    return arena;
+}
+
+LinearArena &LinearArena::frameArena()
+{
+    static LinearArena arena;
+    return arena;
+}
+
+void LinearArena::release()
+{
+    for (const Block &block : _blocks)
+    {
+        ::operator delete(block.data);
+    }
+    _blocks.clear();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator for short-lived data. Memory is never freed piece by piece; a whole
+// range is released at once with rewind() or reset(). When a block is full another
+// one is chained, and the next reset() merges them into a single block of the total
+// size, so after the first use the same workload makes no heap allocations.
+//
+//     {
+//         ArenaScope scope(LinearArena::loadArena());
+//         char *buffer = scope.arena().allocateArray<char>(length);
+//         ...
+//     } // everything allocated in the scope is released here
+class LinearArena
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+    struct Marker
+    {
+        size_t block;
+        size_t offset;
+        size_t used;
+    };
+
+    explicit LinearArena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+    ~LinearArena();
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    template <typename T>
+    T *allocateArray(size_t count)
+    {
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    Marker mark() const { return {_current, _offset, _used}; }
+    // Releases everything allocated after the marker was taken
+    void rewind(const Marker &marker);
+    void reset();
+
+    size_t getUsedBytes() const { return _used; }
+    size_t getPeakBytes() const { return _peak; }
+    size_t getCapacity() const;
+    size_t getBlockCount() const { return _blocks.size(); }
+
+    // Scratch memory for loading assets, one arena per thread so loaders can run in parallel
+    static LinearArena &loadArena();
+    // Scratch of the current frame (Md2::DrawCrowd sort keys), reset at the start of every
+    // frame. Only used from the render thread.
+    static LinearArena &frameArena();
+
+private:
+    LinearArena(const LinearArena &rhs) = delete;
+    LinearArena &operator=(const LinearArena &rhs) = delete;
+
+    struct Block
+    {
+        unsigned char *data;
+        size_t size;
+    };
+
+    void release();
+
+    size_t _blockSize;
+    std::vector<Block> _blocks;
+    size_t _current;
+    size_t _offset;
+    size_t _used;
+    size_t _peak;
+};
+
+// Rewinds the arena to where it was when the scope was entered
+class ArenaScope
+{
+public:
+    explicit ArenaScope(LinearArena &arena) : _arena(arena), _marker(arena.mark()) {}
+    ~ArenaScope() { _arena.rewind(_marker); }
+    LinearArena &arena() { return _arena; }
+
+private:
+    ArenaScope(const ArenaScope &rhs) = delete;
+    ArenaScope &operator=(const ArenaScope &rhs) = delete;
+
+    LinearArena &_arena;
+    LinearArena::Marker _marker;
+};
+
+// Number of calls to the global operator new since the program started. Two readings
+// around a frame show whether the frame touched the heap.
+unsigned long long getHeapAllocationCount();
@@ -0,0 +1,359 @@
+#include "CommandList.h"
+#include "GL/glew.h"
+#include <algorithm>
+#include <cstring>
+
+#include <glm/gtc/type_ptr.hpp>
+
+namespace
+{
+    // Every command starts with this, payloads follow unaligned and are read with memcpy
+    struct CommandHeader
+    {
+        uint8_t type;
+        uint8_t size; // payload bytes
+    };
+
+    struct TextureBinding
+    {
+        uint32_t unit;
+        uint32_t texture;
+    };
+
+    struct UniformFloat
+    {
+        int32_t location;
+        float value;
+    };
+
+    struct UniformMat4
+    {
+        int32_t location;
+        float value[16];
+    };
+
+    struct DrawIndexed
+    {
+        uint32_t count;
+        uint32_t firstIndex;
+        uint32_t instanceCount;
+        IndexType type;
+    };
+
+    template <typename T>
+    T Read(const unsigned char *data)
+    {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+}
+
+uint64_t CommandList::makeSortKey(unsigned int program, unsigned int texture, float depth)
+{
+    uint32_t depthBits;
+    depth = std::max(depth, 0.0f);
+    std::memcpy(&depthBits, &depth, sizeof(depthBits));
+    return (static_cast<uint64_t>(program & 0xFFFF) << 48) | (static_cast<uint64_t>(texture & 0xFFFF) << 32) | depthBits;
+}
+
+void CommandList::reset()
+{
+    // Capacity is kept, a list that is reused every frame stops allocating
+    _bytes.clear();
+    _packets.clear();
+}
+
+void CommandList::beginPacket(uint64_t sortKey)
+{
+    uint32_t offset = static_cast<uint32_t>(_bytes.size());
+    if (!_packets.empty())
+    {
+        _packets.back().end = offset;
+    }
+    _packets.push_back({sortKey, offset, offset});
+}
+
+void CommandList::bindProgram(unsigned int program)
+{
+    uint32_t value = program;
+    write(BIND_PROGRAM, &value, sizeof(value));
+}
+
+void CommandList::bindTexture(unsigned int unit, unsigned int texture)
+{
+    TextureBinding binding{unit, texture};
+    write(BIND_TEXTURE, &binding, sizeof(binding));
+}
+
+void CommandList::bindVertexArray(unsigned int vertexArray)
+{
+    uint32_t value = vertexArray;
+    write(BIND_VERTEX_ARRAY, &value, sizeof(value));
+}
+
+void CommandList::setUniform(int location, float value)
+{
+    UniformFloat uniform{location, value};
+    write(UNIFORM_FLOAT, &uniform, sizeof(uniform));
+}
+
+void CommandList::setUniform(int location, const glm::mat4 &value)
+{
+    UniformMat4 uniform;
+    uniform.location = location;
+    std::memcpy(uniform.value, glm::value_ptr(value), sizeof(uniform.value));
+    write(UNIFORM_MAT4, &uniform, sizeof(uniform));
+}
+
+void CommandList::drawIndexed(unsigned int count, unsigned int firstIndex, IndexType type, unsigned int instanceCount)
+{
+    DrawIndexed draw{count, firstIndex, instanceCount, type};
+    write(DRAW_INDEXED, &draw, sizeof(draw));
+}
+
+void CommandList::timeDraw(unsigned int query)
+{
+    uint32_t value = query;
+    write(TIME_DRAW, &value, sizeof(value));
+}
+
+void CommandList::write(CommandType type, const void *payload, size_t size)
+{
+    // Commands recorded before the first beginPacket() form a packet with key 0
+    if (_packets.empty())
+    {
+        _packets.push_back({0, 0, 0});
+    }
+
+    CommandHeader header{type, static_cast<uint8_t>(size)};
+    size_t offset = _bytes.size();
+    _bytes.resize(offset + sizeof(header) + size);
+    std::memcpy(&_bytes[offset], &header, sizeof(header));
+    std::memcpy(&_bytes[offset + sizeof(header)], payload, size);
+    _packets.back().end = static_cast<uint32_t>(_bytes.size());
+}
+
+void CommandExecutor::execute(const CommandList *const *lists, size_t listCount, CommandBackend &backend)
+{
+    _entries.clear();
+    for (size_t i = 0; i < listCount; i++)
+    {
+        const CommandList &list = *lists[i];
+        for (uint32_t packet = 0; packet < list._packets.size(); packet++)
+        {
+            _entries.push_back({list._packets[packet].sortKey, static_cast<uint32_t>(_entries.size()), &list, packet});
+        }
+    }
+    // Ties broken by merge order instead of std::stable_sort, which allocates a buffer every call
+    std::sort(_entries.begin(), _entries.end(), [](const Entry &a, const Entry &b)
+              { return a.sortKey != b.sortKey ? a.sortKey < b.sortKey : a.order < b.order; });
+
+    // State left by other code is unknown, the first binding of each kind always goes through
+    _program = ~0u;
+    _vertexArray = ~0u;
+    std::fill(std::begin(_textures), std::end(_textures), ~0u);
+    for (const Entry &entry : _entries)
+    {
+        replay(*entry.list, entry.list->_packets[entry.packet], backend);
+    }
+    _stats.packets += _entries.size();
+}
+
+void CommandExecutor::replay(const CommandList &list, const CommandList::Packet &packet, CommandBackend &backend)
+{
+    const unsigned char *data = list._bytes.data() + packet.begin;
+    const unsigned char *end = list._bytes.data() + packet.end;
+    uint32_t timerQuery = 0; // set by TIME_DRAW for the next draw of this packet
+    while (data < end)
+    {
+        CommandHeader header = Read<CommandHeader>(data);
+        const unsigned char *payload = data + sizeof(header);
+        data = payload + header.size;
+        _stats.commands++;
+
+        switch (header.type)
+        {
+        case CommandList::BIND_PROGRAM:
+        {
+            uint32_t program = Read<uint32_t>(payload);
+            if (program == _program)
+            {
+                _stats.redundantBindings++;
+                break;
+            }
+            _program = program;
+            backend.bindProgram(program);
+            break;
+        }
+        case CommandList::BIND_TEXTURE:
+        {
+            TextureBinding binding = Read<TextureBinding>(payload);
+            if (binding.unit < MAX_TEXTURE_UNITS && _textures[binding.unit] == binding.texture)
+            {
+                _stats.redundantBindings++;
+                break;
+            }
+            if (binding.unit < MAX_TEXTURE_UNITS)
+            {
+                _textures[binding.unit] = binding.texture;
+            }
+            backend.bindTexture(binding.unit, binding.texture);
+            break;
+        }
+        case CommandList::BIND_VERTEX_ARRAY:
+        {
+            uint32_t vertexArray = Read<uint32_t>(payload);
+            if (vertexArray == _vertexArray)
+            {
+                _stats.redundantBindings++;
+                break;
+            }
+            _vertexArray = vertexArray;
+            backend.bindVertexArray(vertexArray);
+            break;
+        }
+        case CommandList::UNIFORM_FLOAT:
+        {
+            UniformFloat uniform = Read<UniformFloat>(payload);
+            backend.setUniform(uniform.location, uniform.value);
+            break;
+        }
+        case CommandList::UNIFORM_MAT4:
+        {
+            UniformMat4 uniform = Read<UniformMat4>(payload);
+            backend.setUniform(uniform.location, glm::make_mat4(uniform.value));
+            break;
+        }
+        case CommandList::DRAW_INDEXED:
+        {
+            DrawIndexed draw = Read<DrawIndexed>(payload);
+            if (timerQuery != 0)
+            {
+                backend.beginTimer(timerQuery);
+            }
+            backend.drawIndexed(draw.count, draw.firstIndex, draw.type, draw.instanceCount);
+            if (timerQuery != 0)
+            {
+                backend.endTimer();
+                timerQuery = 0;
+            }
+            _stats.draws++;
+            break;
+        }
+        case CommandList::TIME_DRAW:
+        {
+            timerQuery = Read<uint32_t>(payload);
+            break;
+        }
+        }
+    }
+}
+
+void GlCommandBackend::bindProgram(unsigned int program)
+{
+    glUseProgram(program);
+}
+
+void GlCommandBackend::bindTexture(unsigned int unit, unsigned int texture)
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void GlCommandBackend::bindVertexArray(unsigned int vertexArray)
+{
+    glBindVertexArray(vertexArray);
+}
+
+void GlCommandBackend::setUniform(int location, float value)
+{
+    glUniform1f(location, value);
+}
+
+void GlCommandBackend::setUniform(int location, const glm::mat4 &value)
+{
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void GlCommandBackend::drawIndexed(unsigned int count, unsigned int firstIndex, IndexType type, unsigned int instanceCount)
+{
+    const GLenum indexType = type == IndexType::UINT16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    const size_t indexSize = type == IndexType::UINT16 ? sizeof(GLushort) : sizeof(GLuint);
+    const GLvoid *indices = (GLvoid *)(firstIndex * indexSize);
+    if (instanceCount == 1)
+    {
+        glDrawElements(GL_TRIANGLES, count, indexType, indices);
+    }
+    else
+    {
+        glDrawElementsInstanced(GL_TRIANGLES, count, indexType, indices, instanceCount);
+    }
+}
+
+void GlCommandBackend::beginTimer(unsigned int query)
+{
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void GlCommandBackend::endTimer()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void NullCommandBackend::bindProgram(unsigned int program)
+{
+    record(CALL_BIND_PROGRAM, program, 0);
+}
+
+void NullCommandBackend::bindTexture(unsigned int unit, unsigned int texture)
+{
+    record(CALL_BIND_TEXTURE, texture, static_cast<int>(unit));
+}
+
+void NullCommandBackend::bindVertexArray(unsigned int vertexArray)
+{
+    record(CALL_BIND_VERTEX_ARRAY, vertexArray, 0);
+}
+
+void NullCommandBackend::setUniform(int location, float)
+{
+    record(CALL_UNIFORM, 0, location);
+}
+
+void NullCommandBackend::setUniform(int location, const glm::mat4 &)
+{
+    record(CALL_UNIFORM, 0, location);
+}
+
+void NullCommandBackend::drawIndexed(unsigned int count, unsigned int firstIndex, IndexType, unsigned int instanceCount)
+{
+    record(CALL_DRAW, count, static_cast<int>(firstIndex));
+    _indices += static_cast<unsigned long long>(count) * instanceCount;
+}
+
+void NullCommandBackend::beginTimer(unsigned int query)
+{
+    record(CALL_BEGIN_TIMER, query, 0);
+}
+
+void NullCommandBackend::endTimer()
+{
+    record(CALL_END_TIMER, 0, 0);
+}
+
+void NullCommandBackend::clear()
+{
+    _calls.clear();
+    std::fill(std::begin(_counts), std::end(_counts), 0ull);
+    _indices = 0;
+}
+
+void NullCommandBackend::record(CallType type, unsigned int handle, int argument)
+{
+    _counts[type]++;
+    if (_trace)
+    {
+        _calls.push_back({type, handle, argument});
+    }
+}
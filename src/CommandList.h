@@ -0,0 +1,211 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Deferred draw submission. Any thread records draw packets into its own CommandList
+// (a linear byte buffer that keeps its capacity between frames); the GL thread then
+// hands all lists to a CommandExecutor, which orders the packets by sort key and replays
+// them into a CommandBackend. Only the backend makes API calls, so culling, sorting and
+// packet building can run on workers while GL stays single-threaded.
+//
+//     // worker i
+//     lists[i].reset();
+//     lists[i].beginPacket(CommandList::makeSortKey(program, texture, depth));
+//     lists[i].bindProgram(program);
+//     ...
+//     lists[i].drawIndexed(count, firstIndex);
+//
+//     // GL thread, after joining the workers
+//     executor.execute(listPointers, glBackend);
+//
+// A packet carries all of its state, so packets can be reordered freely; the executor
+// drops bindings that are already current.
+
+enum class IndexType : uint8_t
+{
+    UINT16,
+    UINT32
+};
+
+// What the recorded commands turn into. GlCommandBackend issues GL calls, NullCommandBackend
+// only counts (and optionally traces) them.
+class CommandBackend
+{
+public:
+    virtual ~CommandBackend() = default;
+    virtual void bindProgram(unsigned int program) = 0;
+    virtual void bindTexture(unsigned int unit, unsigned int texture) = 0;
+    virtual void bindVertexArray(unsigned int vertexArray) = 0;
+    virtual void setUniform(int location, float value) = 0;
+    virtual void setUniform(int location, const glm::mat4 &value) = 0;
+    virtual void drawIndexed(unsigned int count, unsigned int firstIndex, IndexType type, unsigned int instanceCount) = 0;
+    // Around a draw recorded with timeDraw(), for GPU timer queries
+    virtual void beginTimer(unsigned int query) = 0;
+    virtual void endTimer() = 0;
+};
+
+class CommandList
+{
+public:
+    CommandList() = default;
+
+    // Program and texture in the high bits so state changes are minimized, then depth
+    // (front to back, a non-negative float's bits sort like the float)
+    static uint64_t makeSortKey(unsigned int program, unsigned int texture, float depth);
+
+    void reset();
+
+    // Everything recorded up to the next beginPacket() belongs to this packet
+    void beginPacket(uint64_t sortKey);
+    void bindProgram(unsigned int program);
+    void bindTexture(unsigned int unit, unsigned int texture);
+    void bindVertexArray(unsigned int vertexArray);
+    void setUniform(int location, float value);
+    void setUniform(int location, const glm::mat4 &value);
+    void drawIndexed(unsigned int count, unsigned int firstIndex, IndexType type = IndexType::UINT16, unsigned int instanceCount = 1);
+    // The next draw of the packet is measured into this GL_TIME_ELAPSED query
+    void timeDraw(unsigned int query);
+
+    size_t getPacketCount() const { return _packets.size(); }
+    size_t getByteSize() const { return _bytes.size(); }
+
+private:
+    friend class CommandExecutor;
+
+    enum CommandType : uint8_t
+    {
+        BIND_PROGRAM,
+        BIND_TEXTURE,
+        BIND_VERTEX_ARRAY,
+        UNIFORM_FLOAT,
+        UNIFORM_MAT4,
+        DRAW_INDEXED,
+        TIME_DRAW
+    };
+
+    struct Packet
+    {
+        uint64_t sortKey;
+        uint32_t begin; // byte range in _bytes
+        uint32_t end;
+    };
+
+    CommandList(const CommandList &rhs) = delete;
+    CommandList &operator=(const CommandList &rhs) = delete;
+
+    void write(CommandType type, const void *payload, size_t size);
+
+    std::vector<unsigned char> _bytes;
+    std::vector<Packet> _packets;
+};
+
+struct CommandStats
+{
+    unsigned long long packets;
+    unsigned long long commands;
+    unsigned long long draws;
+    unsigned long long redundantBindings; // skipped because the state was already current
+};
+
+// Merges command lists on the submitting thread and replays them in sort key order.
+// Packets with equal keys keep their recording order, lists in the order given.
+class CommandExecutor
+{
+public:
+    static constexpr unsigned int MAX_TEXTURE_UNITS = 16;
+
+    CommandExecutor() = default;
+
+    void execute(const CommandList *const *lists, size_t listCount, CommandBackend &backend);
+    void execute(const std::vector<CommandList *> &lists, CommandBackend &backend) { execute(lists.data(), lists.size(), backend); }
+
+    // Totals since construction
+    const CommandStats &getStats() const { return _stats; }
+
+private:
+    CommandExecutor(const CommandExecutor &rhs) = delete;
+    CommandExecutor &operator=(const CommandExecutor &rhs) = delete;
+
+    struct Entry
+    {
+        uint64_t sortKey;
+        uint32_t order; // position in the merged sequence
+        const CommandList *list;
+        uint32_t packet;
+    };
+
+    void replay(const CommandList &list, const CommandList::Packet &packet, CommandBackend &backend);
+
+    std::vector<Entry> _entries; // reused between frames
+    CommandStats _stats = {};
+    unsigned int _program = 0;
+    unsigned int _vertexArray = 0;
+    unsigned int _textures[MAX_TEXTURE_UNITS] = {};
+};
+
+// Issues the commands as GL calls. Needs the GL context to be current.
+class GlCommandBackend : public CommandBackend
+{
+public:
+    void bindProgram(unsigned int program) override;
+    void bindTexture(unsigned int unit, unsigned int texture) override;
+    void bindVertexArray(unsigned int vertexArray) override;
+    void setUniform(int location, float value) override;
+    void setUniform(int location, const glm::mat4 &value) override;
+    void drawIndexed(unsigned int count, unsigned int firstIndex, IndexType type, unsigned int instanceCount) override;
+    void beginTimer(unsigned int query) override;
+    void endTimer() override;
+};
+
+// Backend without an API: counts calls and, when tracing, keeps them in order so a
+// replay can be compared against what was expected. Used by the benchmarks and for
+// checking submission without a GPU.
+class NullCommandBackend : public CommandBackend
+{
+public:
+    enum CallType
+    {
+        CALL_BIND_PROGRAM,
+        CALL_BIND_TEXTURE,
+        CALL_BIND_VERTEX_ARRAY,
+        CALL_UNIFORM,
+        CALL_DRAW,
+        CALL_BEGIN_TIMER,
+        CALL_END_TIMER
+    };
+
+    struct Call
+    {
+        CallType type;
+        unsigned int handle; // program, texture, vertex array, index count or query
+        int argument;        // texture unit, uniform location or first index
+    };
+
+    explicit NullCommandBackend(bool trace = false) : _trace(trace) {}
+
+    void bindProgram(unsigned int program) override;
+    void bindTexture(unsigned int unit, unsigned int texture) override;
+    void bindVertexArray(unsigned int vertexArray) override;
+    void setUniform(int location, float value) override;
+    void setUniform(int location, const glm::mat4 &value) override;
+    void drawIndexed(unsigned int count, unsigned int firstIndex, IndexType type, unsigned int instanceCount) override;
+    void beginTimer(unsigned int query) override;
+    void endTimer() override;
+
+    void clear();
+    unsigned long long getCallCount(CallType type) const { return _counts[type]; }
+    unsigned long long getIndexCount() const { return _indices; }
+    const std::vector<Call> &getTrace() const { return _calls; }
+
+private:
+    void record(CallType type, unsigned int handle, int argument);
+
+    bool _trace;
+    std::vector<Call> _calls;
+    unsigned long long _counts[CALL_END_TIMER + 1] = {};
+    unsigned long long _indices = 0;
+};
@@ -0,0 +1,442 @@
+#include "FrameCapture.h"
+#include "TgaLoader.h"
+#include "MemoryTracker.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    constexpr int BYTES_PER_PIXEL = 4; // GL_BGRA
+    constexpr GLuint64 FENCE_TIMEOUT_NS = 1000000;
+    const char *const MEMORY_ASSET = "FrameCapture";
+
+    // PNG without zlib: the image data goes into stored (uncompressed) deflate blocks,
+    // which every decoder accepts. Files are the size of a TGA.
+    constexpr unsigned char PNG_SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    constexpr size_t MAX_STORED_BLOCK = 65535;
+    constexpr unsigned int ADLER_MODULUS = 65521;
+
+    unsigned int Crc32(unsigned int crc, const unsigned char *data, size_t size)
+    {
+        static unsigned int table[256] = {};
+        if (table[1] == 0)
+        {
+            for (unsigned int i = 0; i < 256; i++)
+            {
+                unsigned int value = i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    value = value & 1 ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+                }
+                table[i] = value;
+            }
+        }
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void PutBigEndian(unsigned char *out, unsigned int value)
+    {
+        out[0] = static_cast<unsigned char>(value >> 24);
+        out[1] = static_cast<unsigned char>(value >> 16);
+        out[2] = static_cast<unsigned char>(value >> 8);
+        out[3] = static_cast<unsigned char>(value);
+    }
+
+    void WriteChunk(std::ofstream &file, const char *type, const unsigned char *data, size_t size)
+    {
+        unsigned char length[4];
+        unsigned char crc[4];
+        PutBigEndian(length, static_cast<unsigned int>(size));
+        unsigned int checksum = Crc32(0, reinterpret_cast<const unsigned char *>(type), 4);
+        PutBigEndian(crc, Crc32(checksum, data, size));
+        file.write(reinterpret_cast<const char *>(length), 4);
+        file.write(type, 4);
+        file.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+        file.write(reinterpret_cast<const char *>(crc), 4);
+    }
+
+    // `pixels` are BGRA rows bottom to top, as read back; `scratch` is reused between frames
+    bool SavePNG(const char *filename, const unsigned char *pixels, int width, int height, std::vector<unsigned char> &scratch)
+    {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cerr << "Could not create file " << filename << "." << std::endl;
+            return false;
+        }
+
+        // Filter byte 0 per row, RGBA, top row first
+        const size_t rowSize = static_cast<size_t>(width) * BYTES_PER_PIXEL + 1;
+        const size_t rawSize = rowSize * height;
+        const size_t blockCount = (rawSize + MAX_STORED_BLOCK - 1) / MAX_STORED_BLOCK;
+        scratch.resize(2 + rawSize + blockCount * 5 + 4);
+
+        unsigned char *raw = scratch.data() + scratch.size() - rawSize - 4;
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char *source = pixels + static_cast<size_t>(height - 1 - y) * width * BYTES_PER_PIXEL;
+            unsigned char *row = raw + y * rowSize;
+            row[0] = 0;
+            for (int x = 0; x < width; x++)
+            {
+                row[1 + x * 4] = source[x * 4 + 2];
+                row[2 + x * 4] = source[x * 4 + 1];
+                row[3 + x * 4] = source[x * 4];
+                row[4 + x * 4] = source[x * 4 + 3];
+            }
+        }
+
+        unsigned int a = 1;
+        unsigned int b = 0;
+        for (size_t i = 0; i < rawSize; i++)
+        {
+            a = (a + raw[i]) % ADLER_MODULUS;
+            b = (b + a) % ADLER_MODULUS;
+        }
+
+        // The block headers go in front of the data, moving it forward as they are written
+        unsigned char *out = scratch.data();
+        *out++ = 0x78; // zlib header: deflate, 32K window, no compression level
+        *out++ = 0x01;
+        for (size_t offset = 0; offset < rawSize; offset += MAX_STORED_BLOCK)
+        {
+            size_t length = std::min(MAX_STORED_BLOCK, rawSize - offset);
+            *out++ = offset + length == rawSize ? 1 : 0;
+            *out++ = static_cast<unsigned char>(length);
+            *out++ = static_cast<unsigned char>(length >> 8);
+            *out++ = static_cast<unsigned char>(~length);
+            *out++ = static_cast<unsigned char>(~length >> 8);
+            std::memmove(out, raw + offset, length);
+            out += length;
+        }
+        PutBigEndian(out, (b << 16) | a);
+        out += 4;
+
+        unsigned char header[13] = {};
+        PutBigEndian(header, static_cast<unsigned int>(width));
+        PutBigEndian(header + 4, static_cast<unsigned int>(height));
+        header[8] = 8; // bits per channel
+        header[9] = 6; // RGBA
+
+        file.write(reinterpret_cast<const char *>(PNG_SIGNATURE), sizeof(PNG_SIGNATURE));
+        WriteChunk(file, "IHDR", header, sizeof(header));
+        WriteChunk(file, "IDAT", scratch.data(), out - scratch.data());
+        WriteChunk(file, "IEND", nullptr, 0);
+        if (!file)
+        {
+            std::cerr << "Could not write PNG data to " << filename << "." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool IsPng(const char *filename)
+    {
+        size_t length = std::strlen(filename);
+        return length >= 4 && (std::strcmp(filename + length - 4, ".png") == 0 || std::strcmp(filename + length - 4, ".PNG") == 0);
+    }
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+FrameCapture::FrameCapture()
+    : _width(0),
+      _height(0),
+      _framebuffer(0),
+      _colorBuffer(0),
+      _depthBuffer(0),
+      _readSlot(0),
+      _mapSlot(0),
+      _stats(),
+      _stop(false)
+{
+    for (Slot &slot : _slots)
+    {
+        slot.buffer = 0;
+        slot.fence = nullptr;
+        slot.pixels = nullptr;
+        slot.state.store(FREE, std::memory_order_relaxed);
+        slot.written = false;
+        slot.filename[0] = '\0';
+    }
+    _worker = std::thread(&FrameCapture::encode, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_one();
+    _worker.join();
+    release();
+}
+
+bool FrameCapture::init(int width, int height, bool offscreen)
+{
+    finish();
+    release();
+    _width = width;
+    _height = height;
+    const size_t frameBytes = static_cast<size_t>(width) * height * BYTES_PER_PIXEL;
+
+    for (Slot &slot : _slots)
+    {
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, nullptr, GL_STREAM_READ);
+        MemoryTracker::global().trackBuffer(slot.buffer, frameBytes, MemoryTracker::STREAM, MEMORY_ASSET);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (offscreen)
+    {
+        glGenRenderbuffers(1, &_colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, _colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glGenRenderbuffers(1, &_depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, _depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        // Renderbuffers have their own names, they are accounted like texture memory
+        MemoryTracker::global().allocate(MemoryTracker::STREAM, MEMORY_ASSET, MemoryTracker::GPU_TEXTURE, frameBytes * 2);
+
+        glGenFramebuffers(1, &_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depthBuffer);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cerr << "Error: Capture framebuffer is incomplete (0x" << std::hex << status << std::dec << ")" << std::endl;
+            release();
+            return false;
+        }
+    }
+    return true;
+}
+
+void FrameCapture::bindFramebuffer() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glViewport(0, 0, _width, _height);
+}
+
+bool FrameCapture::capture(const char *filename)
+{
+    auto start = std::chrono::steady_clock::now();
+    _stats.requested++;
+    recycleSlots();
+
+    Slot &slot = _slots[_readSlot];
+    if (!isInitialized() || slot.state.load(std::memory_order_acquire) != FREE)
+    {
+        _stats.dropped++;
+        _stats.renderThreadMilliseconds += MillisecondsSince(start);
+        return false;
+    }
+    std::strncpy(slot.filename, filename, MAX_FILENAME - 1);
+    slot.filename[MAX_FILENAME - 1] = '\0';
+
+    // With a pack buffer bound glReadPixels only queues the copy and returns
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _framebuffer);
+    glReadBuffer(_framebuffer != 0 ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glReadPixels(0, 0, _width, _height, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.state.store(READING, std::memory_order_relaxed);
+    _readSlot = (_readSlot + 1) % RING_SIZE;
+
+    _stats.renderThreadMilliseconds += MillisecondsSince(start);
+    return true;
+}
+
+void FrameCapture::update()
+{
+    auto start = std::chrono::steady_clock::now();
+    recycleSlots();
+
+    // Hand over every finished readback, oldest first, without waiting for the GPU
+    while (_slots[_mapSlot].state.load(std::memory_order_relaxed) == READING && mapSlot(_slots[_mapSlot], false))
+    {
+        _mapSlot = (_mapSlot + 1) % RING_SIZE;
+    }
+    _stats.renderThreadMilliseconds += MillisecondsSince(start);
+}
+
+void FrameCapture::finish()
+{
+    while (_slots[_mapSlot].state.load(std::memory_order_relaxed) == READING)
+    {
+        mapSlot(_slots[_mapSlot], true);
+        _mapSlot = (_mapSlot + 1) % RING_SIZE;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _encoded.wait(lock, [this]()
+                      {
+                          for (const Slot &slot : _slots)
+                          {
+                              const int state = slot.state.load(std::memory_order_acquire);
+                              if (state == ENCODING || state == SKIPPED)
+                              {
+                                  return false;
+                              }
+                          }
+                          return true; });
+    }
+    recycleSlots();
+}
+
+bool FrameCapture::mapSlot(Slot &slot, bool wait)
+{
+    GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? FENCE_TIMEOUT_NS : 0);
+    while (wait && result == GL_TIMEOUT_EXPIRED)
+    {
+        result = glClientWaitSync(slot.fence, 0, FENCE_TIMEOUT_NS);
+    }
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        return false;
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    // The copy is complete, mapping does not stall. The mapping stays alive while the
+    // worker encodes from it and is released by recycleSlots().
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    slot.pixels = static_cast<const unsigned char *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(_width) * _height * BYTES_PER_PIXEL, GL_MAP_READ_BIT));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!slot.pixels)
+    {
+        std::cerr << "Error: Could not map the readback of " << slot.filename << ", frame dropped" << std::endl;
+        _stats.dropped++;
+    }
+
+    // The worker takes slots in ring order, so a dropped frame still passes through it
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        slot.state.store(slot.pixels ? ENCODING : SKIPPED, std::memory_order_release);
+    }
+    _wake.notify_one();
+    return true;
+}
+
+void FrameCapture::recycleSlots()
+{
+    for (Slot &slot : _slots)
+    {
+        if (slot.state.load(std::memory_order_acquire) == ENCODED)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.pixels = nullptr;
+            if (slot.written)
+            {
+                _stats.written++;
+            }
+            else
+            {
+                _stats.failed++;
+            }
+            slot.state.store(FREE, std::memory_order_relaxed);
+        }
+    }
+}
+
+void FrameCapture::release()
+{
+    MemoryTracker &memory = MemoryTracker::global();
+    for (Slot &slot : _slots)
+    {
+        if (slot.buffer != 0)
+        {
+            memory.untrackBuffer(slot.buffer);
+            glDeleteBuffers(1, &slot.buffer);
+            slot.buffer = 0;
+        }
+    }
+    if (_framebuffer != 0)
+    {
+        memory.release(MemoryTracker::STREAM, MEMORY_ASSET, MemoryTracker::GPU_TEXTURE, static_cast<size_t>(_width) * _height * BYTES_PER_PIXEL * 2);
+        glDeleteFramebuffers(1, &_framebuffer);
+        glDeleteRenderbuffers(1, &_colorBuffer);
+        glDeleteRenderbuffers(1, &_depthBuffer);
+        _framebuffer = 0;
+        _colorBuffer = 0;
+        _depthBuffer = 0;
+    }
+}
+
+// Worker thread: encodes the slots in ring order as they become ready
+void FrameCapture::encode()
+{
+    std::vector<unsigned char> scratch;
+    int next = 0;
+    while (true)
+    {
+        Slot &slot = _slots[next];
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this, &slot]()
+                       {
+                           const int state = slot.state.load(std::memory_order_acquire);
+                           return _stop || state == ENCODING || state == SKIPPED; });
+            const int state = slot.state.load(std::memory_order_acquire);
+            if (state == SKIPPED)
+            {
+                // Nothing is mapped, the slot can be reused right away
+                slot.state.store(FREE, std::memory_order_release);
+                _encoded.notify_all();
+                next = (next + 1) % RING_SIZE;
+                continue;
+            }
+            if (state != ENCODING)
+            {
+                return;
+            }
+        }
+
+        if (IsPng(slot.filename))
+        {
+            slot.written = SavePNG(slot.filename, slot.pixels, _width, _height, scratch);
+        }
+        else
+        {
+            slot.written = SaveTGA(slot.filename, slot.pixels, static_cast<unsigned short>(_width), static_cast<unsigned short>(_height), BYTES_PER_PIXEL);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            slot.state.store(ENCODED, std::memory_order_release);
+        }
+        _encoded.notify_all();
+        next = (next + 1) % RING_SIZE;
+    }
+}
+
+void FrameCapture::printReport() const
+{
+    double average = _stats.requested > 0 ? _stats.renderThreadMilliseconds / _stats.requested : 0.0;
+    std::cout << "Frame capture: " << _stats.written << " written, " << _stats.dropped << " dropped, " << _stats.failed
+              << " failed of " << _stats.requested << " (" << average << " ms render thread per capture)" << std::endl;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "GL/glew.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct CaptureStats
+{
+    unsigned long long requested;
+    unsigned long long written;
+    unsigned long long dropped; // every slot was busy (the GPU or the encoder is behind), or the readback could not be mapped
+    unsigned long long failed;  // could not be written
+    double renderThreadMilliseconds; // spent in capture() and update()
+};
+
+// Framebuffer capture without stalls. capture() starts an asynchronous glReadPixels into
+// one of RING_SIZE pixel buffer objects; update() maps the ones whose fence has passed,
+// usually a frame or two later, and a worker thread writes them out as TGA or PNG. The
+// render thread never waits for the GPU or the disk; when all slots are busy the frame
+// is dropped and counted, as is a frame whose readback cannot be mapped.
+//
+// In a headless context (hidden window, no usable back buffer) init(width, height, true)
+// creates an offscreen framebuffer to render into, see bindFramebuffer().
+class FrameCapture
+{
+public:
+    static constexpr int RING_SIZE = 4;
+    static constexpr int MAX_FILENAME = 256;
+
+    FrameCapture();
+    ~FrameCapture();
+
+    // Can be called again after a resize, pending captures are finished first
+    bool init(int width, int height, bool offscreen = false);
+    // Offscreen mode only; 0 (the window) otherwise
+    void bindFramebuffer() const;
+    GLuint getFramebuffer() const { return _framebuffer; }
+
+    // Call after drawing and before swapping buffers. The file extension picks the
+    // format (.png, anything else is TGA). Returns false when the frame was dropped.
+    bool capture(const char *filename);
+    // Once per frame on the GL thread, also in frames without a capture
+    void update();
+    // Blocks until every requested frame is on disk
+    void finish();
+
+    int getWidth() const { return _width; }
+    int getHeight() const { return _height; }
+    bool isInitialized() const { return _slots[0].buffer != 0; }
+    const CaptureStats &getStats() const { return _stats; }
+    void printReport() const;
+
+private:
+    FrameCapture(const FrameCapture &rhs) = delete;
+    FrameCapture &operator=(const FrameCapture &rhs) = delete;
+
+    enum SlotState
+    {
+        FREE,
+        READING,  // glReadPixels issued, waiting for the fence
+        ENCODING, // mapped, owned by the worker
+        ENCODED,  // waiting for the GL thread to unmap it
+        SKIPPED   // mapping failed, the worker passes over it without encoding
+    };
+
+    struct Slot
+    {
+        GLuint buffer;
+        GLsync fence;
+        const unsigned char *pixels;
+        std::atomic<int> state;
+        bool written;
+        char filename[MAX_FILENAME];
+    };
+
+    bool mapSlot(Slot &slot, bool wait);
+    void recycleSlots();
+    void release();
+    void encode();
+
+    int _width;
+    int _height;
+    GLuint _framebuffer;
+    GLuint _colorBuffer;
+    GLuint _depthBuffer;
+
+    // Slots are used, mapped and encoded strictly in ring order, so files come out in order
+    Slot _slots[RING_SIZE];
+    int _readSlot;
+    int _mapSlot;
+    CaptureStats _stats;
+
+    std::thread _worker;
+    std::mutex _mutex;
+    std::condition_variable _wake;     // a slot is ready to encode, or stop
+    std::condition_variable _encoded;  // a slot has been encoded
+    bool _stop;
+};
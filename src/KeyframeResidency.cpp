@@ -0,0 +1,139 @@
+#include "KeyframeResidency.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace md2model;
+
+KeyframeResidency &KeyframeResidency::Global()
+{
+    static KeyframeResidency residency;
+    return residency;
+}
+
+KeyframeResidency::KeyframeResidency(size_t budgetBytes) : _stats(),
+                                                               _overBudget(false)
+{
+    _stats.budgetBytes = budgetBytes;
+}
+
+KeyframeResidency::Handle KeyframeResidency::Register(size_t bytes, std::function<void()> evict)
+{
+    Entry entry{bytes, std::move(evict), true, false, 0, _lru.end()};
+    if (!_freeHandles.empty())
+    {
+        Handle handle = _freeHandles.back();
+        _freeHandles.pop_back();
+        _entries[handle] = std::move(entry);
+        return handle;
+    }
+    _entries.emplace_back(std::move(entry));
+    return static_cast<Handle>(_entries.size() - 1);
+}
+
+void KeyframeResidency::Unregister(Handle handle)
+{
+    Entry &entry = _entries[handle];
+    if (entry.resident)
+    {
+        _lru.erase(entry.lruPosition);
+        _stats.residentBytes -= entry.bytes;
+    }
+    entry = Entry{0, nullptr, false, false, 0, _lru.end()};
+    _freeHandles.push_back(handle);
+}
+
+bool KeyframeResidency::Request(Handle handle)
+{
+    Entry &entry = _entries[handle];
+    _stats.requests++;
+    entry.lastUsedFrame = _stats.frames;
+    if (!entry.resident)
+    {
+        _stats.misses++;
+        return false;
+    }
+    _lru.splice(_lru.begin(), _lru, entry.lruPosition);
+    return true;
+}
+
+void KeyframeResidency::MakeResident(Handle handle)
+{
+    Entry &entry = _entries[handle];
+    if (entry.resident)
+    {
+        return;
+    }
+
+    // Make room first, so the peak reflects what the budget allowed
+    if (entry.bytes <= _stats.budgetBytes)
+    {
+        EvictUntil(_stats.budgetBytes - entry.bytes);
+    }
+    else
+    {
+        EvictUntil(0);
+    }
+
+    entry.resident = true;
+    entry.lastUsedFrame = _stats.frames;
+    _lru.push_front(handle);
+    entry.lruPosition = _lru.begin();
+
+    _stats.residentBytes += entry.bytes;
+    _stats.peakResidentBytes = std::max(_stats.peakResidentBytes, _stats.residentBytes);
+    _stats.uploads++;
+    _stats.uploadsThisFrame++;
+    _stats.uploadedBytesThisFrame += entry.bytes;
+    _stats.maxUploadsPerFrame = std::max(_stats.maxUploadsPerFrame, _stats.uploadsThisFrame);
+    if (_stats.residentBytes > _stats.budgetBytes && !_overBudget)
+    {
+        _overBudget = true;
+        _stats.overBudgetFrames++;
+    }
+}
+
+void KeyframeResidency::BeginFrame()
+{
+    _stats.frames++;
+    _stats.uploadsThisFrame = 0;
+    _stats.uploadedBytesThisFrame = 0;
+    _overBudget = false;
+}
+
+void KeyframeResidency::SetBudget(size_t bytes)
+{
+    _stats.budgetBytes = bytes;
+    EvictUntil(bytes);
+}
+
+void KeyframeResidency::EvictUntil(size_t residentBytes)
+{
+    auto it = _lru.end();
+    while (_stats.residentBytes > residentBytes && it != _lru.begin())
+    {
+        --it;
+        Entry &entry = _entries[*it];
+        if (entry.lastUsedFrame == _stats.frames)
+        {
+            // Everything in front of this clip was used this frame as well
+            break;
+        }
+
+        it = _lru.erase(it);
+        entry.resident = false;
+        _stats.residentBytes -= entry.bytes;
+        _stats.evictions++;
+        entry.evict();
+    }
+}
+
+void KeyframeResidency::PrintReport() const
+{
+    double averageUploads = _stats.frames > 0 ? static_cast<double>(_stats.uploads) / _stats.frames : 0.0;
+    double missRate = _stats.requests > 0 ? 100.0 * _stats.misses / _stats.requests : 0.0;
+    std::cout << "Keyframe residency: " << _stats.residentBytes / 1024 << " KB resident (peak " << _stats.peakResidentBytes / 1024
+              << " KB, budget " << _stats.budgetBytes / 1024 << " KB)" << std::endl;
+    std::cout << "  uploads: " << _stats.uploads << " (" << averageUploads << "/frame, max " << _stats.maxUploadsPerFrame << ")"
+              << "  misses: " << _stats.misses << "/" << _stats.requests << " (" << missRate << "%)"
+              << "  evictions: " << _stats.evictions << "  frames over budget: " << _stats.overBudgetFrames << std::endl;
+}
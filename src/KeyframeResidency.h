@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <vector>
+
+namespace md2model
+{
+    constexpr size_t DEFAULT_KEYFRAME_BUDGET = 16 * 1024 * 1024; // bytes of keyframe vertex data on the GPU
+
+    struct ResidencyStats
+    {
+        size_t budgetBytes;
+        size_t residentBytes;
+        size_t peakResidentBytes;
+        unsigned int uploadsThisFrame;      // clips uploaded since the last BeginFrame
+        size_t uploadedBytesThisFrame;
+        unsigned int maxUploadsPerFrame;
+        unsigned long long frames;
+        unsigned long long requests;        // clip uses, one per draw
+        unsigned long long misses;          // uses that had to upload the clip first
+        unsigned long long uploads;
+        unsigned long long evictions;
+        unsigned long long overBudgetFrames; // the clips used in one frame did not fit in the budget
+    };
+
+    // Tracks which animation clips have their keyframes on the GPU and evicts the least
+    // recently used ones when the budget is exceeded. One instance is shared by every
+    // model, so the budget covers the whole scene. The owner of a clip does the actual
+    // upload and release; this class only does the bookkeeping:
+    //
+    //     if (!residency.Request(handle))
+    //     {
+    //         Upload();
+    //         residency.MakeResident(handle);
+    //     }
+    class KeyframeResidency
+    {
+    public:
+        using Handle = int;
+
+        static KeyframeResidency &Global();
+
+        explicit KeyframeResidency(size_t budgetBytes = DEFAULT_KEYFRAME_BUDGET);
+
+        // `evict` is called when the clip has to leave the GPU to make room for another one
+        Handle Register(size_t bytes, std::function<void()> evict);
+        // Forgets a clip without calling its evict callback, the owner releases it itself
+        void Unregister(Handle handle);
+
+        // Marks the clip as used this frame. Returns false if it has to be uploaded first.
+        bool Request(Handle handle);
+        // Called after the upload. Evicts least recently used clips until the new one fits,
+        // except clips already used this frame, whose draws have been issued.
+        void MakeResident(Handle handle);
+
+        void BeginFrame();
+        void SetBudget(size_t bytes);
+        const ResidencyStats &GetStats() const { return _stats; }
+        void PrintReport() const;
+
+    private:
+        struct Entry
+        {
+            size_t bytes;
+            std::function<void()> evict;
+            bool registered;
+            bool resident;
+            unsigned long long lastUsedFrame;
+            std::list<Handle>::iterator lruPosition; // valid while resident
+        };
+
+        void EvictUntil(size_t residentBytes);
+
+        std::vector<Entry> _entries;
+        std::vector<Handle> _freeHandles;
+        std::list<Handle> _lru; // front is the most recently used resident clip
+        ResidencyStats _stats;
+        bool _overBudget; // already counted in overBudgetFrames this frame
+    };
+}
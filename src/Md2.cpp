@@ -1,251 +1,975 @@
 #include "Md2.h"
 #include "ShaderProgram.h"
 #include "Texture2D.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "PoseKernel.h"
+#include "StreamBuffer.h"
+#include "MemoryTracker.h"
+#include "Arena.h"
+#include "CommandList.h"
+#include "PoseCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <limits>
+
+#include <glm/gtc/type_ptr.hpp>
 
 using namespace md2model;
 
-Md2::Md2(const char *md2FileName, const char *textureFileName) : _texture(std::make_unique<Texture2D>()),
-                                                                 _shaderProgram(std::make_unique<ShaderProgram>()),
-                                                                 _pause(false),
-                                                                 _position(glm::vec3(0.0f, 0.0f, -25.0f)),
-                                                                 _modelLoaded(false),
-                                                                 _textureLoaded(false),
-                                                                 _bufferInitialized(false)
+namespace
+{
+    // Per-instance attributes of the FEATURE_INSTANCING variant (basic.vert)
+    struct CrowdInstanceData
+    {
+        glm::mat4 model;     // locations 3-6, one column each
+        float interpolation; // location 7
+        GLint pose;          // location 9 with FEATURE_POSE_BUFFER, first float of the pose
+        float padding[2];    // keeps every matrix 16-byte aligned in the ring
+    };
+
+    static_assert(sizeof(CrowdInstanceData) == CROWD_INSTANCE_BYTES, "CROWD_INSTANCE_BYTES is the instance stride");
+
+    constexpr GLuint INSTANCE_MODEL_LOCATION = 3;
+    constexpr GLuint INSTANCE_INTERPOLATION_LOCATION = 7;
+    constexpr GLuint POINT_INDEX_LOCATION = 8;
+    constexpr GLuint INSTANCE_POSE_LOCATION = 9;
+    constexpr GLint POSE_TEXTURE_UNIT = 1;
+    constexpr uint64_t POSE_KEY_MASK = (1ull << 30) - 1; // pose handle bits of a posed crowd key
+    constexpr int MATRIX_COLUMNS = 4;
+
+    const char *const UNIFORM_NAMES[UNIFORM_COUNT] = {"model", "view", "projection", "modelView", "interpolation"};
+
+    void GetUniformLocations(GLuint program, GLint *uniforms)
+    {
+        for (int i = 0; i < UNIFORM_COUNT; i++)
+        {
+            uniforms[i] = program != 0 ? glGetUniformLocation(program, UNIFORM_NAMES[i]) : -1;
+        }
+    }
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point &start)
+    {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double, std::milli>(now - start).count();
+        start = now;
+        return elapsed;
+    }
+}
+
+glm::mat4 md2model::ModelTransform(const glm::vec3 &position, float angle)
 {
+    // Transform model: translate, rotate, and scale
+    glm::mat4 model(1.0f);
+    return glm::translate(model, position) * glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.0f, 0.0f)) * glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::scale(model, glm::vec3(MODEL_SCALE, MODEL_SCALE, MODEL_SCALE));
+}
+
+int md2model::SelectLod(const glm::vec3 &position, float boundingRadius, const float *screenSizes, int lodCount, const glm::mat4 &view, const glm::mat4 &projection)
+{
+    // Fraction of the screen height covered by the bounding sphere
+    glm::vec4 center = view * glm::vec4(position, 1.0f);
+    float distance = std::max(glm::length(glm::vec3(center.x, center.y, center.z)), 0.001f);
+    float screenSize = boundingRadius * MODEL_SCALE * projection[1][1] / distance;
+
+    int lod = 0;
+    while (lod + 1 < lodCount && screenSize < screenSizes[lod])
+    {
+        lod++;
+    }
+    return lod;
+}
+
+void md2model::ModelBounds(const glm::vec3 &modelMin, const glm::vec3 &modelMax, const glm::vec3 &position, float angle, glm::vec3 &min, glm::vec3 &max)
+{
+    const glm::mat4 transform = ModelTransform(position, angle);
+    min = glm::vec3(std::numeric_limits<float>::max());
+    max = -min;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec4 p = transform * glm::vec4(corner & 1 ? modelMax.x : modelMin.x, corner & 2 ? modelMax.y : modelMin.y, corner & 4 ? modelMax.z : modelMin.z, 1.0f);
+        min = glm::min(min, glm::vec3(p.x, p.y, p.z));
+        max = glm::max(max, glm::vec3(p.x, p.y, p.z));
+    }
+}
+
+Md2::Md2(const char *md2FileName, const char *textureFileName, ShaderVariants *shaders) : _runtime(),
+                                                                                          _texture(std::make_unique<Texture2D>()),
+                                                                                          _ownedShaders(shaders ? nullptr : std::make_unique<ShaderVariants>("shaders/basic.vert", "shaders/basic.frag")),
+                                                                                          _shaders(shaders ? shaders : _ownedShaders.get()),
+                                                                                          _shaderProgram(nullptr),
+                                                                                          _shaderFeatures(0),
+                                                                                          _crowdShader(),
+                                                                                          _posedCrowdShader(),
+                                                                                          _poseVertexArray(0),
+                                                                                          _poseVertexBuffer(0),
+                                                                                          _poseTexture(0),
+                                                                                          _pause(false),
+                                                                                          _modelLoaded(false),
+                                                                                          _textureLoaded(false),
+                                                                                          _bufferInitialized(false),
+                                                                                          _loadTimings(),
+                                                                                          _assetName(md2FileName),
+                                                                                          _modelBytes(0),
+                                                                                          _meshBytes(0)
+{
+    _runtime.forcedLod = -1;
+    _runtime.position = DEFAULT_MODEL_POSITION;
+    std::copy(std::begin(DEFAULT_LOD_SCREEN_SIZES), std::end(DEFAULT_LOD_SCREEN_SIZES), _runtime.lodScreenSizes);
+
+    // Load-time temporaries come from the load arena, which is reset once the model is uploaded
+    ArenaScope loadScope(LinearArena::loadArena());
+    auto start = std::chrono::steady_clock::now();
     LoadModel(md2FileName);
+    _loadTimings.loadModel = MillisecondsSince(start);
     LoadTexture(textureFileName);
+    _loadTimings.loadTexture = MillisecondsSince(start);
+    BuildLods();
+    _loadTimings.buildLods = MillisecondsSince(start);
+    OptimizeIndices();
+    _loadTimings.optimizeIndices = MillisecondsSince(start);
     InitBuffer();
-    _shaderProgram->loadShaders("shaders/basic.vert", "shaders/basic.frag");
+    _loadTimings.initBuffer = MillisecondsSince(start);
+    SetShaderFeatures(_shaderFeatures);
+    _loadTimings.loadShaders = MillisecondsSince(start);
 }
 
 Md2::~Md2()
 {
     // Clean up OpenGL resources
-    for (size_t i = 0; i < _vaoIndices.size(); i++)
+    for (int clip = 0; clip < _runtime.clipCount; clip++)
+    {
+        KeyframeResidency::Global().Unregister(_runtime.frames[_runtime.clips[clip].firstFrame].residency);
+        if (_runtime.clips[clip].buffer != 0)
+        {
+            EvictClip(clip);
+        }
+    }
+    MemoryTracker &memory = MemoryTracker::global();
+    memory.untrackBuffer(_runtime.indexBuffer);
+    glDeleteBuffers(1, &_runtime.indexBuffer);
+    if (_poseVertexArray != 0)
     {
-        glDeleteVertexArrays(1, &_vaoIndices[i]);
-        glDeleteBuffers(1, &_vboIndices[i]);
+        memory.untrackBuffer(_poseVertexBuffer);
+        glDeleteBuffers(1, &_poseVertexBuffer);
+        glDeleteVertexArrays(1, &_poseVertexArray);
+        glDeleteTextures(1, &_poseTexture);
+    }
+    memory.release(MemoryTracker::MODEL, _assetName, MemoryTracker::CPU, _modelBytes);
+    memory.release(MemoryTracker::MESH, _assetName, MemoryTracker::CPU, _meshBytes);
+    for (int lod = 0; lod < _runtime.lodCount; lod++)
+    {
+        glDeleteQueries(1, &_runtime.lods[lod].query);
     }
     // modData vectors are automatically cleaned up
 }
 
 void Md2::Draw(int frame, float angle, float interpolation, const glm::mat4 &view, const glm::mat4 &projection)
 {
-    // Validate frame bounds
-    if (frame < 0 || frame >= static_cast<int>(_vaoIndices.size()))
+    assert(_modelLoaded && _textureLoaded && _bufferInitialized);
+    DrawPacket packet;
+    if (!PrepareDraw(frame, angle, view, projection, packet))
     {
-        std::cerr << "Error: Invalid frame index " << frame << " (valid range: 0-" << _vaoIndices.size() - 1 << ")" << std::endl;
         return;
     }
 
+    // A hot reload swapped the program, the cached uniform locations belong to the old one
+    if (_shaderProgram->getGeneration() != _runtime.shaderGeneration)
+    {
+        ResolveUniforms();
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _runtime.texture);
+    glUseProgram(_runtime.program);
+    glUniformMatrix4fv(_runtime.uniforms[UNIFORM_MODEL], 1, GL_FALSE, glm::value_ptr(packet.model));
+    glUniformMatrix4fv(_runtime.uniforms[UNIFORM_VIEW], 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(_runtime.uniforms[UNIFORM_PROJECTION], 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(_runtime.uniforms[UNIFORM_MODEL_VIEW], 1, GL_FALSE, glm::value_ptr(packet.modelView));
+    glUniform1f(_runtime.uniforms[UNIFORM_INTERPOLATION], interpolation);
+
+    glBindVertexArray(packet.vao);
+
+    // GPU time is read back a few frames later so the query never stalls the pipeline
+    const int lod = packet.lod;
+    const unsigned int lodBit = 1u << lod;
+    ReadLodTimer(lod);
+    bool timed = (_runtime.lodQueryPending & lodBit) == 0;
+    if (timed)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, _runtime.lods[lod].query);
+    }
+
+    glDrawElements(GL_TRIANGLES, packet.indexCount, GL_UNSIGNED_SHORT, (GLvoid *)(packet.firstIndex * sizeof(GLushort)));
+
+    if (timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        _runtime.lodQueryPending |= lodBit;
+    }
+    _runtime.lods[lod].draws++;
+    glBindVertexArray(0);
+}
+
+bool Md2::DrawCrowd(const CrowdInstance *instances, int count, const glm::mat4 &view, const glm::mat4 &projection, GpuRingBuffer &ring, IndirectDrawBuffer *commands)
+{
     assert(_modelLoaded && _textureLoaded && _bufferInitialized);
-    _texture->bind(0);
-    glm::mat4 model(1.0f);
+    assert(ring.getTarget() == GL_ARRAY_BUFFER);
 
-    // Transform model: translate, rotate, and scale
-    constexpr float MODEL_SCALE = 0.3f;
-    model = glm::translate(model, _position) * glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.0f, 0.0f)) * glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::scale(model, glm::vec3(MODEL_SCALE, MODEL_SCALE, MODEL_SCALE));
+    // Sorted by frame, then LOD, so each run of equal keys is one instanced draw
+    // Frame scratch, released when the frame arena is reset at the start of the next frame
+    uint64_t *order = LinearArena::frameArena().allocateArray<uint64_t>(static_cast<size_t>(count));
+    size_t ordered = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const CrowdInstance &instance = instances[i];
+        if (instance.frame < 0 || instance.frame >= _runtime.frameCount)
+        {
+            continue;
+        }
+        const uint64_t key = static_cast<uint64_t>(instance.frame * LOD_LEVELS + SelectCrowdLod(instance, view, projection));
+        order[ordered++] = key << 32 | static_cast<uint32_t>(i);
+    }
+    if (ordered == 0)
+    {
+        return true;
+    }
+    std::sort(order, order + ordered);
+
+    GLintptr offset = 0;
+    CrowdInstanceData *data = static_cast<CrowdInstanceData *>(ring.allocate(ordered * sizeof(CrowdInstanceData), alignof(glm::vec4), offset));
+    if (!data)
+    {
+        std::cerr << "Error: A crowd of " << ordered << " instances does not fit the stream buffer" << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < ordered; i++)
+    {
+        const CrowdInstance &instance = instances[static_cast<uint32_t>(order[i])];
+        data[i].model = ModelTransform(instance.position, instance.angle);
+        data[i].interpolation = instance.interpolation;
+        data[i].pose = 0;
+    }
+    ring.flush();
+
+    UseCrowdShader(_crowdShader, _shaderFeatures | FEATURE_INSTANCING, view, projection);
+    if (commands)
+    {
+        return DrawCrowdIndirect(order, ordered, ring.getBuffer(), offset, *commands);
+    }
+    size_t first = 0;
+    while (first < ordered)
+    {
+        const uint64_t key = order[first] >> 32;
+        size_t last = first + 1;
+        while (last < ordered && order[last] >> 32 == key)
+        {
+            last++;
+        }
+        const int frame = static_cast<int>(key / LOD_LEVELS);
+        RequestFrame(frame);
+        glBindVertexArray(_runtime.frames[frame].vao);
+        DrawInstances(static_cast<int>(key % LOD_LEVELS), ring.getBuffer(), offset + static_cast<GLintptr>(first * sizeof(CrowdInstanceData)), static_cast<GLsizei>(last - first), false);
+        first = last;
+    }
 
-    _shaderProgram->use();
-    _shaderProgram->setUniform("model", model);
-    _shaderProgram->setUniform("view", view);
-    _shaderProgram->setUniform("projection", projection);
-    _shaderProgram->setUniform("modelView", view * model);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    return true;
+}
 
-    glBindVertexArray(_vaoIndices[frame]);
+bool Md2::DrawCrowd(const CrowdInstance *instances, int count, const glm::mat4 &view, const glm::mat4 &projection, GpuRingBuffer &ring, PoseCache &cache, GpuRingBuffer &poseRing)
+{
+    assert(_modelLoaded && _textureLoaded && _bufferInitialized);
+    assert(ring.getTarget() == GL_ARRAY_BUFFER && poseRing.getTarget() == GL_TEXTURE_BUFFER);
 
-    GLint count = _frameIndices[frame].second - _frameIndices[frame].first + 1;
-    _shaderProgram->setUniform("interpolation", interpolation);
-    glDrawArrays(GL_TRIANGLES, 0, count);
+    // Sorted by LOD, then pose: the key is the LOD and pose above the instance index
+    // Frame scratch, released when the frame arena is reset at the start of the next frame
+    uint64_t *order = LinearArena::frameArena().allocateArray<uint64_t>(static_cast<size_t>(count));
+    size_t ordered = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const CrowdInstance &instance = instances[i];
+        if (instance.frame < 0 || instance.frame >= _runtime.frameCount)
+        {
+            continue;
+        }
+        const int nextFrame = instance.frame + 1 == _runtime.frameCount ? 0 : instance.frame + 1;
+        const uint64_t pose = cache.Acquire(*_model, instance.frame, nextFrame, instance.interpolation);
+        const uint64_t lod = static_cast<uint64_t>(SelectCrowdLod(instance, view, projection));
+        order[ordered++] = lod << 62 | pose << 32 | static_cast<uint32_t>(i);
+    }
+    if (ordered == 0)
+    {
+        return true;
+    }
+    std::sort(order, order + ordered);
+
+    // Every pose the cache holds this frame, in one copy; the instances index into it
+    GLintptr poseOffset = 0;
+    const size_t poolBytes = cache.GetPoolFloats() * sizeof(float);
+    void *poses = poseRing.allocate(static_cast<GLsizeiptr>(poolBytes), sizeof(float), poseOffset);
+    GLintptr offset = 0;
+    CrowdInstanceData *data = static_cast<CrowdInstanceData *>(ring.allocate(ordered * sizeof(CrowdInstanceData), alignof(glm::vec4), offset));
+    if (!poses || !data)
+    {
+        std::cerr << "Error: A crowd of " << ordered << " instances does not fit the stream buffers" << std::endl;
+        return false;
+    }
+    std::memcpy(poses, cache.GetPoolData(), poolBytes);
+    const GLint firstFloat = static_cast<GLint>(poseOffset / static_cast<GLintptr>(sizeof(float)));
+    for (size_t i = 0; i < ordered; i++)
+    {
+        const CrowdInstance &instance = instances[static_cast<uint32_t>(order[i])];
+        const PoseCache::PoseHandle pose = static_cast<PoseCache::PoseHandle>((order[i] >> 32) & POSE_KEY_MASK);
+        data[i].model = ModelTransform(instance.position, instance.angle);
+        data[i].interpolation = 0.0f;
+        data[i].pose = firstFloat + static_cast<GLint>(cache.GetPoolOffset(pose));
+    }
+    ring.flush();
+    poseRing.flush();
+
+    if (_poseVertexArray == 0)
+    {
+        InitPoseVertexArray();
+    }
+    UseCrowdShader(_posedCrowdShader, _shaderFeatures | FEATURE_INSTANCING | FEATURE_POSE_BUFFER, view, projection);
+    glActiveTexture(GL_TEXTURE0 + POSE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, _poseTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, poseRing.getBuffer());
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(_posedCrowdShader.poses, POSE_TEXTURE_UNIT);
+
+    // Every frame reads the same vertex array, so the crowd is one draw per LOD
+    glBindVertexArray(_poseVertexArray);
+    size_t first = 0;
+    while (first < ordered)
+    {
+        const uint64_t lod = order[first] >> 62;
+        size_t last = first + 1;
+        while (last < ordered && order[last] >> 62 == lod)
+        {
+            last++;
+        }
+        DrawInstances(static_cast<int>(lod), ring.getBuffer(), offset + static_cast<GLintptr>(first * sizeof(CrowdInstanceData)), static_cast<GLsizei>(last - first), true);
+        first = last;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+    return true;
 }
 
-void Md2::LoadTexture(const char *textureFileName)
+int Md2::SelectCrowdLod(const CrowdInstance &instance, const glm::mat4 &view, const glm::mat4 &projection) const
 {
-    _texture->loadTexture(textureFileName, true);
-    _textureLoaded = true;
+    return _runtime.forcedLod >= 0 ? std::min(_runtime.forcedLod, _runtime.lodCount - 1)
+                                   : md2model::SelectLod(instance.position, _runtime.boundingRadius, _runtime.lodScreenSizes, _runtime.lodCount, view, projection);
 }
 
-void Md2::InitBuffer()
+void Md2::UseCrowdShader(CrowdShader &shader, ShaderKey features, const glm::mat4 &view, const glm::mat4 &projection)
 {
-    std::vector<float> md2Vertices;
-    int startFrame = 0;
-    int endFrame = _model->numFrames - 1;
-    md2model::vector *currentFrame;
-    md2model::vector *nextFrame;
-    _model->currentFrame = startFrame;
-    _model->interpol = 0.0f;
+    ShaderProgram &program = _shaders->get(features);
+    if (&program != shader.program || program.getGeneration() != shader.generation)
+    {
+        shader.program = &program;
+        shader.generation = program.getGeneration();
+        GetUniformLocations(program.getProgram(), shader.uniforms);
+        shader.poses = program.getProgram() != 0 ? glGetUniformLocation(program.getProgram(), "poses") : -1;
+    }
 
-    int vertexIndex = 0;
-    int startVertex = 0;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _runtime.texture);
+    glUseProgram(program.getProgram());
+    glUniformMatrix4fv(shader.uniforms[UNIFORM_VIEW], 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(shader.uniforms[UNIFORM_PROJECTION], 1, GL_FALSE, glm::value_ptr(projection));
+}
 
-    // fill buffer
-    while (_model->currentFrame <= endFrame)
+bool Md2::DrawCrowdIndirect(const uint64_t *order, size_t ordered, GLuint buffer, GLintptr offset, IndirectDrawBuffer &commands)
+{
+    // One command per (frame, LOD) group, in the same order as the instance data
+    GLsizei groups = 0;
+    for (size_t i = 0; i < ordered; i++)
     {
-        currentFrame = &_model->pointList[_model->numPoints * _model->currentFrame];
-        nextFrame = _model->currentFrame == endFrame ? &_model->pointList[_model->numPoints * startFrame] : &_model->pointList[_model->numPoints * (_model->currentFrame + 1)];
-        startVertex = vertexIndex;
-        for (int index = 0; index < _model->numTriangles; index++)
+        if (i == 0 || order[i] >> 32 != order[i - 1] >> 32)
         {
+            groups++;
+        }
+    }
+    GLintptr commandOffset = 0;
+    DrawElementsIndirectCommand *command = commands.allocate(groups, commandOffset);
+    if (!command)
+    {
+        std::cerr << "Error: " << groups << " crowd draws do not fit the indirect buffer" << std::endl;
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return false;
+    }
 
-            // Start of the vertex data
-            for (int p = 0; p < VERTICES_PER_TRIANGLE; p++)
-            {
-                // current frame
-                for (int j = 0; j < POSITION_COMPONENTS; j++)
-                {
-                    // vertices
-                    md2Vertices.emplace_back(currentFrame[_model->triIndx[index].meshIndex[p]].point[j]);
-                }
-
-                // next frame
-                for (int j = 0; j < POSITION_COMPONENTS; j++)
-                {
-                    // vertices
-                    md2Vertices.emplace_back(nextFrame[_model->triIndx[index].meshIndex[p]].point[j]);
-                }
-
-                // tex coords
-                md2Vertices.emplace_back(_model->st[_model->triIndx[index].stIndex[p]].s);
-                md2Vertices.emplace_back(_model->st[_model->triIndx[index].stIndex[p]].t);
-                vertexIndex++;
-            }
-            // End of the vertex data
+    // Groups are sorted by frame, so the commands of a clip are consecutive and go out in one
+    // multi-draw on the clip's VAO. baseInstance counts from the start of the crowd's instance
+    // data, where the attributes point.
+    GLsizei runStart = 0;
+    int runClip = -1;
+    auto drawRun = [&](GLsizei runEnd)
+    {
+        // Every frame of the clip shares its residency handle
+        RequestFrame(_runtime.clips[runClip].firstFrame);
+        glBindVertexArray(_runtime.clips[runClip].vao);
+        SetInstanceAttributes(buffer, offset, false);
+        commands.flush();
+        commands.draw(GL_TRIANGLES, GL_UNSIGNED_SHORT, commandOffset + runStart * static_cast<GLintptr>(sizeof(DrawElementsIndirectCommand)), runEnd - runStart);
+        runStart = runEnd;
+    };
+
+    size_t first = 0;
+    for (GLsizei group = 0; group < groups; group++)
+    {
+        const uint64_t key = order[first] >> 32;
+        size_t last = first + 1;
+        while (last < ordered && order[last] >> 32 == key)
+        {
+            last++;
         }
-        _frameIndices[_model->currentFrame] = {startVertex, vertexIndex - 1};
-        _model->currentFrame++;
+        const int frame = static_cast<int>(key / LOD_LEVELS);
+        const int lod = static_cast<int>(key % LOD_LEVELS);
+        const int clip = FindClip(frame);
+        if (clip != runClip && group > runStart)
+        {
+            drawRun(group);
+        }
+        runClip = clip;
+
+        const RuntimeLod &runtimeLod = _runtime.lods[lod];
+        command[group].count = runtimeLod.indexCount;
+        command[group].instanceCount = static_cast<GLuint>(last - first);
+        command[group].firstIndex = runtimeLod.firstIndex;
+        command[group].baseVertex = (frame - _runtime.clips[clip].firstFrame) * _runtime.wedgeCount;
+        command[group].baseInstance = static_cast<GLuint>(first);
+        _runtime.lods[lod].draws += command[group].instanceCount;
+        first = last;
     }
+    drawRun(groups);
 
-    int frameIndex = startFrame;
-    unsigned int vbo, vao;
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    return true;
+}
 
-    for (int i = 0; i < _model->numFrames; i++)
+void Md2::SetInstanceAttributes(GLuint buffer, GLintptr offset, bool posed)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (int column = 0; column < MATRIX_COLUMNS; column++)
+    {
+        const GLuint location = INSTANCE_MODEL_LOCATION + column;
+        glVertexAttribPointer(location, MATRIX_COLUMNS, GL_FLOAT, GL_FALSE, sizeof(CrowdInstanceData), (GLvoid *)(offset + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location);
+    }
+    if (posed)
+    {
+        glVertexAttribIPointer(INSTANCE_POSE_LOCATION, 1, GL_INT, sizeof(CrowdInstanceData), (GLvoid *)(offset + offsetof(CrowdInstanceData, pose)));
+        glVertexAttribDivisor(INSTANCE_POSE_LOCATION, 1);
+        glEnableVertexAttribArray(INSTANCE_POSE_LOCATION);
+    }
+    else
     {
-        glGenBuffers(1, &vbo);      // Generate an empty vertex buffer on the GPU
-        glGenVertexArrays(1, &vao); // Tell OpenGL to create new Vertex Array Object
+        glVertexAttribPointer(INSTANCE_INTERPOLATION_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(CrowdInstanceData), (GLvoid *)(offset + offsetof(CrowdInstanceData, interpolation)));
+        glVertexAttribDivisor(INSTANCE_INTERPOLATION_LOCATION, 1);
+        glEnableVertexAttribArray(INSTANCE_INTERPOLATION_LOCATION);
+    }
+}
 
-        auto count = _frameIndices[frameIndex].second - _frameIndices[frameIndex].first + 1;
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, count * sizeof(float) * FLOATS_PER_VERTEX, &md2Vertices[_frameIndices[frameIndex].first * FLOATS_PER_VERTEX], GL_STATIC_DRAW);
+void Md2::DrawInstances(int lod, GLuint buffer, GLintptr offset, GLsizei instanceCount, bool posed)
+{
+    // The instance attributes point into the group's range of the ring
+    SetInstanceAttributes(buffer, offset, posed);
 
-        glBindVertexArray(vao); // Make it the current one
+    const RuntimeLod &runtimeLod = _runtime.lods[lod];
+    glDrawElementsInstanced(GL_TRIANGLES, runtimeLod.indexCount, GL_UNSIGNED_SHORT, (GLvoid *)(runtimeLod.firstIndex * sizeof(GLushort)), instanceCount);
+    _runtime.lods[lod].draws += static_cast<unsigned int>(instanceCount);
 
-        // Current Frame Position attribute
-        glVertexAttribPointer(0, POSITION_COMPONENTS, GL_FLOAT, GL_FALSE, FLOATS_PER_VERTEX * sizeof(GLfloat), (GLvoid *)(0));
-        glEnableVertexAttribArray(0);
+    // Frame VAOs are shared with Draw, whose variant has no instance attributes
+    if (!posed)
+    {
+        for (GLuint location = INSTANCE_MODEL_LOCATION; location <= INSTANCE_INTERPOLATION_LOCATION; location++)
+        {
+            glDisableVertexAttribArray(location);
+        }
+    }
+}
 
-        // Next  Frame Position attribute
-        glVertexAttribPointer(1, POSITION_COMPONENTS, GL_FLOAT, GL_FALSE, FLOATS_PER_VERTEX * sizeof(GLfloat), (GLvoid *)(POSITION_COMPONENTS * sizeof(GLfloat)));
-        glEnableVertexAttribArray(1);
+bool Md2::PrepareDraw(int frame, float angle, const glm::mat4 &view, const glm::mat4 &projection, DrawPacket &packet)
+{
+    // Validate frame bounds
+    if (frame < 0 || frame >= _runtime.frameCount)
+    {
+        std::cerr << "Error: Invalid frame index " << frame << " (valid range: 0-" << _runtime.frameCount - 1 << ")" << std::endl;
+        return false;
+    }
 
-        // Texture Coord attribute
-        glVertexAttribPointer(2, TEXCOORD_COMPONENTS, GL_FLOAT, GL_FALSE, FLOATS_PER_VERTEX * sizeof(GLfloat), (GLvoid *)((POSITION_COMPONENTS * 2) * sizeof(GLfloat)));
-        glEnableVertexAttribArray(2);
-        frameIndex++;
-        _vaoIndices.emplace_back(vao);
-        _vboIndices.emplace_back(vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+    RequestFrame(frame);
+    ResolvePacket(frame, angle, view, projection, packet);
+    return true;
+}
+
+bool Md2::PrepareRecord(int frame, const glm::mat4 &view, const glm::mat4 &projection, GLuint *timerQuery)
+{
+    if (timerQuery)
+    {
+        *timerQuery = 0;
+    }
+    if (frame < 0 || frame >= _runtime.frameCount)
+    {
+        std::cerr << "Error: Invalid frame index " << frame << " (valid range: 0-" << _runtime.frameCount - 1 << ")" << std::endl;
+        return false;
     }
 
-    glBindVertexArray(0); // unbind to make sure other code doesn't change it
-    _bufferInitialized = true;
+    RequestFrame(frame);
+    if (_shaderProgram->getGeneration() != _runtime.shaderGeneration)
+    {
+        ResolveUniforms();
+    }
+    const int lod = ResolveLod(view, projection);
+    _runtime.lods[lod].draws++;
+
+    // Same rule as Draw: one query in flight per LOD
+    const unsigned int lodBit = 1u << lod;
+    ReadLodTimer(lod);
+    if (timerQuery && (_runtime.lodQueryPending & lodBit) == 0)
+    {
+        *timerQuery = _runtime.lods[lod].query;
+        _runtime.lodQueryPending |= lodBit;
+    }
+    return true;
 }
 
-void Md2::LoadModel(const char *md2FileName)
+bool Md2::RecordDraw(CommandList &list, int frame, float angle, float interpolation, const glm::mat4 &view, const glm::mat4 &projection, GLuint timerQuery) const
+{
+    if (frame < 0 || frame >= _runtime.frameCount || _runtime.frames[frame].vao == 0)
+    {
+        return false;
+    }
+
+    DrawPacket packet;
+    ResolvePacket(frame, angle, view, projection, packet);
+
+    // Sorted by program and texture, then front to back
+    list.beginPacket(CommandList::makeSortKey(_runtime.program, _runtime.texture, -packet.modelView[3][2]));
+    list.bindTexture(0, _runtime.texture);
+    list.bindProgram(_runtime.program);
+    list.setUniform(_runtime.uniforms[UNIFORM_MODEL], packet.model);
+    list.setUniform(_runtime.uniforms[UNIFORM_VIEW], view);
+    list.setUniform(_runtime.uniforms[UNIFORM_PROJECTION], projection);
+    list.setUniform(_runtime.uniforms[UNIFORM_MODEL_VIEW], packet.modelView);
+    list.setUniform(_runtime.uniforms[UNIFORM_INTERPOLATION], interpolation);
+    list.bindVertexArray(packet.vao);
+    if (timerQuery != 0)
+    {
+        list.timeDraw(timerQuery);
+    }
+    list.drawIndexed(packet.indexCount, packet.firstIndex);
+    return true;
+}
+
+void Md2::ResolvePacket(int frame, float angle, const glm::mat4 &view, const glm::mat4 &projection, DrawPacket &packet) const
+{
+    packet.vao = _runtime.frames[frame].vao;
+
+    packet.model = ModelTransform(_runtime.position, angle);
+    packet.modelView = view * packet.model;
+
+    packet.lod = ResolveLod(view, projection);
+    packet.indexCount = _runtime.lods[packet.lod].indexCount;
+    packet.firstIndex = _runtime.lods[packet.lod].firstIndex;
+}
+
+int Md2::ResolveLod(const glm::mat4 &view, const glm::mat4 &projection) const
+{
+    return _runtime.forcedLod >= 0 ? std::min(_runtime.forcedLod, _runtime.lodCount - 1) : SelectLod(view, projection);
+}
+
+int Md2::SelectLod(const glm::mat4 &view, const glm::mat4 &projection) const
+{
+    return md2model::SelectLod(_runtime.position, _runtime.boundingRadius, _runtime.lodScreenSizes, _runtime.lodCount, view, projection);
+}
+
+void Md2::SetLodScreenSizes(const std::vector<float> &screenSizes)
+{
+    // Missing thresholds never switch to the next level
+    for (int lod = 0; lod < LOD_LEVELS; lod++)
+    {
+        _runtime.lodScreenSizes[lod] = lod < static_cast<int>(screenSizes.size()) ? screenSizes[lod] : 0.0f;
+    }
+}
+
+std::vector<LodStats> Md2::GetLodStats() const
+{
+    std::vector<LodStats> stats = _lodStats;
+    for (size_t lod = 0; lod < stats.size(); lod++)
+    {
+        stats[lod].draws = _runtime.lods[lod].draws;
+    }
+    return stats;
+}
+
+void Md2::ReadLodTimer(int lod)
 {
-    FILE *fp = fopen(md2FileName, "rb");
-    if (!fp)
+    const unsigned int lodBit = 1u << lod;
+    if ((_runtime.lodQueryPending & lodBit) == 0)
     {
-        std::cerr << "Error: Could not open MD2 file: " << md2FileName << std::endl;
         return;
     }
 
-    // Get file size
-    fseek(fp, 0, SEEK_END);
-    long length = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    GLint available = 0;
+    glGetQueryObjectiv(_runtime.lods[lod].query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available)
+    {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(_runtime.lods[lod].query, GL_QUERY_RESULT, &nanoseconds);
+        _lodStats[lod].gpuMilliseconds += nanoseconds / 1.0e6;
+        _lodStats[lod].timedDraws++;
+        _runtime.lodQueryPending &= ~lodBit;
+    }
+}
 
-    if (length < static_cast<long>(sizeof(header)))
+void Md2::SetShaderFeatures(ShaderKey features)
+{
+    if (_shaderProgram && features == _shaderFeatures)
     {
-        std::cerr << "Error: File too small to be a valid MD2 file" << std::endl;
-        fclose(fp);
         return;
     }
+    _shaderFeatures = features;
+    _shaderProgram = &_shaders->get(features);
+    ResolveUniforms();
+}
 
-    std::vector<char> buffer(length);
-    size_t bytesRead = fread(buffer.data(), sizeof(char), length, fp);
-    fclose(fp);
+void Md2::ResolveUniforms()
+{
+    _runtime.program = _shaderProgram->getProgram();
+    _runtime.shaderGeneration = _shaderProgram->getGeneration();
+    GetUniformLocations(_runtime.program, _runtime.uniforms);
+}
 
-    if (bytesRead != static_cast<size_t>(length))
+void Md2::InitPoseVertexArray()
+{
+    // Positions come from the pose texture; a wedge keeps its texture coordinate and the
+    // model vertex to fetch
+    struct PoseVertex
+    {
+        float s;
+        float t;
+        GLint point;
+    };
+    ArenaScope scope(LinearArena::loadArena());
+    PoseVertex *vertices = scope.arena().allocateArray<PoseVertex>(_wedges.size());
+    for (size_t i = 0; i < _wedges.size(); i++)
+    {
+        vertices[i] = {_model->st[_wedges[i].stIndex].s, _model->st[_wedges[i].stIndex].t, _wedges[i].meshIndex};
+    }
+
+    glGenVertexArrays(1, &_poseVertexArray);
+    glBindVertexArray(_poseVertexArray);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _runtime.indexBuffer);
+    glGenBuffers(1, &_poseVertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _poseVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, _wedges.size() * sizeof(PoseVertex), vertices, GL_STATIC_DRAW);
+    MemoryTracker::global().trackBuffer(_poseVertexBuffer, _wedges.size() * sizeof(PoseVertex), MemoryTracker::MESH, _assetName);
+    glVertexAttribPointer(2, TEXCOORD_COMPONENTS, GL_FLOAT, GL_FALSE, sizeof(PoseVertex), (GLvoid *)offsetof(PoseVertex, s));
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(POINT_INDEX_LOCATION, 1, GL_INT, sizeof(PoseVertex), (GLvoid *)offsetof(PoseVertex, point));
+    glEnableVertexAttribArray(POINT_INDEX_LOCATION);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    glGenTextures(1, &_poseTexture);
+}
+
+void Md2::PrintLodReport() const
+{
+    std::cout << "LOD  triangles  error     ACMR (before/after)  ATVR (before/after)  draws     GPU ms/draw" << std::endl;
+    std::vector<LodStats> lodStats = GetLodStats();
+    for (size_t i = 0; i < lodStats.size(); i++)
+    {
+        const LodStats &stats = lodStats[i];
+        double average = stats.timedDraws > 0 ? stats.gpuMilliseconds / stats.timedDraws : 0.0;
+        std::cout << i << "    " << stats.triangles << "        " << stats.error << "    "
+                  << stats.acmrBefore << "/" << stats.acmrAfter << "    "
+                  << stats.atvrBefore << "/" << stats.atvrAfter << "    "
+                  << stats.draws << "    " << average << std::endl;
+    }
+}
+
+void Md2::LoadTexture(const char *textureFileName)
+{
+    _textureLoaded = _texture->loadTexture(textureFileName, true);
+    _runtime.texture = _texture->getTexture();
+}
+
+void Md2::BuildLods()
+{
+    if (!_modelLoaded)
     {
-        std::cerr << "Error: Failed to read complete MD2 file" << std::endl;
         return;
     }
 
-    // Validate MD2 header
-    header *head = reinterpret_cast<header *>(buffer.data());
+    // The model is drawn with a uniform scale, so the radius is kept in model units
+    _runtime.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    _runtime.boundsMax = -_runtime.boundsMin;
+    for (const md2model::vector &point : _model->pointList)
+    {
+        glm::vec3 position(point.point[0], point.point[1], point.point[2]);
+        _runtime.boundingRadius = std::max(_runtime.boundingRadius, glm::length(position));
+        _runtime.boundsMin = glm::min(_runtime.boundsMin, position);
+        _runtime.boundsMax = glm::max(_runtime.boundsMax, position);
+    }
+
+    MeshSimplifier simplifier(*_model);
+    std::vector<LodLevel> levels = simplifier.BuildLods(LOD_LEVELS, LOD_REDUCTION_RATIO);
+    for (LodLevel &level : levels)
+    {
+        _lodStats.push_back({static_cast<int>(level.triangles.size()), level.error, 0.0f, 0.0f, 0.0f, 0.0f, 0, 0, 0.0});
+        _lodTriangles.emplace_back(std::move(level.triangles));
+    }
+}
 
-    // Validate MD2 file format
-    if (head->id != MD2_MAGIC_NUMBER || head->version != MD2_VERSION)
+void Md2::OptimizeIndices()
+{
+    if (!_modelLoaded)
     {
-        std::cerr << "Error: Invalid MD2 file format (bad magic number or version)" << std::endl;
         return;
     }
 
-    _model = std::make_unique<modData>();
+    // All levels index the wedges of the full mesh, so one vertex buffer per frame serves every LOD
+    _wedges = BuildWedges(_lodTriangles[0]);
+    const int wedgeCount = static_cast<int>(_wedges.size());
 
-    _model->numPoints = head->vNum;
-    _model->numFrames = head->Number_Of_Frames;
-    _model->frameSize = head->framesize;
+    // Clusters are sorted on the average pose, which is the best guess for any frame
+    std::vector<glm::vec3> averagePositions(wedgeCount, glm::vec3(0.0f));
+    for (int i = 0; i < wedgeCount; i++)
+    {
+        for (int f = 0; f < _model->numFrames; f++)
+        {
+            const float *point = _model->pointList[_model->numPoints * f + _wedges[i].meshIndex].point;
+            averagePositions[i] += glm::vec3(point[0], point[1], point[2]);
+        }
+        averagePositions[i] = averagePositions[i] / static_cast<float>(_model->numFrames);
+    }
+
+    std::vector<std::vector<unsigned short>> lodIndices;
+    for (size_t lod = 0; lod < _lodTriangles.size(); lod++)
+    {
+        std::vector<unsigned short> indices = BuildIndices(_lodTriangles[lod], _wedges);
+        CacheStats before = SimulateVertexCache(indices, wedgeCount);
+        OptimizeVertexCache(indices, wedgeCount);
+        OptimizeOverdraw(indices, averagePositions);
+        CacheStats after = SimulateVertexCache(indices, wedgeCount);
+
+        _lodStats[lod].acmrBefore = before.acmr;
+        _lodStats[lod].acmrAfter = after.acmr;
+        _lodStats[lod].atvrBefore = before.atvr;
+        _lodStats[lod].atvrAfter = after.atvr;
+        lodIndices.emplace_back(std::move(indices));
+    }
 
-    // Reserve space for vectors
-    _model->pointList.resize(head->vNum * head->Number_Of_Frames);
+    // The full mesh is drawn most often, so the vertex order follows its first use
+    std::vector<int> remap = OptimizeVertexFetch(lodIndices[0], wedgeCount);
+    std::vector<wedge> reordered(wedgeCount);
+    for (int i = 0; i < wedgeCount; i++)
+    {
+        reordered[remap[i]] = _wedges[i];
+    }
+    _wedges.swap(reordered);
 
-    // Load vertex data
-    for (int count = 0; count < head->Number_Of_Frames; count++)
+    // Every level lives in one index buffer, back to back
+    for (size_t lod = 0; lod < lodIndices.size(); lod++)
     {
-        frame *fra = reinterpret_cast<frame *>(&buffer[head->offsetFrames + head->framesize * count]);
-        for (int count2 = 0; count2 < head->vNum; count2++)
+        if (lod > 0)
         {
-            GLint index = head->vNum * count + count2;
-            _model->pointList[index].point[0] = fra->scale[0] * fra->fp[count2].v[0] + fra->translate[0];
-            _model->pointList[index].point[1] = fra->scale[1] * fra->fp[count2].v[1] + fra->translate[1];
-            _model->pointList[index].point[2] = fra->scale[2] * fra->fp[count2].v[2] + fra->translate[2];
+            for (unsigned short &index : lodIndices[lod])
+            {
+                index = static_cast<unsigned short>(remap[index]);
+            }
         }
+        RuntimeLod &runtimeLod = _runtime.lods[_runtime.lodCount++];
+        runtimeLod.firstIndex = static_cast<GLuint>(_indices.size());
+        runtimeLod.indexCount = static_cast<GLuint>(lodIndices[lod].size());
+        _indices.insert(_indices.end(), lodIndices[lod].begin(), lodIndices[lod].end());
+    }
+
+    for (const std::vector<mesh> &triangles : _lodTriangles)
+    {
+        _meshBytes += triangles.capacity() * sizeof(mesh);
+    }
+    _meshBytes += _wedges.capacity() * sizeof(wedge) + _indices.capacity() * sizeof(unsigned short);
+    MemoryTracker::global().allocate(MemoryTracker::MESH, _assetName, MemoryTracker::CPU, _meshBytes);
+}
+
+void Md2::InitBuffer()
+{
+    if (!_modelLoaded)
+    {
+        return;
+    }
+
+    // The index buffer does not change between frames, every VAO references the same one
+    glGenBuffers(1, &_runtime.indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _runtime.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indices.size() * sizeof(GLushort), _indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    MemoryTracker::global().trackBuffer(_runtime.indexBuffer, _indices.size() * sizeof(GLushort), MemoryTracker::MESH, _assetName);
+
+    // Nothing is uploaded yet, every clip registers its size with the shared budget
+    _runtime.wedgeCount = static_cast<int>(_wedges.size());
+    _runtime.frameCount = _model->numFrames;
+    _runtime.clipCount = static_cast<int>(_model->clips.size());
+    for (int clip = 0; clip < _runtime.clipCount; clip++)
+    {
+        const animationClip &animation = _model->clips[clip];
+        _runtime.clips[clip] = {0, 0, static_cast<unsigned short>(animation.firstFrame), static_cast<unsigned short>(animation.frameCount)};
+
+        size_t bytes = static_cast<size_t>(animation.frameCount) * _runtime.wedgeCount * FLOATS_PER_VERTEX * sizeof(GLfloat);
+        KeyframeResidency::Handle handle = KeyframeResidency::Global().Register(bytes, [this, clip]()
+                                                                                { EvictClip(clip); });
+        for (int i = 0; i < animation.frameCount; i++)
+        {
+            _runtime.frames[animation.firstFrame + i] = {0, handle};
+        }
+    }
+
+    for (int lod = 0; lod < _runtime.lodCount; lod++)
+    {
+        glGenQueries(1, &_runtime.lods[lod].query);
+    }
+    _bufferInitialized = true;
+}
+
+void Md2::RequestFrame(int frame)
+{
+    KeyframeResidency &residency = KeyframeResidency::Global();
+    KeyframeResidency::Handle handle = _runtime.frames[frame].residency;
+    if (!residency.Request(handle))
+    {
+        UploadClip(FindClip(frame));
+        residency.MakeResident(handle);
     }
+}
+
+int Md2::FindClip(int frame) const
+{
+    // Clips are sorted by first frame, the frame's clip is the last one starting at or before it
+    const RuntimeClip *clips = _runtime.clips;
+    const RuntimeClip *next = std::upper_bound(clips, clips + _runtime.clipCount, frame, [](int value, const RuntimeClip &clip)
+                                               { return value < clip.firstFrame; });
+    return static_cast<int>(next - clips) - 1;
+}
+
+GLuint Md2::CreateVertexArray(size_t offset) const
+{
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _runtime.indexBuffer);
+
+    // Current Frame Position attribute
+    glVertexAttribPointer(0, POSITION_COMPONENTS, GL_FLOAT, GL_FALSE, FLOATS_PER_VERTEX * sizeof(GLfloat), (GLvoid *)(offset));
+    glEnableVertexAttribArray(0);
+
+    // Next  Frame Position attribute
+    glVertexAttribPointer(1, POSITION_COMPONENTS, GL_FLOAT, GL_FALSE, FLOATS_PER_VERTEX * sizeof(GLfloat), (GLvoid *)(offset + POSITION_COMPONENTS * sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+
+    // Texture Coord attribute
+    glVertexAttribPointer(2, TEXCOORD_COMPONENTS, GL_FLOAT, GL_FALSE, FLOATS_PER_VERTEX * sizeof(GLfloat), (GLvoid *)(offset + (POSITION_COMPONENTS * 2) * sizeof(GLfloat)));
+    glEnableVertexAttribArray(2);
+    return vao;
+}
+
+void Md2::UploadClip(int clip)
+{
+    RuntimeClip &runtimeClip = _runtime.clips[clip];
+    const int firstFrame = runtimeClip.firstFrame;
+    const int lastFrame = firstFrame + runtimeClip.frameCount - 1;
+    const int endFrame = _model->numFrames - 1;
+    md2model::vector *currentFrame;
+    md2model::vector *nextFrame;
 
-    // Load texture coordinates
-    _model->numST = head->tNum;
-    _model->st.resize(head->tNum);
-    textindx *stPtr = reinterpret_cast<textindx *>(&buffer[head->offsetTCoord]);
+    const size_t floatCount = static_cast<size_t>(runtimeClip.frameCount) * _runtime.wedgeCount * FLOATS_PER_VERTEX;
+    MemoryTracker::Transient vertexMemory(MemoryTracker::MODEL, _assetName, floatCount * sizeof(float));
+    ArenaScope scope(LinearArena::loadArena());
+    float *md2Vertices = scope.arena().allocateArray<float>(floatCount);
+    float *write = md2Vertices;
 
-    for (int count = 0; count < head->tNum; count++)
+    // fill buffer, the last frame of the model blends back into the first one
+    for (int frame = firstFrame; frame <= lastFrame; frame++)
     {
-        _model->st[count].s = static_cast<float>(stPtr[count].s) / static_cast<float>(head->twidth);
-        _model->st[count].t = static_cast<float>(stPtr[count].t) / static_cast<float>(head->theight);
+        currentFrame = &_model->pointList[_model->numPoints * frame];
+        nextFrame = frame == endFrame ? &_model->pointList[0] : &_model->pointList[_model->numPoints * (frame + 1)];
+        for (const wedge &vertex : _wedges)
+        {
+            // current frame
+            for (int j = 0; j < POSITION_COMPONENTS; j++)
+            {
+                *write++ = currentFrame[vertex.meshIndex].point[j];
+            }
+
+            // next frame
+            for (int j = 0; j < POSITION_COMPONENTS; j++)
+            {
+                *write++ = nextFrame[vertex.meshIndex].point[j];
+            }
+
+            // tex coords
+            *write++ = _model->st[vertex.stIndex].s;
+            *write++ = _model->st[vertex.stIndex].t;
+        }
     }
 
-    // Load triangle indices
-    _model->numTriangles = head->fNum;
-    _model->triIndx.resize(head->fNum);
-    mesh *bufIndexPtr = reinterpret_cast<mesh *>(&buffer[head->offsetIndx]);
+    // One buffer per clip, each frame's VAO points at its own range of it and the clip's VAO
+    // at the start, for draws that pick the frame with baseVertex
+    glGenBuffers(1, &runtimeClip.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, runtimeClip.buffer);
+    glBufferData(GL_ARRAY_BUFFER, floatCount * sizeof(float), md2Vertices, GL_STATIC_DRAW);
+    MemoryTracker::global().trackBuffer(runtimeClip.buffer, floatCount * sizeof(float), MemoryTracker::MODEL, _assetName);
 
-    for (int count2 = 0; count2 < head->fNum; count2++)
+    for (int frame = firstFrame; frame <= lastFrame; frame++)
     {
-        _model->triIndx[count2].meshIndex[0] = bufIndexPtr[count2].meshIndex[0];
-        _model->triIndx[count2].meshIndex[1] = bufIndexPtr[count2].meshIndex[1];
-        _model->triIndx[count2].meshIndex[2] = bufIndexPtr[count2].meshIndex[2];
+        size_t offset = static_cast<size_t>(frame - firstFrame) * _runtime.wedgeCount * FLOATS_PER_VERTEX * sizeof(GLfloat);
+        _runtime.frames[frame].vao = CreateVertexArray(offset);
+    }
+    runtimeClip.vao = CreateVertexArray(0);
 
-        _model->triIndx[count2].stIndex[0] = bufIndexPtr[count2].stIndex[0];
-        _model->triIndx[count2].stIndex[1] = bufIndexPtr[count2].stIndex[1];
-        _model->triIndx[count2].stIndex[2] = bufIndexPtr[count2].stIndex[2];
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0); // unbind to make sure other code doesn't change it
+}
+
+void Md2::EvictClip(int clip)
+{
+    RuntimeClip &runtimeClip = _runtime.clips[clip];
+    for (int frame = runtimeClip.firstFrame; frame < runtimeClip.firstFrame + runtimeClip.frameCount; frame++)
+    {
+        glDeleteVertexArrays(1, &_runtime.frames[frame].vao);
+        _runtime.frames[frame].vao = 0;
     }
+    glDeleteVertexArrays(1, &runtimeClip.vao);
+    runtimeClip.vao = 0;
+    MemoryTracker::global().untrackBuffer(runtimeClip.buffer);
+    glDeleteBuffers(1, &runtimeClip.buffer);
+    runtimeClip.buffer = 0;
+}
 
-    _model->currentFrame = 0;
-    _model->nextFrame = 1;
-    _model->interpol = 0.0;
+void Md2::LoadModel(const char *md2FileName)
+{
+    _model = LoadModelData(md2FileName);
+    _modelLoaded = _model != nullptr;
+    if (_modelLoaded)
+    {
+        _modelBytes = ModelDataBytes(*_model);
+        MemoryTracker::global().allocate(MemoryTracker::MODEL, _assetName, MemoryTracker::CPU, _modelBytes);
+    }
+}
 
-    _modelLoaded = true;
+void Md2::InterpolatePose(int frameA, int frameB, float t, float *positions, float *normals) const
+{
+    assert(_modelLoaded);
+    md2model::InterpolatePose(*_model, frameA, frameB, t, positions, normals);
 }
@@ -3,29 +3,53 @@
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 
 #include <vector>
-#include <map>
 #include <memory>
+#include <string>
+
+#include "KeyframeResidency.h"
+#include "ShaderVariants.h"
 
 class ShaderProgram;
 class Texture2D;
+class CommandList;
+class GpuRingBuffer;
+class IndirectDrawBuffer;
 
 namespace md2model
 {
+    class PoseCache;
+
     // MD2 Format Constants
     constexpr int MD2_MAGIC_NUMBER = 844121161;  // "IDP2"
     constexpr int MD2_VERSION = 8;
+    constexpr int MD2_MAX_FRAMES = 512;         // limit of the format, sizes the runtime tables
+    constexpr int MD2_MAX_VERTICES = 2048;      // limits of the format, checked by LoadModelData
+    constexpr int MD2_MAX_TEXCOORDS = 2048;
+    constexpr int MD2_MAX_TRIANGLES = 4096;
+    constexpr int MD2_MAX_SKINS = 32;
+    constexpr int MD2_FRAME_NAME_LENGTH = 16;
+    constexpr int MD2_SKIN_NAME_LENGTH = 64;
     
     // Vertex data layout
     constexpr int FLOATS_PER_VERTEX = 8;  // current_pos(3) + next_pos(3) + tex_coords(2)
     constexpr int VERTICES_PER_TRIANGLE = 3;
     constexpr int POSITION_COMPONENTS = 3;
     constexpr int TEXCOORD_COMPONENTS = 2;
+    constexpr float NORMAL_QUANTIZATION = 127.0f; // packed normals are signed bytes
+
+    constexpr float MODEL_SCALE = 0.3f;   // uniform scale of the model transform
+
+    // Level of detail
+    constexpr int LOD_LEVELS = 4;                // LOD 0 is the original mesh
+    constexpr float LOD_REDUCTION_RATIO = 0.5f;  // triangles kept from one level to the next
     
     struct header
     {
@@ -70,16 +94,44 @@ namespace md2model
     {
         float scale[3];
         float translate[3];
-        char name[16];
+        char name[MD2_FRAME_NAME_LENGTH];
         framePoint_t fp[1];
     };
 
+    struct frameTransform
+    {
+        float scale[3];
+        float translate[3];
+    };
+
+    struct packedNormal
+    {
+        signed char n[4]; // x, y, z, padding
+    };
+
     struct mesh
     {
         unsigned short meshIndex[3];
         unsigned short stIndex[3];
     };
 
+    // A unique (position, texture coordinate) pair. MD2 stores separate indices for
+    // both, so a shared vertex buffer needs one entry per combination that is used.
+    struct wedge
+    {
+        unsigned short meshIndex;
+        unsigned short stIndex;
+    };
+
+    // Consecutive frames whose names only differ in the trailing number ("run1" to "run6")
+    struct animationClip
+    {
+        std::string name;
+        int firstFrame;
+        int frameCount;
+        float loopMotion; // largest vertex distance from the last frame back to the first
+    };
+
     struct vector
     {
         float point[3];
@@ -100,33 +152,293 @@ namespace md2model
         std::vector<mesh> triIndx;
         std::vector<textcoord> st;
         std::vector<md2model::vector> pointList;
+        std::vector<framePoint_t> quantizedPoints;     // numFrames * numPoints, as stored in the file
+        std::vector<frameTransform> frameTransforms;   // numFrames
+        std::vector<packedNormal> normalList;          // numFrames * numPoints
+        std::vector<animationClip> clips;              // cover every frame, in order
+        std::vector<float> nextFrameMotion;            // numFrames, largest vertex distance to the next frame (the last wraps to 0)
+        std::vector<char> frameNames;                  // numFrames * MD2_FRAME_NAME_LENGTH, as stored in the file
+        std::vector<char> skinNames;                   // numSkins * MD2_SKIN_NAME_LENGTH, as stored in the file
+        int numSkins;
+        int numGLCommands;                             // of the file, the commands themselves are not read
+    };
+
+    // Where a model stands until SetPosition(), in front of a camera at the origin
+    inline const glm::vec3 DEFAULT_MODEL_POSITION(0.0f, 0.0f, -25.0f);
+    // Fractions of the screen height below which LOD i + 1 is used, see SelectLod
+    constexpr float DEFAULT_LOD_SCREEN_SIZES[LOD_LEVELS] = {0.25f, 0.12f, 0.05f, 0.0f};
+
+    // World transform every renderer uses: translate, rotate about X by `angle` degrees, turn
+    // the model upright and scale by MODEL_SCALE
+    glm::mat4 ModelTransform(const glm::vec3 &position, float angle);
+    // Level of detail every renderer uses, from the projected size of the bounding sphere
+    // (radius in model units) against `screenSizes`, one threshold per level
+    int SelectLod(const glm::vec3 &position, float boundingRadius, const float *screenSizes, int lodCount, const glm::mat4 &view, const glm::mat4 &projection);
+    // World box around a model-space box under ModelTransform, for occlusion proxies
+    void ModelBounds(const glm::vec3 &modelMin, const glm::vec3 &modelMax, const glm::vec3 &position, float angle, glm::vec3 &min, glm::vec3 &max);
+
+    // Parses an MD2 file without touching OpenGL. Returns nullptr on failure (including
+    // counts, offsets or triangle indices that do not fit the file), or when the parsed
+    // data does not fit the MemoryTracker::MODEL CPU budget.
+    std::unique_ptr<modData> LoadModelData(const char *md2FileName);
+    // Bound on how far any vertex moves between two keyframes, in model units. Consecutive
+    // frames and clip loops are looked up in the tables LoadModelData builds; other pairs
+    // are measured.
+    float KeyframeMotion(const modData &model, int frameA, int frameB);
+    // Heap memory held by the containers of a parsed model
+    size_t ModelDataBytes(const modData &model);
+    // Writes an MD2 file LoadModelData reads back to the same model, with `triangles` in
+    // place of model.triIndx. Frame and skin names are written as loaded; the GL command
+    // list is rebuilt as triangle strips of `triangles` in their order.
+    bool SaveModelData(const char *md2FileName, const modData &model, const std::vector<mesh> &triangles);
+
+    struct LodStats
+    {
+        int triangles;
+        float error;          // object-space error reported by the simplifier
+        float acmrBefore;     // post-transform cache efficiency of the original triangle order
+        float acmrAfter;
+        float atvrBefore;
+        float atvrAfter;
+        unsigned int draws;
+        unsigned int timedDraws;
+        double gpuMilliseconds; // accumulated over timedDraws
+    };
+
+    // Wall time of each construction stage, in milliseconds
+    struct LoadTimings
+    {
+        double loadModel;
+        double loadTexture;
+        double buildLods;
+        double optimizeIndices;
+        double initBuffer;
+        double loadShaders;
+    };
+
+    enum RuntimeUniform
+    {
+        UNIFORM_MODEL,
+        UNIFORM_VIEW,
+        UNIFORM_PROJECTION,
+        UNIFORM_MODEL_VIEW,
+        UNIFORM_INTERPOLATION,
+        UNIFORM_COUNT
+    };
+
+    // Per-frame entry of the runtime record
+    struct RuntimeFrame
+    {
+        GLuint vao; // 0 while the clip is not resident
+        KeyframeResidency::Handle residency; // of the frame's clip
+    };
+
+    struct RuntimeClip
+    {
+        GLuint buffer; // 0 while not resident
+        GLuint vao;    // whole clip, frames selected with baseVertex (DrawCrowd's multi-draw)
+        unsigned short firstFrame;
+        unsigned short frameCount;
+    };
+
+    struct RuntimeLod
+    {
+        GLuint firstIndex;
+        GLuint indexCount;
+        GLuint query;      // GL_TIME_ELAPSED
+        unsigned int draws;
+    };
+
+    // Everything Draw reads, in fixed-size tables instead of maps and nested vectors. A draw
+    // reads the first cache line (handles, uniform locations, counts), the LOD table on the
+    // second one and a single 8-byte frame entry.
+    struct alignas(64) ModelRuntime
+    {
+        GLuint program;
+        GLuint texture;
+        unsigned int shaderGeneration; // ShaderProgram generation the uniform locations belong to
+        GLint uniforms[UNIFORM_COUNT];
+        int frameCount;
+        int lodCount;
+        int forcedLod; // -1 for automatic selection
+        float boundingRadius;
+        unsigned int lodQueryPending; // bit per LOD
+        glm::vec3 position;
+
+        RuntimeLod lods[LOD_LEVELS];
+
+        // Only read for automatic LOD selection and on uploads
+        float lodScreenSizes[LOD_LEVELS]; // below lodScreenSizes[i], LOD i + 1 is used
+        GLuint indexBuffer; // referenced by every frame's VAO
+        int clipCount;
+        int wedgeCount;
+        glm::vec3 boundsMin; // model space, over every frame, for GetBounds
+        glm::vec3 boundsMax;
+
+        RuntimeFrame frames[MD2_MAX_FRAMES];
+        RuntimeClip clips[MD2_MAX_FRAMES];
+    };
+
+    // Fields added to the hot part have to replace others, not push the LOD table out of its line
+    static_assert(offsetof(ModelRuntime, position) + sizeof(glm::vec3) <= 64, "Draw state must fit the first cache line");
+    static_assert(offsetof(ModelRuntime, lods) == 64, "the LOD table must start the second cache line");
+    static_assert(offsetof(ModelRuntime, lodScreenSizes) == 128, "the LOD table must fit the second cache line");
+
+    // Draw state resolved from the runtime record, without any GL call
+    struct DrawPacket
+    {
+        glm::mat4 model;
+        glm::mat4 modelView;
+        GLuint vao;
+        int lod;
+        GLuint indexCount;
+        GLuint firstIndex;
     };
 
+    // One copy of a model in Md2::DrawCrowd
+    struct CrowdInstance
+    {
+        glm::vec3 position;
+        float angle;
+        int frame;
+        float interpolation;
+    };
+
+    // Stream buffer bytes DrawCrowd writes per instance
+    constexpr int CROWD_INSTANCE_BYTES = 80;
+
     class Md2
     {
     public:
-        Md2(const char *md2FileName, const char *textureFileName);
+        // Models can share one set of shader variants; without one the model gets its own
+        // for shaders/basic.*
+        Md2(const char *md2FileName, const char *textureFileName, ShaderVariants *shaders = nullptr);
         ~Md2();
         // The frame parameter start at 0
         void Draw(int frame, float angle, float interpolation, const glm::mat4 &view, const glm::mat4 &projection);
         void SetPause(bool pause) { _pause = pause; }
         bool isValid() const { return _modelLoaded && _textureLoaded && _bufferInitialized; }
+        void SetPosition(const glm::vec3 &position) { _runtime.position = position; }
+        const glm::vec3 &GetPosition() const { return _runtime.position; }
+        // Bounding sphere radius in world units, around GetPosition(), for any angle and frame
+        float GetBoundingRadius() const { return _runtime.boundingRadius * MODEL_SCALE; }
+        // World box around every frame, tighter than the sphere
+        void GetBounds(float angle, glm::vec3 &min, glm::vec3 &max) const { ModelBounds(_runtime.boundsMin, _runtime.boundsMax, _runtime.position, angle, min, max); }
+
+        // Picks the level of detail from the projected size of the bounding sphere.
+        // screenSizes[i] is the fraction of the screen height below which LOD i + 1 is used.
+        int SelectLod(const glm::mat4 &view, const glm::mat4 &projection) const;
+        void SetLodScreenSizes(const std::vector<float> &screenSizes);
+        // -1 restores automatic selection
+        void SetForcedLod(int lod) { _runtime.forcedLod = lod; }
+        int GetLodCount() const { return _runtime.lodCount; }
+        std::vector<LodStats> GetLodStats() const;
+        const LoadTimings &GetLoadTimings() const { return _loadTimings; }
+        void PrintLodReport() const;
+
+        // Instanced draw of many copies with the FEATURE_INSTANCING variant of the current
+        // shader features. Instances are grouped by frame and LOD; their model matrices and
+        // interpolation factors go to `ring` (GL_ARRAY_BUFFER, between beginFrame() and
+        // endFrame()) and every group is one glDrawElementsInstanced. With `commands` (see
+        // IndirectDrawBuffer::isSupported) every group becomes an indirect command on its
+        // clip's VAO instead, picking the frame with baseVertex and its instances with
+        // baseInstance, and each clip in the crowd is one glMultiDrawElementsIndirect. The
+        // rings are flushed here, so several models can share them in a frame. Instances with
+        // an invalid frame are skipped; returns false when the crowd does not fit the rings.
+        bool DrawCrowd(const CrowdInstance *instances, int count, const glm::mat4 &view, const glm::mat4 &projection, GpuRingBuffer &ring, IndirectDrawBuffer *commands = nullptr);
+        // Same, with the poses taken from `cache` (one Acquire per instance) instead of the
+        // keyframe buffers. The cache's pool is copied to `poseRing` (GL_TEXTURE_BUFFER) and the
+        // FEATURE_POSE_BUFFER variant fetches positions from it through a buffer texture, so
+        // the crowd is one instanced draw per LOD whatever the frames. The whole pool has to
+        // fit GL_MAX_TEXTURE_BUFFER_SIZE floats.
+        bool DrawCrowd(const CrowdInstance *instances, int count, const glm::mat4 &view, const glm::mat4 &projection, GpuRingBuffer &ring, PoseCache &cache, GpuRingBuffer &poseRing);
+        // The CPU half of Draw: residency, LOD selection and matrices. Returns false for an
+        // invalid frame.
+        bool PrepareDraw(int frame, float angle, const glm::mat4 &view, const glm::mat4 &projection, DrawPacket &packet);
+        // Deferred submission (see CommandList.h). PrepareRecord runs on the GL thread: it makes
+        // the frame resident, refreshes the uniform locations after a shader reload and counts
+        // the draw in the LOD stats. When `timerQuery` is given and the LOD's GPU timer is free,
+        // it is reserved and returned there (0 otherwise); passing it on to RecordDraw times
+        // the draw when the list is executed, and that list must then be executed. RecordDraw
+        // makes no GL calls and can then run on a worker; it returns false for a frame that
+        // was not prepared.
+        bool PrepareRecord(int frame, const glm::mat4 &view, const glm::mat4 &projection, GLuint *timerQuery = nullptr);
+        bool RecordDraw(CommandList &list, int frame, float angle, float interpolation, const glm::mat4 &view, const glm::mat4 &projection, GLuint timerQuery = 0) const;
+
+        // CPU version of the keyframe lerp done in basic.vert, for picking, shadow volumes
+        // and software rendering. Writes GetVertexCount() * 3 floats to each buffer;
+        // normals may be nullptr.
+        void InterpolatePose(int frameA, int frameB, float t, float *positions, float *normals = nullptr) const;
+        int GetVertexCount() const { return _model ? _model->numPoints : 0; }
+        int GetFrameCount() const { return _model ? _model->numFrames : 0; }
+        const std::vector<animationClip> &GetClips() const { return _model->clips; }
+        // Switches to the shader variant with these features, compiling it on first use
+        void SetShaderFeatures(ShaderKey features);
+        ShaderKey GetShaderFeatures() const { return _shaderFeatures; }
+        // GL names bound by recorded packets, for checking a replay
+        GLuint GetProgram() const { return _runtime.program; }
+        GLuint GetTexture() const { return _runtime.texture; }
+        // For ShaderWatcher; uniform locations are fetched again whenever the program is swapped
+        ShaderVariants &GetShaders() { return *_shaders; }
 
     private:
         void LoadModel(const char *md2FileName);
         void LoadTexture(const char *textureFileName);
+        void BuildLods();
+        void OptimizeIndices();
         void InitBuffer();
+        void ReadLodTimer(int lod);
+        void ResolveUniforms();
+        struct CrowdShader
+        {
+            ShaderProgram *program; // variant the locations belong to
+            unsigned int generation;
+            GLint uniforms[UNIFORM_COUNT];
+            GLint poses; // FEATURE_POSE_BUFFER sampler
+        };
+        int SelectCrowdLod(const CrowdInstance &instance, const glm::mat4 &view, const glm::mat4 &projection) const;
+        void UseCrowdShader(CrowdShader &shader, ShaderKey features, const glm::mat4 &view, const glm::mat4 &projection);
+        // DrawCrowd with multi-draw indirect, for the sorted keys and the instance data at `offset` in `buffer`
+        bool DrawCrowdIndirect(const uint64_t *order, size_t ordered, GLuint buffer, GLintptr offset, IndirectDrawBuffer &commands);
+        // Points the instance attributes of the bound VAO at `offset` in `buffer`
+        void SetInstanceAttributes(GLuint buffer, GLintptr offset, bool posed);
+        // One instanced draw of a LOD with the instance attributes at `offset` in `buffer`
+        void DrawInstances(int lod, GLuint buffer, GLintptr offset, GLsizei instanceCount, bool posed);
+        void InitPoseVertexArray();
+        void ResolvePacket(int frame, float angle, const glm::mat4 &view, const glm::mat4 &projection, DrawPacket &packet) const;
+        // The forced LOD if set, otherwise SelectLod
+        int ResolveLod(const glm::mat4 &view, const glm::mat4 &projection) const;
+        // Keyframes are uploaded one animation clip at a time, when a frame of it is first drawn
+        void RequestFrame(int frame);
+        int FindClip(int frame) const;
+        // Position, next position and texture coordinate attributes from `offset` in the bound buffer
+        GLuint CreateVertexArray(size_t offset) const;
+        void UploadClip(int clip);
+        void EvictClip(int clip);
 
+        ModelRuntime _runtime;
         std::unique_ptr<modData> _model;
         std::unique_ptr<Texture2D> _texture;
-        std::vector<GLuint> _vaoIndices;
-        std::vector<GLuint> _vboIndices;
-        std::unique_ptr<ShaderProgram> _shaderProgram;
-        std::map<int, std::pair<int, int>> _frameIndices;
+        std::unique_ptr<ShaderVariants> _ownedShaders;
+        ShaderVariants *_shaders;
+        ShaderProgram *_shaderProgram; // current variant
+        ShaderKey _shaderFeatures;
+        CrowdShader _crowdShader;      // FEATURE_INSTANCING
+        CrowdShader _posedCrowdShader; // FEATURE_INSTANCING | FEATURE_POSE_BUFFER
+        GLuint _poseVertexArray; // texture coordinate and model vertex per wedge, made on first use
+        GLuint _poseVertexBuffer;
+        GLuint _poseTexture;     // buffer texture over the pose ring
         bool _pause;
-        glm::vec3 _position;
         bool _modelLoaded;
         bool _textureLoaded;
         bool _bufferInitialized;
+        std::vector<std::vector<mesh>> _lodTriangles;
+        std::vector<wedge> _wedges; // vertex layout shared by every frame buffer
+        std::vector<unsigned short> _indices;
+        std::vector<LodStats> _lodStats; // draws are counted in the runtime record
+        LoadTimings _loadTimings;
+        std::string _assetName; // MemoryTracker tag
+        size_t _modelBytes;     // reported to MemoryTracker, released in the destructor
+        size_t _meshBytes;
     };
 }
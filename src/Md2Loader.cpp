@@ -0,0 +1,466 @@
+#include "Md2.h"
+#include "Arena.h"
+#include "MemoryTracker.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace md2model;
+
+namespace
+{
+    // Frame header (scale, translate, name) that precedes the packed vertices
+    constexpr int FRAME_HEADER_SIZE = sizeof(frame) - sizeof(framePoint_t);
+
+    bool CountInRange(const char *what, int count, int maximum)
+    {
+        if (count < 1 || count > maximum)
+        {
+            std::cerr << "Error: MD2 file has " << count << " " << what << " (1 to " << maximum << " supported)" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // The tables are read in place, so their offsets keep the alignment of the floats in `frame`
+    constexpr int TABLE_ALIGNMENT = alignof(frame);
+
+    // `count` records of `recordSize` bytes at `offset` lie inside the file
+    bool RangeInFile(const char *what, int offset, int count, long long recordSize, long length)
+    {
+        long long end = static_cast<long long>(offset) + count * recordSize;
+        if (offset < static_cast<int>(sizeof(header)) || offset % TABLE_ALIGNMENT != 0 || recordSize % TABLE_ALIGNMENT != 0 || end > length)
+        {
+            std::cerr << "Error: MD2 " << what << " (offset " << offset << ", " << count << " x " << recordSize << " bytes) are misaligned or outside the " << length << " byte file" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Smooth vertex normals from the area weighted face normals of every frame. The
+    // normalIndex stored in the file points into Quake 2's anorms table, which is not
+    // carried by this loader, so the normals are rebuilt from the geometry instead.
+    void BuildNormals(modData &model)
+    {
+        model.normalList.resize(model.pointList.size());
+        std::vector<glm::vec3> accumulated(model.numPoints);
+
+        for (int f = 0; f < model.numFrames; f++)
+        {
+            const md2model::vector *points = &model.pointList[model.numPoints * f];
+            std::fill(accumulated.begin(), accumulated.end(), glm::vec3(0.0f));
+
+            for (const mesh &triangle : model.triIndx)
+            {
+                glm::vec3 p[VERTICES_PER_TRIANGLE];
+                for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+                {
+                    const float *point = points[triangle.meshIndex[k]].point;
+                    p[k] = glm::vec3(point[0], point[1], point[2]);
+                }
+                glm::vec3 faceNormal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+                {
+                    accumulated[triangle.meshIndex[k]] += faceNormal;
+                }
+            }
+
+            for (int v = 0; v < model.numPoints; v++)
+            {
+                float length = glm::length(accumulated[v]);
+                glm::vec3 n = length > 0.0f ? accumulated[v] / length : glm::vec3(0.0f, 0.0f, 1.0f);
+                packedNormal &packed = model.normalList[model.numPoints * f + v];
+                for (int j = 0; j < POSITION_COMPONENTS; j++)
+                {
+                    packed.n[j] = static_cast<signed char>(std::lround(n[j] * NORMAL_QUANTIZATION));
+                }
+                packed.n[3] = 0;
+            }
+        }
+    }
+
+    float MeasureMotion(const modData &model, int frameA, int frameB)
+    {
+        const md2model::vector *a = &model.pointList[static_cast<size_t>(model.numPoints) * frameA];
+        const md2model::vector *b = &model.pointList[static_cast<size_t>(model.numPoints) * frameB];
+        float maxMotionSquared = 0.0f;
+        for (int i = 0; i < model.numPoints; i++)
+        {
+            float dx = b[i].point[0] - a[i].point[0];
+            float dy = b[i].point[1] - a[i].point[1];
+            float dz = b[i].point[2] - a[i].point[2];
+            maxMotionSquared = std::max(maxMotionSquared, dx * dx + dy * dy + dz * dz);
+        }
+        return std::sqrt(maxMotionSquared);
+    }
+
+    // The pairs a running animation blends between, so pose error bounds need no vertex pass
+    void BuildMotionTables(modData &model)
+    {
+        model.nextFrameMotion.resize(model.numFrames);
+        for (int f = 0; f < model.numFrames; f++)
+        {
+            model.nextFrameMotion[f] = MeasureMotion(model, f, f + 1 == model.numFrames ? 0 : f + 1);
+        }
+        for (animationClip &clip : model.clips)
+        {
+            clip.loopMotion = MeasureMotion(model, clip.firstFrame + clip.frameCount - 1, clip.firstFrame);
+        }
+    }
+
+    // Frame names are "<clip><number>", padded with zeros to 16 characters. Variants of an
+    // animation put their digit before a two digit frame number (pain101..pain104,
+    // pain201..), so with three or more trailing digits only the last two are the frame
+    // and pain1, pain2 and pain3 stay separate clips.
+    std::string ClipName(const frame &fra)
+    {
+        size_t length = 0;
+        while (length < sizeof(fra.name) && fra.name[length] != '\0')
+        {
+            length++;
+        }
+        size_t digits = 0;
+        while (digits < length && std::isdigit(static_cast<unsigned char>(fra.name[length - 1 - digits])))
+        {
+            digits++;
+        }
+        return std::string(fra.name, length - (digits >= 3 ? 2 : digits));
+    }
+
+    // GL command list as written by the Quake tools: runs of {count, then s, t and vertex
+    // index per vertex}, a positive count for a triangle strip, ended by 0. Strips are grown
+    // greedily while the next triangle continues the last edge with the strip's winding.
+    std::vector<int> BuildGLCommands(const modData &model, const std::vector<mesh> &triangles)
+    {
+        std::vector<int> commands;
+        std::vector<wedge> strip;
+        auto same = [](const wedge &a, const wedge &b)
+        { return a.meshIndex == b.meshIndex && a.stIndex == b.stIndex; };
+        auto emit = [&]()
+        {
+            if (strip.empty())
+            {
+                return;
+            }
+            commands.push_back(static_cast<int>(strip.size()));
+            for (const wedge &corner : strip)
+            {
+                int bits[2];
+                std::memcpy(&bits[0], &model.st[corner.stIndex].s, sizeof(int));
+                std::memcpy(&bits[1], &model.st[corner.stIndex].t, sizeof(int));
+                commands.push_back(bits[0]);
+                commands.push_back(bits[1]);
+                commands.push_back(corner.meshIndex);
+            }
+            strip.clear();
+        };
+
+        for (const mesh &triangle : triangles)
+        {
+            wedge corners[VERTICES_PER_TRIANGLE];
+            for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+            {
+                corners[k] = {triangle.meshIndex[k], triangle.stIndex[k]};
+            }
+
+            // Strip triangle n is (v[n], v[n+1], v[n+2]) when n is even, (v[n+1], v[n], v[n+2]) when odd
+            bool extended = false;
+            if (!strip.empty())
+            {
+                const bool odd = (strip.size() - 2) % 2 == 1;
+                const wedge &first = odd ? strip.back() : strip[strip.size() - 2];
+                const wedge &second = odd ? strip[strip.size() - 2] : strip.back();
+                for (int k = 0; k < VERTICES_PER_TRIANGLE && !extended; k++)
+                {
+                    if (same(corners[k], first) && same(corners[(k + 1) % VERTICES_PER_TRIANGLE], second))
+                    {
+                        strip.push_back(corners[(k + 2) % VERTICES_PER_TRIANGLE]);
+                        extended = true;
+                    }
+                }
+            }
+            if (!extended)
+            {
+                emit();
+                strip.assign(corners, corners + VERTICES_PER_TRIANGLE);
+            }
+        }
+        emit();
+        commands.push_back(0);
+        return commands;
+    }
+}
+
+std::unique_ptr<modData> md2model::LoadModelData(const char *md2FileName)
+{
+    FILE *fp = fopen(md2FileName, "rb");
+    if (!fp)
+    {
+        std::cerr << "Error: Could not open MD2 file: " << md2FileName << std::endl;
+        return nullptr;
+    }
+
+    // Get file size
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (length < static_cast<long>(sizeof(header)))
+    {
+        std::cerr << "Error: File too small to be a valid MD2 file" << std::endl;
+        fclose(fp);
+        return nullptr;
+    }
+
+    MemoryTracker::Transient fileMemory(MemoryTracker::MODEL, md2FileName, length);
+    // The file contents are only needed while parsing
+    ArenaScope scope(LinearArena::loadArena());
+    char *buffer = static_cast<char *>(scope.arena().allocate(length, alignof(header)));
+    size_t bytesRead = fread(buffer, sizeof(char), length, fp);
+    fclose(fp);
+
+    if (bytesRead != static_cast<size_t>(length))
+    {
+        std::cerr << "Error: Failed to read complete MD2 file" << std::endl;
+        return nullptr;
+    }
+
+    // Validate MD2 header
+    header *head = reinterpret_cast<header *>(buffer);
+
+    // Validate MD2 file format
+    if (head->id != MD2_MAGIC_NUMBER || head->version != MD2_VERSION)
+    {
+        std::cerr << "Error: Invalid MD2 file format (bad magic number or version)" << std::endl;
+        return nullptr;
+    }
+
+    // The runtime tables in Md2 are sized for the format's limits, and every table the
+    // header points to has to lie inside the file
+    if (!CountInRange("frames", head->Number_Of_Frames, MD2_MAX_FRAMES) ||
+        !CountInRange("vertices", head->vNum, MD2_MAX_VERTICES) ||
+        !CountInRange("texture coordinates", head->tNum, MD2_MAX_TEXCOORDS) ||
+        !CountInRange("triangles", head->fNum, MD2_MAX_TRIANGLES))
+    {
+        return nullptr;
+    }
+    if (head->framesize < FRAME_HEADER_SIZE + head->vNum * static_cast<int>(sizeof(framePoint_t)))
+    {
+        std::cerr << "Error: MD2 frame size " << head->framesize << " is too small for " << head->vNum << " vertices" << std::endl;
+        return nullptr;
+    }
+    if (head->textures < 0 || head->textures > MD2_MAX_SKINS)
+    {
+        std::cerr << "Error: MD2 file has " << head->textures << " skins (0 to " << MD2_MAX_SKINS << " supported)" << std::endl;
+        return nullptr;
+    }
+    // Without skins the offset is not used, exporters leave anything there
+    if ((head->textures > 0 && !RangeInFile("skins", head->offsetSkins, head->textures, MD2_SKIN_NAME_LENGTH, length)) ||
+        !RangeInFile("texture coordinates", head->offsetTCoord, head->tNum, sizeof(textindx), length) ||
+        !RangeInFile("triangles", head->offsetIndx, head->fNum, sizeof(mesh), length) ||
+        !RangeInFile("frames", head->offsetFrames, head->Number_Of_Frames, head->framesize, length))
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<modData> model = std::make_unique<modData>();
+
+    model->numPoints = head->vNum;
+    model->numFrames = head->Number_Of_Frames;
+    model->frameSize = head->framesize;
+    model->twidth = head->twidth;
+    model->theight = head->theight;
+    model->numSkins = head->textures;
+    model->numGLCommands = head->numGLcmds;
+    if (head->textures > 0)
+    {
+        model->skinNames.assign(&buffer[head->offsetSkins], &buffer[head->offsetSkins] + head->textures * MD2_SKIN_NAME_LENGTH);
+    }
+
+    // Reserve space for vectors
+    model->pointList.resize(head->vNum * head->Number_Of_Frames);
+    model->quantizedPoints.resize(head->vNum * head->Number_Of_Frames);
+    model->frameTransforms.resize(head->Number_Of_Frames);
+    model->frameNames.resize(head->Number_Of_Frames * MD2_FRAME_NAME_LENGTH);
+
+    // Load vertex data
+    for (int count = 0; count < head->Number_Of_Frames; count++)
+    {
+        frame *fra = reinterpret_cast<frame *>(&buffer[head->offsetFrames + head->framesize * count]);
+        for (int j = 0; j < POSITION_COMPONENTS; j++)
+        {
+            model->frameTransforms[count].scale[j] = fra->scale[j];
+            model->frameTransforms[count].translate[j] = fra->translate[j];
+        }
+        // The packed form is what the CPU pose kernel decodes directly
+        std::memcpy(&model->quantizedPoints[head->vNum * count], fra->fp, head->vNum * sizeof(framePoint_t));
+        std::memcpy(&model->frameNames[count * MD2_FRAME_NAME_LENGTH], fra->name, MD2_FRAME_NAME_LENGTH);
+
+        std::string clipName = ClipName(*fra);
+        if (model->clips.empty() || model->clips.back().name != clipName)
+        {
+            model->clips.push_back({clipName, count, 0, 0.0f});
+        }
+        model->clips.back().frameCount++;
+
+        for (int count2 = 0; count2 < head->vNum; count2++)
+        {
+            GLint index = head->vNum * count + count2;
+            model->pointList[index].point[0] = fra->scale[0] * fra->fp[count2].v[0] + fra->translate[0];
+            model->pointList[index].point[1] = fra->scale[1] * fra->fp[count2].v[1] + fra->translate[1];
+            model->pointList[index].point[2] = fra->scale[2] * fra->fp[count2].v[2] + fra->translate[2];
+        }
+    }
+
+    // Load texture coordinates
+    model->numST = head->tNum;
+    model->st.resize(head->tNum);
+    textindx *stPtr = reinterpret_cast<textindx *>(&buffer[head->offsetTCoord]);
+
+    for (int count = 0; count < head->tNum; count++)
+    {
+        model->st[count].s = static_cast<float>(stPtr[count].s) / static_cast<float>(head->twidth);
+        model->st[count].t = static_cast<float>(stPtr[count].t) / static_cast<float>(head->theight);
+    }
+
+    // Load triangle indices
+    model->numTriangles = head->fNum;
+    model->triIndx.resize(head->fNum);
+    mesh *bufIndexPtr = reinterpret_cast<mesh *>(&buffer[head->offsetIndx]);
+
+    for (int count2 = 0; count2 < head->fNum; count2++)
+    {
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            if (bufIndexPtr[count2].meshIndex[k] >= head->vNum || bufIndexPtr[count2].stIndex[k] >= head->tNum)
+            {
+                std::cerr << "Error: MD2 triangle " << count2 << " indexes past the vertex or texture coordinate table" << std::endl;
+                return nullptr;
+            }
+        }
+        model->triIndx[count2].meshIndex[0] = bufIndexPtr[count2].meshIndex[0];
+        model->triIndx[count2].meshIndex[1] = bufIndexPtr[count2].meshIndex[1];
+        model->triIndx[count2].meshIndex[2] = bufIndexPtr[count2].meshIndex[2];
+
+        model->triIndx[count2].stIndex[0] = bufIndexPtr[count2].stIndex[0];
+        model->triIndx[count2].stIndex[1] = bufIndexPtr[count2].stIndex[1];
+        model->triIndx[count2].stIndex[2] = bufIndexPtr[count2].stIndex[2];
+    }
+
+    BuildNormals(*model);
+    BuildMotionTables(*model);
+
+    model->currentFrame = 0;
+    model->nextFrame = 1;
+    model->interpol = 0.0;
+
+    if (!MemoryTracker::global().fitsBudget(MemoryTracker::MODEL, MemoryTracker::CPU, ModelDataBytes(*model), md2FileName))
+    {
+        return nullptr;
+    }
+    return model;
+}
+
+float md2model::KeyframeMotion(const modData &model, int frameA, int frameB)
+{
+    if (frameB == (frameA + 1 == model.numFrames ? 0 : frameA + 1))
+    {
+        return model.nextFrameMotion[frameA];
+    }
+    for (const animationClip &clip : model.clips)
+    {
+        if (frameA == clip.firstFrame + clip.frameCount - 1 && frameB == clip.firstFrame)
+        {
+            return clip.loopMotion;
+        }
+    }
+    return MeasureMotion(model, frameA, frameB);
+}
+
+size_t md2model::ModelDataBytes(const modData &model)
+{
+    size_t bytes = sizeof(modData);
+    bytes += model.triIndx.capacity() * sizeof(mesh);
+    bytes += model.st.capacity() * sizeof(textcoord);
+    bytes += model.pointList.capacity() * sizeof(md2model::vector);
+    bytes += model.quantizedPoints.capacity() * sizeof(framePoint_t);
+    bytes += model.frameTransforms.capacity() * sizeof(frameTransform);
+    bytes += model.normalList.capacity() * sizeof(packedNormal);
+    bytes += model.clips.capacity() * sizeof(animationClip);
+    bytes += model.frameNames.capacity() + model.skinNames.capacity();
+    bytes += model.nextFrameMotion.capacity() * sizeof(float);
+    return bytes;
+}
+
+bool md2model::SaveModelData(const char *md2FileName, const modData &model, const std::vector<mesh> &triangles)
+{
+    const int frameSize = FRAME_HEADER_SIZE + model.numPoints * static_cast<int>(sizeof(framePoint_t));
+    const std::vector<int> glCommands = BuildGLCommands(model, triangles);
+
+    header head = {};
+    head.id = MD2_MAGIC_NUMBER;
+    head.version = MD2_VERSION;
+    head.twidth = model.twidth;
+    head.theight = model.theight;
+    head.framesize = frameSize;
+    head.textures = model.numSkins;
+    head.vNum = model.numPoints;
+    head.tNum = model.numST;
+    head.fNum = static_cast<int>(triangles.size());
+    head.numGLcmds = static_cast<int>(glCommands.size());
+    head.Number_Of_Frames = model.numFrames;
+    head.offsetSkins = sizeof(header);
+    head.offsetTCoord = head.offsetSkins + model.numSkins * MD2_SKIN_NAME_LENGTH;
+    head.offsetIndx = head.offsetTCoord + model.numST * static_cast<int>(sizeof(textindx));
+    head.offsetFrames = head.offsetIndx + head.fNum * static_cast<int>(sizeof(mesh));
+    head.offsetGLcmds = head.offsetFrames + model.numFrames * frameSize;
+    head.offsetEnd = head.offsetGLcmds + head.numGLcmds * static_cast<int>(sizeof(int));
+
+    std::vector<char> buffer(head.offsetEnd, 0);
+    std::memcpy(buffer.data(), &head, sizeof(head));
+    if (!model.skinNames.empty())
+    {
+        std::memcpy(&buffer[head.offsetSkins], model.skinNames.data(), model.skinNames.size());
+    }
+
+    textindx *st = reinterpret_cast<textindx *>(&buffer[head.offsetTCoord]);
+    for (int i = 0; i < model.numST; i++)
+    {
+        st[i].s = static_cast<short>(std::lround(model.st[i].s * model.twidth));
+        st[i].t = static_cast<short>(std::lround(model.st[i].t * model.theight));
+    }
+    if (!triangles.empty())
+    {
+        std::memcpy(&buffer[head.offsetIndx], triangles.data(), triangles.size() * sizeof(mesh));
+    }
+
+    for (int f = 0; f < model.numFrames; f++)
+    {
+        frame *fra = reinterpret_cast<frame *>(&buffer[head.offsetFrames + frameSize * f]);
+        for (int j = 0; j < POSITION_COMPONENTS; j++)
+        {
+            fra->scale[j] = model.frameTransforms[f].scale[j];
+            fra->translate[j] = model.frameTransforms[f].translate[j];
+        }
+        std::memcpy(fra->name, &model.frameNames[f * MD2_FRAME_NAME_LENGTH], MD2_FRAME_NAME_LENGTH);
+        std::memcpy(fra->fp, &model.quantizedPoints[static_cast<size_t>(model.numPoints) * f], model.numPoints * sizeof(framePoint_t));
+    }
+    std::memcpy(&buffer[head.offsetGLcmds], glCommands.data(), glCommands.size() * sizeof(int));
+
+    std::ofstream file(md2FileName, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Could not create MD2 file: " << md2FileName << std::endl;
+        return false;
+    }
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    if (!file)
+    {
+        std::cerr << "Error: Failed to write MD2 file: " << md2FileName << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,284 @@
+#include "MemoryTracker.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+    constexpr double BYTES_PER_KB = 1024.0;
+
+    size_t &Field(MemoryUsage &usage, MemoryTracker::Kind kind)
+    {
+        switch (kind)
+        {
+        case MemoryTracker::GPU_BUFFER:
+            return usage.gpuBufferBytes;
+        case MemoryTracker::GPU_TEXTURE:
+            return usage.gpuTextureBytes;
+        default:
+            return usage.cpuBytes;
+        }
+    }
+
+    void Add(MemoryUsage &usage, MemoryTracker::Kind kind, size_t bytes)
+    {
+        Field(usage, kind) += bytes;
+        usage.peakCpuBytes = std::max(usage.peakCpuBytes, usage.cpuBytes);
+        usage.peakGpuBytes = std::max(usage.peakGpuBytes, usage.gpuBufferBytes + usage.gpuTextureBytes);
+    }
+
+    void Remove(MemoryUsage &usage, MemoryTracker::Kind kind, size_t bytes)
+    {
+        size_t &field = Field(usage, kind);
+        field -= std::min(field, bytes);
+    }
+
+    void AddTransient(MemoryUsage &usage, size_t bytes)
+    {
+        usage.transientBytes += bytes;
+        usage.peakTransientBytes = std::max(usage.peakTransientBytes, usage.transientBytes);
+    }
+
+    // Peaks of a sum are not the sum of peaks, so subsystem totals only add up current values
+    void Accumulate(MemoryUsage &total, const MemoryUsage &usage)
+    {
+        total.cpuBytes += usage.cpuBytes;
+        total.gpuBufferBytes += usage.gpuBufferBytes;
+        total.gpuTextureBytes += usage.gpuTextureBytes;
+        total.transientBytes += usage.transientBytes;
+        total.peakCpuBytes = std::max(total.peakCpuBytes, usage.peakCpuBytes);
+        total.peakGpuBytes = std::max(total.peakGpuBytes, usage.peakGpuBytes);
+        total.peakTransientBytes = std::max(total.peakTransientBytes, usage.peakTransientBytes);
+    }
+}
+
+MemoryTracker::Transient::Transient(Subsystem subsystem, const std::string &asset, size_t bytes)
+    : _subsystem(subsystem),
+      _asset(asset),
+      _bytes(bytes)
+{
+    MemoryTracker::global().addTransient(_subsystem, _asset, _bytes);
+}
+
+MemoryTracker::Transient::~Transient()
+{
+    MemoryTracker::global().removeTransient(_subsystem, _asset, _bytes);
+}
+
+MemoryTracker &MemoryTracker::global()
+{
+    static MemoryTracker tracker;
+    return tracker;
+}
+
+const char *MemoryTracker::getSubsystemName(Subsystem subsystem)
+{
+    switch (subsystem)
+    {
+    case MODEL:
+        return "model";
+    case MESH:
+        return "mesh";
+    case TEXTURE:
+        return "texture";
+    case SHADER:
+        return "shader";
+    case STREAM:
+        return "stream";
+    default:
+        return "unknown";
+    }
+}
+
+void MemoryTracker::allocate(Subsystem subsystem, const std::string &asset, Kind kind, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    addLocked({subsystem, asset}, kind, bytes);
+}
+
+void MemoryTracker::release(Subsystem subsystem, const std::string &asset, Kind kind, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    removeLocked({subsystem, asset}, kind, bytes);
+}
+
+void MemoryTracker::trackBuffer(GLuint buffer, size_t bytes, Subsystem subsystem, const std::string &asset)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _buffers.find(buffer);
+    if (it != _buffers.end())
+    {
+        removeLocked({it->second.subsystem, it->second.asset}, GPU_BUFFER, it->second.bytes);
+    }
+    _buffers[buffer] = {bytes, subsystem, asset};
+    addLocked({subsystem, asset}, GPU_BUFFER, bytes);
+}
+
+void MemoryTracker::trackTexture(GLuint texture, size_t bytes, Subsystem subsystem, const std::string &asset)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _textures.find(texture);
+    if (it != _textures.end())
+    {
+        removeLocked({it->second.subsystem, it->second.asset}, GPU_TEXTURE, it->second.bytes);
+    }
+    _textures[texture] = {bytes, subsystem, asset};
+    addLocked({subsystem, asset}, GPU_TEXTURE, bytes);
+}
+
+void MemoryTracker::untrackBuffer(GLuint buffer)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _buffers.find(buffer);
+    if (it != _buffers.end())
+    {
+        removeLocked({it->second.subsystem, it->second.asset}, GPU_BUFFER, it->second.bytes);
+        _buffers.erase(it);
+    }
+}
+
+void MemoryTracker::untrackTexture(GLuint texture)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _textures.find(texture);
+    if (it != _textures.end())
+    {
+        removeLocked({it->second.subsystem, it->second.asset}, GPU_TEXTURE, it->second.bytes);
+        _textures.erase(it);
+    }
+}
+
+void MemoryTracker::setBudget(Subsystem subsystem, Kind kind, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _budgets[subsystem][kind] = bytes;
+}
+
+bool MemoryTracker::fitsBudget(Subsystem subsystem, Kind kind, size_t bytes, const std::string &asset) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t budget = _budgets[subsystem][kind];
+    size_t current = currentLocked(subsystem, kind);
+    if (budget == 0 || current + bytes <= budget)
+    {
+        return true;
+    }
+
+    std::cerr << "Error: " << asset << " needs " << bytes / BYTES_PER_KB << " KB, the " << getSubsystemName(subsystem)
+              << " budget has " << (budget > current ? budget - current : 0) / BYTES_PER_KB << " KB left" << std::endl;
+    return false;
+}
+
+MemoryUsage MemoryTracker::getUsage(Subsystem subsystem) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    MemoryUsage total{};
+    for (const auto &entry : _usage)
+    {
+        if (entry.first.first == subsystem)
+        {
+            Accumulate(total, entry.second);
+        }
+    }
+    return total;
+}
+
+MemoryUsage MemoryTracker::getUsage(Subsystem subsystem, const std::string &asset) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _usage.find({subsystem, asset});
+    return it != _usage.end() ? it->second : MemoryUsage{};
+}
+
+MemoryUsage MemoryTracker::getTotal() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _total;
+}
+
+std::vector<MemoryTracker::Record> MemoryTracker::getReport() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<Record> report;
+    for (const auto &entry : _usage)
+    {
+        report.push_back({entry.first.first, entry.first.second, entry.second});
+    }
+    return report;
+}
+
+void MemoryTracker::printReport() const
+{
+    std::vector<Record> report = getReport();
+    MemoryUsage total = getTotal();
+
+    std::cout << std::left << std::setw(10) << "Subsystem" << std::setw(24) << "Asset" << std::right
+              << std::setw(10) << "CPU KB" << std::setw(12) << "GPU buf KB" << std::setw(12) << "GPU tex KB"
+              << std::setw(14) << "Peak temp KB" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const Record &record : report)
+    {
+        std::cout << std::left << std::setw(10) << getSubsystemName(record.subsystem) << std::setw(24) << record.asset << std::right
+                  << std::setw(10) << record.usage.cpuBytes / BYTES_PER_KB
+                  << std::setw(12) << record.usage.gpuBufferBytes / BYTES_PER_KB
+                  << std::setw(12) << record.usage.gpuTextureBytes / BYTES_PER_KB
+                  << std::setw(14) << record.usage.peakTransientBytes / BYTES_PER_KB << std::endl;
+    }
+    std::cout << std::left << std::setw(34) << "total" << std::right
+              << std::setw(10) << total.cpuBytes / BYTES_PER_KB
+              << std::setw(12) << total.gpuBufferBytes / BYTES_PER_KB
+              << std::setw(12) << total.gpuTextureBytes / BYTES_PER_KB
+              << std::setw(14) << total.peakTransientBytes / BYTES_PER_KB << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+void MemoryTracker::addLocked(const Key &key, Kind kind, size_t bytes)
+{
+    Add(_usage[key], kind, bytes);
+    Add(_total, kind, bytes);
+}
+
+void MemoryTracker::removeLocked(const Key &key, Kind kind, size_t bytes)
+{
+    Remove(_usage[key], kind, bytes);
+    Remove(_total, kind, bytes);
+}
+
+void MemoryTracker::addTransient(Subsystem subsystem, const std::string &asset, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    AddTransient(_usage[{subsystem, asset}], bytes);
+    AddTransient(_total, bytes);
+}
+
+void MemoryTracker::removeTransient(Subsystem subsystem, const std::string &asset, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    MemoryUsage &usage = _usage[{subsystem, asset}];
+    usage.transientBytes -= std::min(usage.transientBytes, bytes);
+    _total.transientBytes -= std::min(_total.transientBytes, bytes);
+}
+
+size_t MemoryTracker::currentLocked(Subsystem subsystem, Kind kind) const
+{
+    size_t current = 0;
+    for (const auto &entry : _usage)
+    {
+        if (entry.first.first == subsystem)
+        {
+            switch (kind)
+            {
+            case GPU_BUFFER:
+                current += entry.second.gpuBufferBytes;
+                break;
+            case GPU_TEXTURE:
+                current += entry.second.gpuTextureBytes;
+                break;
+            default:
+                current += entry.second.cpuBytes;
+                break;
+            }
+        }
+    }
+    return current;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "GL/glew.h"
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct MemoryUsage
+{
+    size_t cpuBytes;
+    size_t gpuBufferBytes;
+    size_t gpuTextureBytes;
+    size_t peakCpuBytes;
+    size_t peakGpuBytes;
+    size_t transientBytes;     // scratch memory alive during loading
+    size_t peakTransientBytes;
+};
+
+// Memory accounting by subsystem and asset (the file an allocation belongs to). CPU
+// containers are reported by their owners, GL buffers and textures are tracked by name
+// between creation and deletion, and load-time scratch buffers are tracked with a
+// Transient guard so their peak is known. Budgets set here are checked by the loaders.
+// Thread safe.
+class MemoryTracker
+{
+public:
+    enum Subsystem
+    {
+        MODEL,   // parsed MD2 data and keyframe buffers
+        MESH,    // LOD triangles, wedges and index buffers
+        TEXTURE,
+        SHADER,
+        STREAM,  // per-frame ring buffers
+        SUBSYSTEM_COUNT
+    };
+
+    enum Kind
+    {
+        CPU,
+        GPU_BUFFER,
+        GPU_TEXTURE,
+        KIND_COUNT
+    };
+
+    struct Record
+    {
+        Subsystem subsystem;
+        std::string asset;
+        MemoryUsage usage;
+    };
+
+    // Scratch memory for the lifetime of the guard, e.g. a file read into memory
+    class Transient
+    {
+    public:
+        Transient(Subsystem subsystem, const std::string &asset, size_t bytes);
+        ~Transient();
+
+    private:
+        Transient(const Transient &rhs) = delete;
+        Transient &operator=(const Transient &rhs) = delete;
+
+        Subsystem _subsystem;
+        std::string _asset;
+        size_t _bytes;
+    };
+
+    static MemoryTracker &global();
+    static const char *getSubsystemName(Subsystem subsystem);
+
+    void allocate(Subsystem subsystem, const std::string &asset, Kind kind, size_t bytes);
+    void release(Subsystem subsystem, const std::string &asset, Kind kind, size_t bytes);
+
+    // Call after glBufferData / glBufferStorage / glTexImage2D. Tracking the same name
+    // again replaces its size (buffer re-specification).
+    void trackBuffer(GLuint buffer, size_t bytes, Subsystem subsystem, const std::string &asset);
+    void trackTexture(GLuint texture, size_t bytes, Subsystem subsystem, const std::string &asset);
+    // Call before glDeleteBuffers / glDeleteTextures, unknown names are ignored
+    void untrackBuffer(GLuint buffer);
+    void untrackTexture(GLuint texture);
+
+    // 0 means no limit. The budget covers the whole subsystem, every asset together.
+    void setBudget(Subsystem subsystem, Kind kind, size_t bytes);
+    // Loaders call this before allocating, it prints the reason when the answer is no
+    bool fitsBudget(Subsystem subsystem, Kind kind, size_t bytes, const std::string &asset) const;
+
+    // Current values summed over assets, peaks are those of the largest asset
+    MemoryUsage getUsage(Subsystem subsystem) const;
+    MemoryUsage getUsage(Subsystem subsystem, const std::string &asset) const;
+    MemoryUsage getTotal() const;
+    // One record per subsystem and asset, sorted by subsystem then asset
+    std::vector<Record> getReport() const;
+    void printReport() const;
+
+private:
+    struct GlObject
+    {
+        size_t bytes;
+        Subsystem subsystem;
+        std::string asset;
+    };
+
+    using Key = std::pair<Subsystem, std::string>;
+
+    void addLocked(const Key &key, Kind kind, size_t bytes);
+    void removeLocked(const Key &key, Kind kind, size_t bytes);
+    void addTransient(Subsystem subsystem, const std::string &asset, size_t bytes);
+    void removeTransient(Subsystem subsystem, const std::string &asset, size_t bytes);
+    size_t currentLocked(Subsystem subsystem, Kind kind) const;
+
+    mutable std::mutex _mutex;
+    std::map<Key, MemoryUsage> _usage;
+    MemoryUsage _total = {}; // with the peaks of the process as a whole
+    std::map<GLuint, GlObject> _buffers;
+    std::map<GLuint, GlObject> _textures;
+    size_t _budgets[SUBSYSTEM_COUNT][KIND_COUNT] = {};
+};
@@ -0,0 +1,358 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+using namespace md2model;
+
+namespace
+{
+    // Forsyth's scoring function, tuned for an LRU cache of this size
+    constexpr int FORSYTH_CACHE_SIZE = 32;
+    constexpr float CACHE_DECAY_POWER = 1.5f;
+    constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+    constexpr float VALENCE_BOOST_SCALE = 2.0f;
+    constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+    float VertexScore(int cachePosition, int remainingValence)
+    {
+        if (remainingValence == 0)
+        {
+            // No triangle needs this vertex anymore
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < VERTICES_PER_TRIANGLE)
+            {
+                // Used by the last triangle, a fixed score avoids favouring one of its edges
+                score = LAST_TRIANGLE_SCORE;
+            }
+            else
+            {
+                const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - VERTICES_PER_TRIANGLE);
+                score = std::pow(1.0f - (cachePosition - VERTICES_PER_TRIANGLE) * scaler, CACHE_DECAY_POWER);
+            }
+        }
+
+        // Vertices with few triangles left are finished first so they can leave the cache
+        score += VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingValence), -VALENCE_BOOST_POWER);
+        return score;
+    }
+
+    glm::vec3 TriangleNormal(const std::vector<unsigned short> &indices, size_t triangle, const std::vector<glm::vec3> &positions)
+    {
+        const glm::vec3 &p0 = positions[indices[triangle * VERTICES_PER_TRIANGLE]];
+        const glm::vec3 &p1 = positions[indices[triangle * VERTICES_PER_TRIANGLE + 1]];
+        const glm::vec3 &p2 = positions[indices[triangle * VERTICES_PER_TRIANGLE + 2]];
+        return glm::cross(p1 - p0, p2 - p0);
+    }
+}
+
+std::vector<wedge> md2model::BuildWedges(const std::vector<mesh> &triangles)
+{
+    std::vector<wedge> wedges;
+    std::map<std::pair<int, int>, int> lookup;
+    for (const mesh &triangle : triangles)
+    {
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            std::pair<int, int> key(triangle.meshIndex[k], triangle.stIndex[k]);
+            if (lookup.find(key) == lookup.end())
+            {
+                lookup[key] = static_cast<int>(wedges.size());
+                wedges.push_back({triangle.meshIndex[k], triangle.stIndex[k]});
+            }
+        }
+    }
+    return wedges;
+}
+
+std::vector<unsigned short> md2model::BuildIndices(const std::vector<mesh> &triangles, const std::vector<wedge> &wedges)
+{
+    std::map<std::pair<int, int>, int> lookup;
+    for (size_t i = 0; i < wedges.size(); i++)
+    {
+        lookup[{wedges[i].meshIndex, wedges[i].stIndex}] = static_cast<int>(i);
+    }
+
+    std::vector<unsigned short> indices;
+    indices.reserve(triangles.size() * VERTICES_PER_TRIANGLE);
+    for (const mesh &triangle : triangles)
+    {
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            indices.emplace_back(static_cast<unsigned short>(lookup.at({triangle.meshIndex[k], triangle.stIndex[k]})));
+        }
+    }
+    return indices;
+}
+
+void md2model::OptimizeVertexCache(std::vector<unsigned short> &indices, int vertexCount)
+{
+    const int triangleCount = static_cast<int>(indices.size() / VERTICES_PER_TRIANGLE);
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // Vertex to triangle adjacency, stored compactly. remaining[v] shrinks as triangles are emitted.
+    std::vector<int> remaining(vertexCount, 0);
+    for (unsigned short index : indices)
+    {
+        remaining[index]++;
+    }
+    std::vector<int> offsets(vertexCount + 1, 0);
+    for (int v = 0; v < vertexCount; v++)
+    {
+        offsets[v + 1] = offsets[v] + remaining[v];
+    }
+    std::vector<int> adjacency(indices.size());
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int t = 0; t < triangleCount; t++)
+    {
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            adjacency[fill[indices[t * VERTICES_PER_TRIANGLE + k]]++] = t;
+        }
+    }
+
+    std::vector<float> vertexScores(vertexCount);
+    for (int v = 0; v < vertexCount; v++)
+    {
+        vertexScores[v] = VertexScore(-1, remaining[v]);
+    }
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    int best = 0;
+    for (int t = 0; t < triangleCount; t++)
+    {
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+        if (triangleScores[t] > triangleScores[best])
+        {
+            best = t;
+        }
+    }
+
+    std::vector<int> cache;
+    std::vector<int> nextCache;
+    std::vector<unsigned short> result;
+    result.reserve(indices.size());
+    int scanCursor = 0;
+
+    while (best >= 0)
+    {
+        emitted[best] = true;
+        nextCache.clear();
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            int v = indices[best * VERTICES_PER_TRIANGLE + k];
+            result.emplace_back(static_cast<unsigned short>(v));
+            nextCache.emplace_back(v);
+
+            // Drop the emitted triangle from the vertex's remaining list
+            int *begin = &adjacency[offsets[v]];
+            int *end = begin + remaining[v];
+            *std::find(begin, end, best) = *(end - 1);
+            remaining[v]--;
+        }
+        for (int v : cache)
+        {
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+            {
+                nextCache.emplace_back(v);
+            }
+        }
+
+        // Vertices pushed out of the cache still need a score update, they are kept
+        // in the list for this pass only
+        for (size_t i = 0; i < nextCache.size(); i++)
+        {
+            int v = nextCache[i];
+            int position = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+            vertexScores[v] = VertexScore(position, remaining[v]);
+        }
+
+        best = -1;
+        float bestScore = -1.0f;
+        for (int v : nextCache)
+        {
+            for (int i = 0; i < remaining[v]; i++)
+            {
+                int t = adjacency[offsets[v] + i];
+                triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+
+        if (nextCache.size() > FORSYTH_CACHE_SIZE)
+        {
+            nextCache.resize(FORSYTH_CACHE_SIZE);
+        }
+        cache.swap(nextCache);
+
+        // Nothing adjacent to the cache is left, continue with the next unemitted triangle
+        if (best < 0)
+        {
+            while (scanCursor < triangleCount && emitted[scanCursor])
+            {
+                scanCursor++;
+            }
+            best = scanCursor < triangleCount ? scanCursor : -1;
+        }
+    }
+
+    indices.swap(result);
+}
+
+void md2model::OptimizeOverdraw(std::vector<unsigned short> &indices, const std::vector<glm::vec3> &positions, float threshold)
+{
+    const size_t triangleCount = indices.size() / VERTICES_PER_TRIANGLE;
+    const int vertexCount = static_cast<int>(positions.size());
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // Split the list where the simulated cache misses a whole triangle. Reordering whole
+    // clusters keeps almost all the reuse the cache optimization produced.
+    std::vector<size_t> clusterStarts;
+    std::vector<long long> cacheTime(vertexCount, -(VERTEX_CACHE_SIZE + 1));
+    long long time = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        int misses = 0;
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            unsigned short v = indices[t * VERTICES_PER_TRIANGLE + k];
+            if (time - cacheTime[v] >= VERTEX_CACHE_SIZE)
+            {
+                cacheTime[v] = time++;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == VERTICES_PER_TRIANGLE)
+        {
+            clusterStarts.emplace_back(t);
+        }
+    }
+    clusterStarts.emplace_back(triangleCount);
+
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        float area = glm::length(TriangleNormal(indices, t, positions));
+        meshCenter += (positions[indices[t * 3]] + positions[indices[t * 3 + 1]] + positions[indices[t * 3 + 2]]) * (area / 3.0f);
+        meshArea += area;
+    }
+    if (meshArea > 0.0f)
+    {
+        meshCenter = meshCenter / meshArea;
+    }
+
+    // Clusters facing away from the center are likely to occlude the rest of the mesh
+    struct Cluster
+    {
+        size_t first;
+        size_t last;
+        float sortKey;
+    };
+    std::vector<Cluster> clusters;
+    for (size_t c = 0; c + 1 < clusterStarts.size(); c++)
+    {
+        glm::vec3 center(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+        {
+            glm::vec3 n = TriangleNormal(indices, t, positions);
+            float a = glm::length(n);
+            center += (positions[indices[t * 3]] + positions[indices[t * 3 + 1]] + positions[indices[t * 3 + 2]]) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        float normalLength = glm::length(normal);
+        float key = 0.0f;
+        if (area > 0.0f && normalLength > 0.0f)
+        {
+            key = glm::dot(center / area - meshCenter, normal / normalLength);
+        }
+        clusters.push_back({clusterStarts[c], clusterStarts[c + 1], key});
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b)
+                     { return a.sortKey > b.sortKey; });
+
+    std::vector<unsigned short> result;
+    result.reserve(indices.size());
+    for (const Cluster &cluster : clusters)
+    {
+        result.insert(result.end(), indices.begin() + cluster.first * VERTICES_PER_TRIANGLE, indices.begin() + cluster.last * VERTICES_PER_TRIANGLE);
+    }
+
+    float before = SimulateVertexCache(indices, vertexCount).acmr;
+    float after = SimulateVertexCache(result, vertexCount).acmr;
+    if (after <= before * threshold)
+    {
+        indices.swap(result);
+    }
+}
+
+std::vector<int> md2model::OptimizeVertexFetch(std::vector<unsigned short> &indices, int vertexCount)
+{
+    std::vector<int> remap(vertexCount, -1);
+    int next = 0;
+    for (unsigned short &index : indices)
+    {
+        if (remap[index] < 0)
+        {
+            remap[index] = next++;
+        }
+        index = static_cast<unsigned short>(remap[index]);
+    }
+
+    // Unreferenced vertices keep their relative order at the end of the buffer
+    for (int &entry : remap)
+    {
+        if (entry < 0)
+        {
+            entry = next++;
+        }
+    }
+    return remap;
+}
+
+CacheStats md2model::SimulateVertexCache(const std::vector<unsigned short> &indices, int vertexCount, int cacheSize)
+{
+    std::vector<long long> cacheTime(vertexCount, -(static_cast<long long>(cacheSize) + 1));
+    std::vector<bool> referenced(vertexCount, false);
+    long long time = 0;
+    int uniqueVertices = 0;
+
+    for (unsigned short index : indices)
+    {
+        if (time - cacheTime[index] >= cacheSize)
+        {
+            // FIFO: a hit does not refresh the entry
+            cacheTime[index] = time++;
+        }
+        if (!referenced[index])
+        {
+            referenced[index] = true;
+            uniqueVertices++;
+        }
+    }
+
+    CacheStats stats;
+    size_t triangleCount = indices.size() / VERTICES_PER_TRIANGLE;
+    stats.acmr = triangleCount > 0 ? static_cast<float>(time) / triangleCount : 0.0f;
+    stats.atvr = uniqueVertices > 0 ? static_cast<float>(time) / uniqueVertices : 0.0f;
+    return stats;
+}
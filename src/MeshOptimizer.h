@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Md2.h"
+
+#include <vector>
+
+namespace md2model
+{
+    // Post-transform vertex cache used by the optimizer and the simulator
+    constexpr int VERTEX_CACHE_SIZE = 16;
+    // Overdraw sorting may cost at most this much ACMR compared to the cache-only order
+    constexpr float OVERDRAW_ACMR_THRESHOLD = 1.05f;
+
+    struct CacheStats
+    {
+        float acmr; // average cache miss ratio: transformed vertices per triangle
+        float atvr; // average transform to vertex ratio: transformed vertices per referenced vertex
+    };
+
+    // Collects the wedges used by `triangles` in first-use order
+    std::vector<wedge> BuildWedges(const std::vector<mesh> &triangles);
+
+    // Builds the index list of `triangles`. Every corner must be present in `wedges`.
+    std::vector<unsigned short> BuildIndices(const std::vector<mesh> &triangles, const std::vector<wedge> &wedges);
+
+    // Reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+    void OptimizeVertexCache(std::vector<unsigned short> &indices, int vertexCount);
+
+    // Reorders clusters of the cache-optimized triangle list so outward facing
+    // geometry is drawn first. `positions` holds one averaged position per vertex.
+    void OptimizeOverdraw(std::vector<unsigned short> &indices, const std::vector<glm::vec3> &positions, float threshold = OVERDRAW_ACMR_THRESHOLD);
+
+    // Reorders vertices in first-use order and rewrites `indices` accordingly.
+    // Returns the old-to-new remap table that has to be applied to the vertex data
+    // and to any other index list referencing the same vertices.
+    std::vector<int> OptimizeVertexFetch(std::vector<unsigned short> &indices, int vertexCount);
+
+    // CPU-only FIFO cache simulator, so results can be checked without a GL context
+    CacheStats SimulateVertexCache(const std::vector<unsigned short> &indices, int vertexCount, int cacheSize = VERTEX_CACHE_SIZE);
+}
@@ -0,0 +1,431 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+using namespace md2model;
+
+namespace
+{
+    // Triangles whose normal turns by more than 90 degrees in any frame are rejected
+    constexpr float FLIP_THRESHOLD = 0.0f;
+
+    glm::vec3 ToVec3(const md2model::vector &v)
+    {
+        return glm::vec3(v.point[0], v.point[1], v.point[2]);
+    }
+
+    int CornerOf(const mesh &triangle, int vertex)
+    {
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            if (triangle.meshIndex[k] == vertex)
+            {
+                return k;
+            }
+        }
+        return -1;
+    }
+}
+
+MeshSimplifier::MeshSimplifier(const modData &model) : _model(model),
+                                                       _triangles(model.triIndx),
+                                                       _triangleAlive(model.numTriangles, true),
+                                                       _vertexTriangles(model.numPoints),
+                                                       _stamps(model.numPoints, 0),
+                                                       _boundary(model.numPoints, false),
+                                                       _aliveTriangles(model.numTriangles)
+{
+    BuildAdjacency();
+    BuildQuadrics();
+}
+
+const md2model::vector &MeshSimplifier::Position(int frame, int vertex) const
+{
+    return _model.pointList[_model.numPoints * frame + vertex];
+}
+
+void MeshSimplifier::BuildAdjacency()
+{
+    std::map<std::pair<int, int>, int> edgeUse;
+    for (int t = 0; t < _model.numTriangles; t++)
+    {
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            int a = _triangles[t].meshIndex[k];
+            int b = _triangles[t].meshIndex[(k + 1) % VERTICES_PER_TRIANGLE];
+            _vertexTriangles[a].emplace_back(t);
+            edgeUse[{std::min(a, b), std::max(a, b)}]++;
+        }
+    }
+
+    // Open edges are only ever collapsed along themselves so the outline survives
+    for (const auto &edge : edgeUse)
+    {
+        if (edge.second == 1)
+        {
+            _boundary[edge.first.first] = true;
+            _boundary[edge.first.second] = true;
+        }
+    }
+}
+
+void MeshSimplifier::BuildQuadrics()
+{
+    _quadrics.assign(static_cast<size_t>(_model.numFrames) * _model.numPoints, Quadric{});
+
+    for (int f = 0; f < _model.numFrames; f++)
+    {
+        Quadric *frameQuadrics = &_quadrics[static_cast<size_t>(f) * _model.numPoints];
+        for (const mesh &triangle : _triangles)
+        {
+            glm::vec3 p0 = ToVec3(Position(f, triangle.meshIndex[0]));
+            glm::vec3 p1 = ToVec3(Position(f, triangle.meshIndex[1]));
+            glm::vec3 p2 = ToVec3(Position(f, triangle.meshIndex[2]));
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float len = glm::length(n);
+            if (len <= 1e-8f)
+            {
+                continue;
+            }
+            n = n / len;
+            double a = n.x, b = n.y, c = n.z, d = -glm::dot(n, p0);
+            const double plane[10] = {a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d};
+
+            for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+            {
+                Quadric &q = frameQuadrics[triangle.meshIndex[k]];
+                for (int i = 0; i < 10; i++)
+                {
+                    q.a[i] += plane[i];
+                }
+            }
+        }
+    }
+}
+
+double MeshSimplifier::CollapseCost(int from, int to) const
+{
+    double cost = 0.0;
+    for (int f = 0; f < _model.numFrames; f++)
+    {
+        const Quadric &qa = _quadrics[static_cast<size_t>(f) * _model.numPoints + from];
+        const Quadric &qb = _quadrics[static_cast<size_t>(f) * _model.numPoints + to];
+        double q[10];
+        for (int i = 0; i < 10; i++)
+        {
+            q[i] = qa.a[i] + qb.a[i];
+        }
+
+        const float *p = Position(f, to).point;
+        double x = p[0], y = p[1], z = p[2];
+        cost += q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+                q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+                q[7] * z * z + 2.0 * q[8] * z + q[9];
+    }
+    return std::max(cost, 0.0);
+}
+
+bool MeshSimplifier::IsCollapseValid(int from, int to) const
+{
+    std::vector<int> fromNeighbours;
+    std::vector<int> toNeighbours;
+    std::map<int, int> stRemap;
+    int shared = 0;
+
+    for (int t : _vertexTriangles[from])
+    {
+        if (!_triangleAlive[t])
+        {
+            continue;
+        }
+        const mesh &triangle = _triangles[t];
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            if (triangle.meshIndex[k] != from)
+            {
+                fromNeighbours.emplace_back(triangle.meshIndex[k]);
+            }
+        }
+
+        int toCorner = CornerOf(triangle, to);
+        if (toCorner >= 0)
+        {
+            // Every texture coordinate used by `from` must have a matching one on `to`,
+            // otherwise the collapse would smear the skin across a UV seam
+            int fromSt = triangle.stIndex[CornerOf(triangle, from)];
+            int toSt = triangle.stIndex[toCorner];
+            auto it = stRemap.find(fromSt);
+            if (it != stRemap.end() && it->second != toSt)
+            {
+                return false;
+            }
+            stRemap[fromSt] = toSt;
+            shared++;
+        }
+    }
+
+    if (shared == 0 || (_boundary[from] && shared != 1))
+    {
+        return false;
+    }
+
+    for (int t : _vertexTriangles[from])
+    {
+        if (_triangleAlive[t] && stRemap.find(_triangles[t].stIndex[CornerOf(_triangles[t], from)]) == stRemap.end())
+        {
+            return false;
+        }
+    }
+
+    // Link condition: the edge's endpoints may only share the vertices opposite the edge
+    for (int t : _vertexTriangles[to])
+    {
+        if (!_triangleAlive[t])
+        {
+            continue;
+        }
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            if (_triangles[t].meshIndex[k] != to)
+            {
+                toNeighbours.emplace_back(_triangles[t].meshIndex[k]);
+            }
+        }
+    }
+    std::sort(fromNeighbours.begin(), fromNeighbours.end());
+    fromNeighbours.erase(std::unique(fromNeighbours.begin(), fromNeighbours.end()), fromNeighbours.end());
+    std::sort(toNeighbours.begin(), toNeighbours.end());
+    toNeighbours.erase(std::unique(toNeighbours.begin(), toNeighbours.end()), toNeighbours.end());
+    std::vector<int> common;
+    std::set_intersection(fromNeighbours.begin(), fromNeighbours.end(), toNeighbours.begin(), toNeighbours.end(), std::back_inserter(common));
+    if (static_cast<int>(common.size()) != shared)
+    {
+        return false;
+    }
+
+    // The collapse has to be valid in every pose, not only in the frame it was measured in
+    for (int t : _vertexTriangles[from])
+    {
+        if (!_triangleAlive[t] || CornerOf(_triangles[t], to) >= 0)
+        {
+            continue;
+        }
+        const mesh &triangle = _triangles[t];
+        int corner = CornerOf(triangle, from);
+        for (int f = 0; f < _model.numFrames; f++)
+        {
+            glm::vec3 p[VERTICES_PER_TRIANGLE];
+            for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+            {
+                p[k] = ToVec3(Position(f, triangle.meshIndex[k]));
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            p[corner] = ToVec3(Position(f, to));
+            glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+            if (glm::dot(before, after) <= FLIP_THRESHOLD)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void MeshSimplifier::Collapse(int from, int to)
+{
+    std::map<int, int> stRemap;
+    for (int t : _vertexTriangles[from])
+    {
+        int toCorner = CornerOf(_triangles[t], to);
+        if (_triangleAlive[t] && toCorner >= 0)
+        {
+            stRemap[_triangles[t].stIndex[CornerOf(_triangles[t], from)]] = _triangles[t].stIndex[toCorner];
+        }
+    }
+
+    for (int t : _vertexTriangles[from])
+    {
+        if (!_triangleAlive[t])
+        {
+            continue;
+        }
+        mesh &triangle = _triangles[t];
+        if (CornerOf(triangle, to) >= 0)
+        {
+            _triangleAlive[t] = false;
+            _aliveTriangles--;
+            continue;
+        }
+        int corner = CornerOf(triangle, from);
+        triangle.meshIndex[corner] = static_cast<unsigned short>(to);
+        triangle.stIndex[corner] = static_cast<unsigned short>(stRemap[triangle.stIndex[corner]]);
+        _vertexTriangles[to].emplace_back(t);
+    }
+    _vertexTriangles[from].clear();
+
+    for (int f = 0; f < _model.numFrames; f++)
+    {
+        Quadric &qa = _quadrics[static_cast<size_t>(f) * _model.numPoints + from];
+        Quadric &qb = _quadrics[static_cast<size_t>(f) * _model.numPoints + to];
+        for (int i = 0; i < 10; i++)
+        {
+            qb.a[i] += qa.a[i];
+        }
+    }
+
+    _stamps[from]++;
+    _stamps[to]++;
+    for (int t : _vertexTriangles[to])
+    {
+        if (_triangleAlive[t])
+        {
+            for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+            {
+                _stamps[_triangles[t].meshIndex[k]]++;
+            }
+        }
+    }
+}
+
+void MeshSimplifier::PushCandidates(int vertex, std::vector<Candidate> &heap)
+{
+    for (int t : _vertexTriangles[vertex])
+    {
+        if (!_triangleAlive[t])
+        {
+            continue;
+        }
+        for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+        {
+            int other = _triangles[t].meshIndex[k];
+            if (other == vertex)
+            {
+                continue;
+            }
+            heap.push_back({CollapseCost(vertex, other), vertex, other, _stamps[vertex], _stamps[other]});
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+}
+
+bool MeshSimplifier::IsEdge(int from, int to) const
+{
+    for (int t : _vertexTriangles[from])
+    {
+        if (_triangleAlive[t] && CornerOf(_triangles[t], to) >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MeshSimplifier::RetryRejected(std::vector<Candidate> &rejected, std::vector<Candidate> &heap)
+{
+    // Only collapses that changed a stamp can have changed the validity of an edge
+    bool pushed = false;
+    size_t kept = 0;
+    for (const Candidate &candidate : rejected)
+    {
+        if (candidate.fromStamp == _stamps[candidate.from] && candidate.toStamp == _stamps[candidate.to])
+        {
+            rejected[kept++] = candidate;
+        }
+        else if (IsEdge(candidate.from, candidate.to))
+        {
+            heap.push_back({CollapseCost(candidate.from, candidate.to), candidate.from, candidate.to, _stamps[candidate.from], _stamps[candidate.to]});
+            std::push_heap(heap.begin(), heap.end());
+            pushed = true;
+        }
+    }
+    rejected.resize(kept);
+    return pushed;
+}
+
+std::vector<mesh> MeshSimplifier::CurrentTriangles() const
+{
+    std::vector<mesh> result;
+    result.reserve(_aliveTriangles);
+    for (size_t t = 0; t < _triangles.size(); t++)
+    {
+        if (_triangleAlive[t])
+        {
+            result.emplace_back(_triangles[t]);
+        }
+    }
+    return result;
+}
+
+std::vector<LodLevel> MeshSimplifier::BuildLods(int levelCount, float ratio)
+{
+    std::vector<LodLevel> levels;
+    levels.push_back({CurrentTriangles(), 0.0f});
+
+    std::vector<Candidate> heap;
+    std::vector<Candidate> rejected;
+    for (int v = 0; v < _model.numPoints; v++)
+    {
+        PushCandidates(v, heap);
+    }
+
+    double worstCost = 0.0;
+    for (int level = 1; level < levelCount; level++)
+    {
+        int target = static_cast<int>(levels.back().triangles.size() * ratio);
+        while (_aliveTriangles > target && (!heap.empty() || RetryRejected(rejected, heap)))
+        {
+            std::pop_heap(heap.begin(), heap.end());
+            Candidate candidate = heap.back();
+            heap.pop_back();
+
+            if (candidate.fromStamp != _stamps[candidate.from] || candidate.toStamp != _stamps[candidate.to])
+            {
+                // Stale: the quadrics around the edge changed, but the edge may still be worth collapsing
+                if (IsEdge(candidate.from, candidate.to))
+                {
+                    heap.push_back({CollapseCost(candidate.from, candidate.to), candidate.from, candidate.to, _stamps[candidate.from], _stamps[candidate.to]});
+                    std::push_heap(heap.begin(), heap.end());
+                }
+                continue;
+            }
+            if (!IsCollapseValid(candidate.from, candidate.to))
+            {
+                // Later collapses around the edge can make it valid
+                rejected.push_back(candidate);
+                continue;
+            }
+
+            worstCost = std::max(worstCost, candidate.cost);
+            Collapse(candidate.from, candidate.to);
+
+            PushCandidates(candidate.to, heap);
+            for (int t : _vertexTriangles[candidate.to])
+            {
+                if (!_triangleAlive[t])
+                {
+                    continue;
+                }
+                for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+                {
+                    if (_triangles[t].meshIndex[k] != candidate.to)
+                    {
+                        PushCandidates(_triangles[t].meshIndex[k], heap);
+                    }
+                }
+            }
+        }
+
+        // Nothing left that can be collapsed safely, a duplicate level would only waste memory
+        if (_aliveTriangles >= static_cast<int>(levels.back().triangles.size()))
+        {
+            break;
+        }
+        float error = static_cast<float>(std::sqrt(worstCost / std::max(1, _model.numFrames)));
+        levels.push_back({CurrentTriangles(), error});
+    }
+
+    return levels;
+}
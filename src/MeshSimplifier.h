@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Md2.h"
+
+#include <vector>
+
+namespace md2model
+{
+    // A simplified version of the model's triangle list. Vertex and texture
+    // coordinate indices still refer to the original modData arrays, so every
+    // level can be expanded with any animation frame.
+    struct LodLevel
+    {
+        std::vector<mesh> triangles;
+        float error; // RMS object-space error of the worst collapse, averaged over all frames
+    };
+
+    // Quadric error metric edge-collapse simplifier.
+    // Quadrics are accumulated separately for every animation frame and the
+    // collapse cost is the sum over all frames, so a collapse that looks fine in
+    // the rest pose but tears the mesh apart while running is rejected.
+    class MeshSimplifier
+    {
+    public:
+        explicit MeshSimplifier(const modData &model);
+
+        // Builds levelCount levels. Level 0 is the original mesh, every following
+        // level keeps `ratio` of the triangles of the previous one.
+        std::vector<LodLevel> BuildLods(int levelCount, float ratio = 0.5f);
+
+    private:
+        struct Quadric
+        {
+            double a[10];
+        };
+
+        struct Candidate
+        {
+            double cost;
+            int from;
+            int to;
+            unsigned fromStamp;
+            unsigned toStamp;
+            bool operator<(const Candidate &rhs) const { return cost > rhs.cost; }
+        };
+
+        void BuildQuadrics();
+        void BuildAdjacency();
+        double CollapseCost(int from, int to) const;
+        bool IsCollapseValid(int from, int to) const;
+        void Collapse(int from, int to);
+        void PushCandidates(int vertex, std::vector<Candidate> &heap);
+        bool IsEdge(int from, int to) const;
+        // Pushes the rejected candidates whose neighbourhood changed since, with their new cost
+        bool RetryRejected(std::vector<Candidate> &rejected, std::vector<Candidate> &heap);
+        std::vector<mesh> CurrentTriangles() const;
+        const md2model::vector &Position(int frame, int vertex) const;
+
+        const modData &_model;
+        std::vector<mesh> _triangles;
+        std::vector<bool> _triangleAlive;
+        std::vector<std::vector<int>> _vertexTriangles;
+        std::vector<Quadric> _quadrics; // numFrames * numPoints
+        std::vector<unsigned> _stamps;
+        std::vector<bool> _boundary;
+        int _aliveTriangles;
+    };
+}
@@ -0,0 +1,349 @@
+#include "OcclusionCuller.h"
+#include "GL/glew.h"
+#include "ShaderProgram.h"
+#include "SoftwareRasterizer.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glm/gtc/type_ptr.hpp>
+
+namespace
+{
+    // Unit cube for the proxy boxes, scaled to the box in proxy.vert
+    const GLfloat CUBE_CORNERS[] = {
+        0.0f, 0.0f, 0.0f,
+        1.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f,
+        1.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 1.0f,
+        1.0f, 0.0f, 1.0f,
+        0.0f, 1.0f, 1.0f,
+        1.0f, 1.0f, 1.0f,
+    };
+
+    const GLubyte CUBE_INDICES[] = {
+        0, 2, 1, 1, 2, 3, // z = 0
+        4, 5, 6, 5, 7, 6, // z = 1
+        0, 1, 4, 1, 5, 4, // y = 0
+        2, 6, 3, 3, 6, 7, // y = 1
+        0, 4, 2, 2, 4, 6, // x = 0
+        1, 3, 5, 3, 7, 5, // x = 1
+    };
+
+    // Objects whose last query was answered this many frames ago are re-queried from a
+    // different frame each, so visible objects do not all query in the same frame
+    uint32_t PersistenceOffset(uint32_t id)
+    {
+        return (id * 2654435761u) % OcclusionCuller::VISIBLE_PERSISTENCE;
+    }
+
+    bool Contains(const Aabb &box, const glm::vec3 &point)
+    {
+        return box.min.x <= point.x && box.min.y <= point.y && box.min.z <= point.z &&
+               point.x <= box.max.x && point.y <= box.max.y && point.z <= box.max.z;
+    }
+}
+
+OcclusionCuller::OcclusionCuller(OcclusionBackend &backend)
+    : _backend(backend),
+      _frame(0),
+      _lastOccluded(0),
+      _stats()
+{
+}
+
+void OcclusionCuller::beginFrame(const OcclusionCandidate *candidates, size_t count, std::vector<uint32_t> &draw)
+{
+    _frame++;
+    _stats.frames++;
+    _backend.beginFrame();
+
+    // Collect whatever has arrived, keeping the rest in flight
+    size_t stillPending = 0;
+    for (uint32_t id : _pending)
+    {
+        ObjectState &object = _objects[id];
+        bool visible;
+        if (!_backend.pollQuery(id, visible))
+        {
+            _pending[stillPending++] = id;
+            continue;
+        }
+        _stats.results++;
+        _stats.latencyFrames += _frame - object.queryFrame;
+        _stats.reappeared += visible && !object.visible;
+        object.pending = false;
+        object.visible = visible;
+        object.nextQueryFrame = visible ? _frame + VISIBLE_PERSISTENCE + PersistenceOffset(id) : _frame;
+    }
+    _pending.resize(stillPending);
+
+    draw.clear();
+    _candidates.assign(candidates, candidates + count);
+    _lastOccluded = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint32_t id = candidates[i].id;
+        if (id >= _objects.size())
+        {
+            _objects.resize(id + 1, ObjectState{0, 0, 0, true, false});
+        }
+        ObjectState &object = _objects[id];
+        // A result from before the object left the frustum says nothing about now
+        if (object.lastCandidateFrame + 1 != _frame && !object.visible)
+        {
+            object.visible = true;
+            object.nextQueryFrame = _frame;
+        }
+        object.lastCandidateFrame = _frame;
+
+        if (object.visible)
+        {
+            draw.push_back(id);
+        }
+        else
+        {
+            _lastOccluded++;
+        }
+    }
+    _stats.candidates += count;
+    _stats.drawn += draw.size();
+    _stats.occluded += _lastOccluded;
+}
+
+void OcclusionCuller::issueQueries(const glm::mat4 &viewProjection, const glm::vec3 &eye)
+{
+    bool begun = false;
+    for (const OcclusionCandidate &candidate : _candidates)
+    {
+        ObjectState &object = _objects[candidate.id];
+        if (object.pending || (object.visible && _frame < object.nextQueryFrame))
+        {
+            continue;
+        }
+        // The box would be clipped by the near plane and could come out empty
+        if (Contains(candidate.box, eye))
+        {
+            object.visible = true;
+            object.nextQueryFrame = _frame + VISIBLE_PERSISTENCE;
+            continue;
+        }
+
+        if (!begun)
+        {
+            _backend.beginQueries(viewProjection);
+            begun = true;
+        }
+        _backend.issueQuery(candidate.id, candidate.box);
+        object.pending = true;
+        object.queryFrame = _frame;
+        _pending.push_back(candidate.id);
+        _stats.queries++;
+    }
+    if (begun)
+    {
+        _backend.endQueries();
+    }
+}
+
+GlOcclusionBackend::GlOcclusionBackend()
+    : _vertexArray(0),
+      _vertexBuffer(0),
+      _indexBuffer(0),
+      _boxMinLocation(-1),
+      _boxMaxLocation(-1)
+{
+}
+
+GlOcclusionBackend::~GlOcclusionBackend()
+{
+    if (!_queries.empty())
+    {
+        glDeleteQueries(static_cast<GLsizei>(_queries.size()), _queries.data());
+    }
+    glDeleteBuffers(1, &_indexBuffer);
+    glDeleteBuffers(1, &_vertexBuffer);
+    glDeleteVertexArrays(1, &_vertexArray);
+}
+
+bool GlOcclusionBackend::init()
+{
+    _program = std::make_unique<ShaderProgram>();
+    if (!_program->loadShaders("shaders/proxy.vert", "shaders/proxy.frag"))
+    {
+        return false;
+    }
+    _boxMinLocation = _program->getUniformLocation("boxMin");
+    _boxMaxLocation = _program->getUniformLocation("boxMax");
+
+    glGenVertexArrays(1, &_vertexArray);
+    glBindVertexArray(_vertexArray);
+    glGenBuffers(1, &_vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_CORNERS), CUBE_CORNERS, GL_STATIC_DRAW);
+    glGenBuffers(1, &_indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(CUBE_INDICES), CUBE_INDICES, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid *)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+void GlOcclusionBackend::beginQueries(const glm::mat4 &viewProjection)
+{
+    // Depth tested against what was drawn, without changing either buffer
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    _program->use();
+    _program->setUniform("viewProjection", viewProjection);
+    glBindVertexArray(_vertexArray);
+}
+
+void GlOcclusionBackend::issueQuery(uint32_t slot, const Aabb &box)
+{
+    if (slot >= _queries.size())
+    {
+        size_t first = _queries.size();
+        _queries.resize(std::max<size_t>(slot + 1, _queries.size() * 2));
+        glGenQueries(static_cast<GLsizei>(_queries.size() - first), _queries.data() + first);
+    }
+    glUniform3fv(_boxMinLocation, 1, glm::value_ptr(box.min));
+    glUniform3fv(_boxMaxLocation, 1, glm::value_ptr(box.max));
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, _queries[slot]);
+    glDrawElements(GL_TRIANGLES, sizeof(CUBE_INDICES), GL_UNSIGNED_BYTE, (GLvoid *)0);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+}
+
+void GlOcclusionBackend::endQueries()
+{
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+bool GlOcclusionBackend::pollQuery(uint32_t slot, bool &visible)
+{
+    GLuint available = 0;
+    glGetQueryObjectuiv(_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+    {
+        return false;
+    }
+    GLuint anySamples = 0;
+    glGetQueryObjectuiv(_queries[slot], GL_QUERY_RESULT, &anySamples);
+    visible = anySamples != 0;
+    return true;
+}
+
+SoftwareOcclusionBackend::SoftwareOcclusionBackend(const SoftwareRasterizer &depthSource, uint32_t latency)
+    : _depthSource(depthSource),
+      _latency(latency),
+      _frame(0),
+      _viewProjection(1.0f),
+      _tilesX(0),
+      _tilesY(0)
+{
+}
+
+void SoftwareOcclusionBackend::beginQueries(const glm::mat4 &viewProjection)
+{
+    _viewProjection = viewProjection;
+
+    // Furthest depth per tile: a tile whose furthest pixel is nearer than a box hides it
+    const int width = _depthSource.getWidth();
+    const int height = _depthSource.getHeight();
+    const float *depth = _depthSource.getDepth();
+    _tilesX = (width + DEPTH_TILE - 1) / DEPTH_TILE;
+    _tilesY = (height + DEPTH_TILE - 1) / DEPTH_TILE;
+    _tileMaxDepth.assign(static_cast<size_t>(_tilesX) * _tilesY, 0.0f);
+    for (int y = 0; y < height; y++)
+    {
+        float *tileRow = &_tileMaxDepth[static_cast<size_t>(y / DEPTH_TILE) * _tilesX];
+        const float *row = depth + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; x++)
+        {
+            tileRow[x / DEPTH_TILE] = std::max(tileRow[x / DEPTH_TILE], row[x]);
+        }
+    }
+}
+
+void SoftwareOcclusionBackend::issueQuery(uint32_t slot, const Aabb &box)
+{
+    if (slot >= _results.size())
+    {
+        _results.resize(slot + 1);
+    }
+    _results[slot] = {_frame + _latency, testBox(box)};
+}
+
+bool SoftwareOcclusionBackend::pollQuery(uint32_t slot, bool &visible)
+{
+    if (_frame < _results[slot].readyFrame)
+    {
+        return false;
+    }
+    visible = _results[slot].visible;
+    return true;
+}
+
+bool SoftwareOcclusionBackend::testBox(const Aabb &box) const
+{
+    const int width = _depthSource.getWidth();
+    const int height = _depthSource.getHeight();
+    float minX = std::numeric_limits<float>::max(), minY = minX, minZ = minX;
+    float maxX = -minX, maxY = -minX;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec4 p = _viewProjection * glm::vec4(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y, corner & 4 ? box.max.z : box.min.z, 1.0f);
+        if (p.w <= 0.0f)
+        {
+            return true; // reaches behind the eye, the rectangle is unbounded
+        }
+        // Window coordinates, as the rasterizer computes them
+        float x = (p.x / p.w * 0.5f + 0.5f) * width;
+        float y = (p.y / p.w * 0.5f + 0.5f) * height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minZ = std::min(minZ, p.z / p.w * 0.5f + 0.5f);
+    }
+    if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height || minZ >= 1.0f)
+    {
+        return false;
+    }
+    minZ = std::max(minZ, 0.0f);
+
+    const int x0 = std::max(static_cast<int>(std::floor(minX)), 0);
+    const int y0 = std::max(static_cast<int>(std::floor(minY)), 0);
+    const int x1 = std::min(static_cast<int>(std::floor(maxX)), width - 1);
+    const int y1 = std::min(static_cast<int>(std::floor(maxY)), height - 1);
+    const float *depth = _depthSource.getDepth();
+    for (int tileY = y0 / DEPTH_TILE; tileY <= y1 / DEPTH_TILE; tileY++)
+    {
+        for (int tileX = x0 / DEPTH_TILE; tileX <= x1 / DEPTH_TILE; tileX++)
+        {
+            if (_tileMaxDepth[static_cast<size_t>(tileY) * _tilesX + tileX] <= minZ)
+            {
+                continue;
+            }
+            const int tx0 = std::max(tileX * DEPTH_TILE, x0), tx1 = std::min(tileX * DEPTH_TILE + DEPTH_TILE - 1, x1);
+            const int ty0 = std::max(tileY * DEPTH_TILE, y0), ty1 = std::min(tileY * DEPTH_TILE + DEPTH_TILE - 1, y1);
+            for (int y = ty0; y <= ty1; y++)
+            {
+                const float *row = depth + static_cast<size_t>(y) * width;
+                for (int x = tx0; x <= tx1; x++)
+                {
+                    if (minZ < row[x])
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "SpatialIndex.h"
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class ShaderProgram;
+class SoftwareRasterizer;
+
+// Occlusion culling with asynchronous queries and temporal coherence, after CHC++.
+// Every object inside the frustum is drawn or skipped based on the last query result
+// read back for it. Results are never waited for; they usually arrive one or two frames
+// after the query was issued. A frame looks like:
+//
+//     culler.beginFrame(candidates, count, draw); // polls results, picks what to draw
+//     ... draw the objects in `draw`, filling the depth buffer ...
+//     culler.issueQueries(projection * view, eye); // proxy boxes against that depth
+//
+// Hidden objects are queried every frame so they reappear within the read-back latency.
+// Visible objects are assumed to stay visible for VISIBLE_PERSISTENCE frames before the
+// next query, spread over time by object id, so the query count stays small in mostly
+// visible scenes. Objects entering the frustum, and cameras inside a proxy box, count as
+// visible.
+
+struct OcclusionCandidate
+{
+    uint32_t id; // stable per object, indexes the culler's state
+    Aabb box;    // must contain everything the object draws
+};
+
+struct OcclusionStats
+{
+    unsigned long long frames;
+    unsigned long long candidates;    // objects passed to beginFrame()
+    unsigned long long drawn;
+    unsigned long long occluded;      // candidates skipped because their last result was hidden
+    unsigned long long queries;       // proxy boxes tested
+    unsigned long long results;       // query results read back
+    unsigned long long latencyFrames; // frames between issuing and reading, summed over results
+    unsigned long long reappeared;    // hidden objects found visible again, drawn a few frames late
+};
+
+// Tests proxy boxes against the depth of what was drawn. GlOcclusionBackend uses
+// GL_ANY_SAMPLES_PASSED queries, SoftwareOcclusionBackend the depth buffer of a
+// SoftwareRasterizer, so the culler can run without a GPU.
+class OcclusionBackend
+{
+public:
+    virtual ~OcclusionBackend() = default;
+    virtual void beginFrame() {}
+    virtual void beginQueries(const glm::mat4 &viewProjection) = 0;
+    // At most one query per slot is in flight
+    virtual void issueQuery(uint32_t slot, const Aabb &box) = 0;
+    virtual void endQueries() = 0;
+    // Does not wait: false while the result of the slot's query is not available yet
+    virtual bool pollQuery(uint32_t slot, bool &visible) = 0;
+};
+
+class OcclusionCuller
+{
+public:
+    static constexpr uint32_t VISIBLE_PERSISTENCE = 8; // frames before a visible object is queried again
+
+    explicit OcclusionCuller(OcclusionBackend &backend);
+
+    // Reads the results that are ready and writes the ids of the candidates to draw
+    void beginFrame(const OcclusionCandidate *candidates, size_t count, std::vector<uint32_t> &draw);
+    // Once the candidates drawn this frame are in the depth buffer
+    void issueQueries(const glm::mat4 &viewProjection, const glm::vec3 &eye);
+
+    const OcclusionStats &getStats() const { return _stats; }
+    // Candidates skipped by the last beginFrame()
+    size_t getOccludedCount() const { return _lastOccluded; }
+    size_t getPendingCount() const { return _pending.size(); }
+
+private:
+    struct ObjectState
+    {
+        uint32_t queryFrame;     // when the pending query was issued
+        uint32_t nextQueryFrame; // visible objects are not queried before this
+        uint32_t lastCandidateFrame;
+        bool visible;
+        bool pending;
+    };
+
+    OcclusionBackend &_backend;
+    std::vector<ObjectState> _objects; // indexed by id
+    std::vector<OcclusionCandidate> _candidates; // this frame's, kept for issueQueries()
+    std::vector<uint32_t> _pending;    // ids with a query in flight
+    uint32_t _frame;
+    size_t _lastOccluded;
+    OcclusionStats _stats;
+};
+
+// Proxy boxes drawn with shaders/proxy.* inside GL_ANY_SAMPLES_PASSED queries, with color
+// and depth writes off. Needs a current GL 3.3 context; query objects are created as
+// slots are first used.
+class GlOcclusionBackend : public OcclusionBackend
+{
+public:
+    GlOcclusionBackend();
+    ~GlOcclusionBackend();
+
+    bool init();
+    void beginQueries(const glm::mat4 &viewProjection) override;
+    void issueQuery(uint32_t slot, const Aabb &box) override;
+    void endQueries() override;
+    bool pollQuery(uint32_t slot, bool &visible) override;
+
+private:
+    GlOcclusionBackend(const GlOcclusionBackend &rhs) = delete;
+    GlOcclusionBackend &operator=(const GlOcclusionBackend &rhs) = delete;
+
+    std::unique_ptr<ShaderProgram> _program;
+    unsigned int _vertexArray;
+    unsigned int _vertexBuffer;
+    unsigned int _indexBuffer;
+    int _boxMinLocation;
+    int _boxMaxLocation;
+    std::vector<unsigned int> _queries; // by slot
+};
+
+// Tests proxy boxes against the depth buffer of a SoftwareRasterizer after finish(): a box
+// is visible when any pixel under its screen rectangle is further away than its nearest
+// corner, which is conservative. A max-depth grid of DEPTH_TILE pixel tiles, rebuilt for
+// each beginQueries(), rejects most pixels. Results are held back `latency` frames to
+// behave like GPU read-back.
+class SoftwareOcclusionBackend : public OcclusionBackend
+{
+public:
+    static constexpr int DEPTH_TILE = 8;
+
+    SoftwareOcclusionBackend(const SoftwareRasterizer &depthSource, uint32_t latency = 1);
+
+    void beginFrame() override { _frame++; }
+    void beginQueries(const glm::mat4 &viewProjection) override;
+    void issueQuery(uint32_t slot, const Aabb &box) override;
+    void endQueries() override {}
+    bool pollQuery(uint32_t slot, bool &visible) override;
+
+private:
+    struct Result
+    {
+        uint32_t readyFrame;
+        bool visible;
+    };
+
+    bool testBox(const Aabb &box) const;
+
+    const SoftwareRasterizer &_depthSource;
+    uint32_t _latency;
+    uint32_t _frame;
+    glm::mat4 _viewProjection;
+    int _tilesX;
+    int _tilesY;
+    std::vector<float> _tileMaxDepth;
+    std::vector<Result> _results; // by slot
+};
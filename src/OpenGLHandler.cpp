@@ -4,6 +4,10 @@
 
 bool OpenGLHandler::_pause = false;
 bool OpenGLHandler::_wireframe = false;
+int OpenGLHandler::_forcedLod = -1;
+bool OpenGLHandler::_fog = false;
+bool OpenGLHandler::_capturing = false;
+bool OpenGLHandler::_crowd = false;
 
 int OpenGLHandler::_windowWidth = 1024;
 int OpenGLHandler::_windowHeight = 768;
@@ -97,6 +101,23 @@ void OpenGLHandler::glfw_onKey(GLFWwindow *window, int key, int scancode, int ac
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         }
         break;
+
+    case GLFW_KEY_F2:
+        // Cycles automatic -> LOD 0 -> ... -> MAX_FORCED_LOD -> automatic
+        _forcedLod = _forcedLod == MAX_FORCED_LOD ? -1 : _forcedLod + 1;
+        break;
+
+    case GLFW_KEY_F3:
+        _fog = !_fog;
+        break;
+
+    case GLFW_KEY_F4:
+        _capturing = !_capturing;
+        break;
+
+    case GLFW_KEY_F5:
+        _crowd = !_crowd;
+        break;
     }
 }
 
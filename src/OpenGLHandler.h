@@ -3,6 +3,8 @@
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
 
+#include "Md2.h"
+
 class OpenGLHandler
 {
 public:
@@ -17,6 +19,10 @@ public:
     // Getters for state
     static bool isPaused() { return _pause; }
     static bool isWireframe() { return _wireframe; }
+    static int getForcedLod() { return _forcedLod; }
+    static bool isFogEnabled() { return _fog; }
+    static bool isCapturing() { return _capturing; }
+    static bool isCrowdEnabled() { return _crowd; }
     static int getWindowWidth() { return _windowWidth; }
     static int getWindowHeight() { return _windowHeight; }
 
@@ -24,10 +30,15 @@ private:
     GLFWwindow *_window;
     double _elapsedSeconds;
     static constexpr const char *APP_TITLE = "MD2 Loader by Raydelto Hernandez v1.0";
+    static constexpr int MAX_FORCED_LOD = md2model::LOD_LEVELS - 1;
     
     // Private static state
     static bool _pause;
     static bool _wireframe;
+    static int _forcedLod; // -1 means automatic selection
+    static bool _fog;
+    static bool _capturing;
+    static bool _crowd;
     static int _windowWidth;
     static int _windowHeight;
 };
@@ -0,0 +1,117 @@
+#include "PoseCache.h"
+#include "PoseKernel.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace md2model;
+
+namespace
+{
+    constexpr size_t MIN_SLOTS = 64;
+}
+
+PoseCache::PoseCache(int buckets) : _buckets(std::max(buckets, 1)),
+                                    _frame(1), // slots start out stamped with frame 0, empty
+                                    _stats()
+{
+}
+
+void PoseCache::BeginFrame()
+{
+    _frame++;
+    _poses.clear();
+    _pool.clear();
+    _stats.frames++;
+}
+
+void PoseCache::SetBuckets(int buckets)
+{
+    // The poses of the current frame were rounded to the old steps
+    _buckets = std::max(buckets, 1);
+    _frame++;
+    _poses.clear();
+    _pool.clear();
+}
+
+size_t PoseCache::Hash(const Key &key)
+{
+    uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(key.model));
+    h ^= (static_cast<uint64_t>(key.frameA) << 40) ^ (static_cast<uint64_t>(key.frameB) << 20) ^ static_cast<uint64_t>(key.bucket);
+    h *= 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(h ^ (h >> 32));
+}
+
+void PoseCache::Grow()
+{
+    std::vector<Slot> old;
+    old.swap(_slots);
+    _slots.assign(std::max(MIN_SLOTS, old.size() * 2), Slot{Key{nullptr, 0, 0, 0}, 0, 0});
+    const size_t mask = _slots.size() - 1;
+    for (const Slot &slot : old)
+    {
+        if (slot.frame != _frame)
+        {
+            continue;
+        }
+        size_t i = Hash(slot.key) & mask;
+        while (_slots[i].frame == _frame)
+        {
+            i = (i + 1) & mask;
+        }
+        _slots[i] = slot;
+    }
+}
+
+PoseCache::PoseHandle PoseCache::Acquire(const modData &model, int frameA, int frameB, float t)
+{
+    _stats.requests++;
+    const int bucket = std::min(std::max(static_cast<int>(std::lround(t * _buckets)), 0), _buckets);
+    const Key key = {&model, frameA, frameB, bucket};
+
+    // Kept at most half full so probe sequences stay short
+    if (_slots.size() < 2 * (_poses.size() + 1))
+    {
+        Grow();
+    }
+    const size_t mask = _slots.size() - 1;
+    size_t i = Hash(key) & mask;
+    PoseHandle pose;
+    while (true)
+    {
+        Slot &slot = _slots[i];
+        if (slot.frame != _frame)
+        {
+            pose = Evaluate(key, model);
+            _slots[i] = {key, _frame, pose};
+            break;
+        }
+        if (slot.key == key)
+        {
+            pose = slot.pose;
+            _stats.hits++;
+            _stats.verticesSaved += model.numPoints;
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    const float error = std::fabs(t - _poses[pose].t) * _poses[pose].maxMotion;
+    _stats.maxError = std::max(_stats.maxError, error);
+    _stats.errorSum += error;
+    return pose;
+}
+
+PoseCache::PoseHandle PoseCache::Evaluate(const Key &key, const modData &model)
+{
+    const PoseHandle handle = static_cast<PoseHandle>(_poses.size());
+    const float t = static_cast<float>(key.bucket) / _buckets;
+    const size_t offset = _pool.size();
+    _pool.resize(offset + static_cast<size_t>(model.numPoints) * POSITION_COMPONENTS);
+    InterpolatePose(model, key.frameA, key.frameB, t, &_pool[offset]);
+
+    // For the error bound, from the tables built at load time
+    _poses.push_back({offset, t, KeyframeMotion(model, key.frameA, key.frameB)});
+    _stats.posesEvaluated++;
+    _stats.verticesEvaluated += model.numPoints;
+    return handle;
+}
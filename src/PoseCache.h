@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Md2.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace md2model
+{
+    constexpr int DEFAULT_POSE_BUCKETS = 16; // steps of t between two keyframes
+
+    struct PoseCacheStats
+    {
+        unsigned long long frames;
+        unsigned long long requests;          // Acquire calls
+        unsigned long long hits;              // requests served by a pose already evaluated this frame
+        unsigned long long posesEvaluated;
+        unsigned long long verticesEvaluated;
+        unsigned long long verticesSaved;     // vertices the hits did not have to blend
+        float maxError;                       // bound on the distance to the exact pose, in model units
+        double errorSum;                      // of the per-request bounds, for the mean
+    };
+
+    // Shares interpolated poses between the entities of a frame that play the same keyframes
+    // at nearly the same phase. Acquire() rounds t to one of `buckets` steps; the first
+    // request for a (model, frame a, frame b, step) evaluates the pose with the CPU kernel
+    // (PoseKernel.h) into a pooled buffer, later ones get the same pose back. The pool and
+    // the lookup table keep their memory across frames, so steady frames do not allocate.
+    //
+    // The cost is a pose error of up to |t - step| times the largest vertex motion between
+    // the two keyframes; the stats keep that bound so the bucket count can be tuned against
+    // it. More buckets means fewer hits and a smaller error.
+    //
+    //     cache.BeginFrame();
+    //     for (Entity &entity : crowd)
+    //     {
+    //         PoseHandle pose = cache.Acquire(model, entity.frame, entity.nextFrame, entity.t);
+    //         Draw(cache.GetPositions(pose));
+    //     }
+    class PoseCache
+    {
+    public:
+        using PoseHandle = uint32_t; // valid until the next BeginFrame()
+
+        explicit PoseCache(int buckets = DEFAULT_POSE_BUCKETS);
+
+        // Forgets the poses of the previous frame
+        void BeginFrame();
+        PoseHandle Acquire(const modData &model, int frameA, int frameB, float t);
+        // numPoints * 3 floats; the pointer is invalidated by the next Acquire()
+        const float *GetPositions(PoseHandle pose) const { return &_pool[_poses[pose].offset]; }
+        // The t the pose was evaluated at
+        float GetT(PoseHandle pose) const { return _poses[pose].t; }
+        // Every pose of the frame back to back, for uploading them in one copy
+        const float *GetPoolData() const { return _pool.data(); }
+        size_t GetPoolFloats() const { return _pool.size(); }
+        // Where the pose starts in the pool, in floats
+        size_t GetPoolOffset(PoseHandle pose) const { return _poses[pose].offset; }
+
+        // Drops the poses of the current frame
+        void SetBuckets(int buckets);
+        int GetBuckets() const { return _buckets; }
+        const PoseCacheStats &GetStats() const { return _stats; }
+        size_t GetPoolBytes() const { return _pool.capacity() * sizeof(float); }
+        void ResetStats() { _stats = PoseCacheStats(); }
+
+    private:
+        struct Key
+        {
+            const modData *model;
+            int frameA;
+            int frameB;
+            int bucket;
+
+            bool operator==(const Key &rhs) const { return model == rhs.model && frameA == rhs.frameA && frameB == rhs.frameB && bucket == rhs.bucket; }
+        };
+
+        struct Slot
+        {
+            Key key;
+            uint32_t frame; // the slot is empty unless this is the current frame
+            PoseHandle pose;
+        };
+
+        struct Pose
+        {
+            size_t offset; // into _pool
+            float t;
+            float maxMotion; // largest vertex distance between the two keyframes
+        };
+
+        static size_t Hash(const Key &key);
+        void Grow();
+        PoseHandle Evaluate(const Key &key, const modData &model);
+
+        int _buckets;
+        uint32_t _frame;
+        std::vector<Slot> _slots; // open addressing, the size is a power of two
+        std::vector<Pose> _poses;
+        std::vector<float> _pool;
+        PoseCacheStats _stats;
+    };
+}
@@ -0,0 +1,265 @@
+#include "PoseKernel.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define POSE_KERNEL_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define POSE_KERNEL_SSE2 1
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define POSE_KERNEL_NEON 1
+#endif
+
+using namespace md2model;
+
+// All kernels blend with p = q_a * scaleA + (q_b * scaleB + offset), where
+// scaleA = scale_a * (1 - t), scaleB = scale_b * t and offset = lerp(translate_a, translate_b, t).
+// Every path rounds the same way (same association, no fused multiply-add), so a pose is
+// bit-identical whichever kernel was compiled in and software rendered images can be
+// compared against golden checksums.
+// The SIMD paths work on one (x, y, z, normalIndex) byte quad per lane group and write
+// four floats per vertex; the fourth lands on the next vertex's x and is overwritten right
+// after, so the last vertex is always finished by the scalar loop.
+
+namespace
+{
+    struct BlendFactors
+    {
+        float scaleA[4];
+        float scaleB[4];
+        float offset[4];
+    };
+
+    BlendFactors MakeFactors(const frameTransform &a, const frameTransform &b, float t)
+    {
+        BlendFactors factors;
+        for (int j = 0; j < POSITION_COMPONENTS; j++)
+        {
+            factors.scaleA[j] = a.scale[j] * (1.0f - t);
+            factors.scaleB[j] = b.scale[j] * t;
+            factors.offset[j] = a.translate[j] + (b.translate[j] - a.translate[j]) * t;
+        }
+        // The normal index byte is multiplied away
+        factors.scaleA[3] = 0.0f;
+        factors.scaleB[3] = 0.0f;
+        factors.offset[3] = 0.0f;
+        return factors;
+    }
+
+    void PositionsScalar(const framePoint_t *a, const framePoint_t *b, const BlendFactors &f, float *out, int first, int count)
+    {
+        for (int i = first; i < count; i++)
+        {
+            for (int j = 0; j < POSITION_COMPONENTS; j++)
+            {
+                out[i * 3 + j] = a[i].v[j] * f.scaleA[j] + (b[i].v[j] * f.scaleB[j] + f.offset[j]);
+            }
+        }
+    }
+
+    void NormalsScalar(const packedNormal *a, const packedNormal *b, float t, float *out, int first, int count)
+    {
+        for (int i = first; i < count; i++)
+        {
+            float n[3];
+            for (int j = 0; j < POSITION_COMPONENTS; j++)
+            {
+                n[j] = a[i].n[j] + (b[i].n[j] - a[i].n[j]) * t;
+            }
+            float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            float scale = length > 0.0f ? 1.0f / length : 0.0f;
+            for (int j = 0; j < POSITION_COMPONENTS; j++)
+            {
+                out[i * 3 + j] = n[j] * scale;
+            }
+        }
+    }
+
+#if POSE_KERNEL_AVX2
+    // Two vertices per register, four per iteration
+    int PositionsAvx2(const framePoint_t *a, const framePoint_t *b, const BlendFactors &f, float *out, int count)
+    {
+        const __m256 scaleA = _mm256_setr_ps(f.scaleA[0], f.scaleA[1], f.scaleA[2], 0.0f, f.scaleA[0], f.scaleA[1], f.scaleA[2], 0.0f);
+        const __m256 scaleB = _mm256_setr_ps(f.scaleB[0], f.scaleB[1], f.scaleB[2], 0.0f, f.scaleB[0], f.scaleB[1], f.scaleB[2], 0.0f);
+        const __m256 offset = _mm256_setr_ps(f.offset[0], f.offset[1], f.offset[2], 0.0f, f.offset[0], f.offset[1], f.offset[2], 0.0f);
+
+        int i = 0;
+        for (; i + 4 < count; i += 4)
+        {
+            __m128i rawA = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i rawB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            for (int half = 0; half < 2; half++)
+            {
+                __m256 qa = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(half == 0 ? rawA : _mm_srli_si128(rawA, 8)));
+                __m256 qb = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(half == 0 ? rawB : _mm_srli_si128(rawB, 8)));
+                __m256 p = _mm256_add_ps(_mm256_mul_ps(qa, scaleA), _mm256_add_ps(_mm256_mul_ps(qb, scaleB), offset));
+                float *destination = out + (i + half * 2) * 3;
+                _mm_storeu_ps(destination, _mm256_castps256_ps128(p));
+                _mm_storeu_ps(destination + 3, _mm256_extractf128_ps(p, 1));
+            }
+        }
+        return i;
+    }
+#endif
+
+#if POSE_KERNEL_SSE2 && !POSE_KERNEL_AVX2
+    int PositionsSse2(const framePoint_t *a, const framePoint_t *b, const BlendFactors &f, float *out, int count)
+    {
+        const __m128 scaleA = _mm_loadu_ps(f.scaleA);
+        const __m128 scaleB = _mm_loadu_ps(f.scaleB);
+        const __m128 offset = _mm_loadu_ps(f.offset);
+        const __m128i zero = _mm_setzero_si128();
+
+        int i = 0;
+        for (; i + 4 < count; i += 4)
+        {
+            __m128i rawA = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i rawB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i lowA = _mm_unpacklo_epi8(rawA, zero);
+            __m128i highA = _mm_unpackhi_epi8(rawA, zero);
+            __m128i lowB = _mm_unpacklo_epi8(rawB, zero);
+            __m128i highB = _mm_unpackhi_epi8(rawB, zero);
+            const __m128i qa[4] = {_mm_unpacklo_epi16(lowA, zero), _mm_unpackhi_epi16(lowA, zero), _mm_unpacklo_epi16(highA, zero), _mm_unpackhi_epi16(highA, zero)};
+            const __m128i qb[4] = {_mm_unpacklo_epi16(lowB, zero), _mm_unpackhi_epi16(lowB, zero), _mm_unpacklo_epi16(highB, zero), _mm_unpackhi_epi16(highB, zero)};
+
+            for (int k = 0; k < 4; k++)
+            {
+                __m128 p = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(qa[k]), scaleA), _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(qb[k]), scaleB), offset));
+                _mm_storeu_ps(out + (i + k) * 3, p);
+            }
+        }
+        return i;
+    }
+#endif
+
+#if POSE_KERNEL_SSE2
+    int NormalsSse2(const packedNormal *a, const packedNormal *b, float t, float *out, int count)
+    {
+        const __m128 weight = _mm_set1_ps(t);
+        int i = 0;
+        for (; i + 1 < count; i++)
+        {
+            // Sign extend the four bytes to 32 bit lanes
+            int packedA, packedB;
+            std::memcpy(&packedA, a + i, sizeof(int));
+            std::memcpy(&packedB, b + i, sizeof(int));
+            __m128i rawA = _mm_cvtsi32_si128(packedA);
+            __m128i rawB = _mm_cvtsi32_si128(packedB);
+            rawA = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_unpacklo_epi8(rawA, rawA), _mm_unpacklo_epi8(rawA, rawA)), 24);
+            rawB = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_unpacklo_epi8(rawB, rawB), _mm_unpacklo_epi8(rawB, rawB)), 24);
+            __m128 na = _mm_cvtepi32_ps(rawA);
+            __m128 n = _mm_add_ps(na, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(rawB), na), weight));
+
+            // Horizontal dot product, the padding lane is always zero
+            __m128 squared = _mm_mul_ps(n, n);
+            __m128 sum = _mm_add_ps(squared, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(2, 3, 0, 1)));
+            sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 0, 3, 2)));
+            __m128 length = _mm_sqrt_ps(sum);
+            __m128 normalized = _mm_div_ps(n, _mm_max_ps(length, _mm_set1_ps(1e-6f)));
+            _mm_storeu_ps(out + i * 3, normalized);
+        }
+        return i;
+    }
+#endif
+
+#if POSE_KERNEL_NEON
+    int PositionsNeon(const framePoint_t *a, const framePoint_t *b, const BlendFactors &f, float *out, int count)
+    {
+        const float32x4_t scaleA = vld1q_f32(f.scaleA);
+        const float32x4_t scaleB = vld1q_f32(f.scaleB);
+        const float32x4_t offset = vld1q_f32(f.offset);
+
+        int i = 0;
+        for (; i + 4 < count; i += 4)
+        {
+            uint8x16_t rawA = vld1q_u8(reinterpret_cast<const uint8_t *>(a + i));
+            uint8x16_t rawB = vld1q_u8(reinterpret_cast<const uint8_t *>(b + i));
+            uint16x8_t lowA = vmovl_u8(vget_low_u8(rawA));
+            uint16x8_t highA = vmovl_u8(vget_high_u8(rawA));
+            uint16x8_t lowB = vmovl_u8(vget_low_u8(rawB));
+            uint16x8_t highB = vmovl_u8(vget_high_u8(rawB));
+            const uint32x4_t qa[4] = {vmovl_u16(vget_low_u16(lowA)), vmovl_u16(vget_high_u16(lowA)), vmovl_u16(vget_low_u16(highA)), vmovl_u16(vget_high_u16(highA))};
+            const uint32x4_t qb[4] = {vmovl_u16(vget_low_u16(lowB)), vmovl_u16(vget_high_u16(lowB)), vmovl_u16(vget_low_u16(highB)), vmovl_u16(vget_high_u16(highB))};
+
+            for (int k = 0; k < 4; k++)
+            {
+                float32x4_t p = vmlaq_f32(vmlaq_f32(offset, vcvtq_f32_u32(qb[k]), scaleB), vcvtq_f32_u32(qa[k]), scaleA);
+                vst1q_f32(out + (i + k) * 3, p);
+            }
+        }
+        return i;
+    }
+
+    int NormalsNeon(const packedNormal *a, const packedNormal *b, float t, float *out, int count)
+    {
+        int i = 0;
+        for (; i + 1 < count; i++)
+        {
+            uint32_t packedA, packedB;
+            std::memcpy(&packedA, a + i, sizeof(uint32_t));
+            std::memcpy(&packedB, b + i, sizeof(uint32_t));
+            int8x8_t rawA = vreinterpret_s8_u32(vdup_n_u32(packedA));
+            int8x8_t rawB = vreinterpret_s8_u32(vdup_n_u32(packedB));
+            float32x4_t na = vcvtq_f32_s32(vmovl_s16(vget_low_s16(vmovl_s8(rawA))));
+            float32x4_t nb = vcvtq_f32_s32(vmovl_s16(vget_low_s16(vmovl_s8(rawB))));
+            float32x4_t n = vmlaq_n_f32(na, vsubq_f32(nb, na), t);
+            float32x4_t squared = vmulq_f32(n, n);
+            float32x2_t pair = vadd_f32(vget_low_f32(squared), vget_high_f32(squared));
+            float sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+            float scale = sum > 0.0f ? 1.0f / std::sqrt(sum) : 0.0f;
+            vst1q_f32(out + i * 3, vmulq_n_f32(n, scale));
+        }
+        return i;
+    }
+#endif
+}
+
+const char *md2model::PoseKernelName()
+{
+#if POSE_KERNEL_AVX2
+    return "AVX2";
+#elif POSE_KERNEL_SSE2
+    return "SSE2";
+#elif POSE_KERNEL_NEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+void md2model::InterpolatePose(const modData &model, int frameA, int frameB, float t, float *positions, float *normals)
+{
+    const int count = model.numPoints;
+    const framePoint_t *a = &model.quantizedPoints[static_cast<size_t>(frameA) * count];
+    const framePoint_t *b = &model.quantizedPoints[static_cast<size_t>(frameB) * count];
+    const BlendFactors factors = MakeFactors(model.frameTransforms[frameA], model.frameTransforms[frameB], t);
+
+    int done = 0;
+#if POSE_KERNEL_AVX2
+    done = PositionsAvx2(a, b, factors, positions, count);
+#elif POSE_KERNEL_SSE2
+    done = PositionsSse2(a, b, factors, positions, count);
+#elif POSE_KERNEL_NEON
+    done = PositionsNeon(a, b, factors, positions, count);
+#endif
+    PositionsScalar(a, b, factors, positions, done, count);
+
+    if (normals)
+    {
+        const packedNormal *na = &model.normalList[static_cast<size_t>(frameA) * count];
+        const packedNormal *nb = &model.normalList[static_cast<size_t>(frameB) * count];
+        done = 0;
+#if POSE_KERNEL_SSE2
+        done = NormalsSse2(na, nb, t, normals, count);
+#elif POSE_KERNEL_NEON
+        done = NormalsNeon(na, nb, t, normals, count);
+#endif
+        NormalsScalar(na, nb, t, normals, done, count);
+    }
+}
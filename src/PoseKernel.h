@@ -0,0 +1,15 @@
+#pragma once
+
+#include "Md2.h"
+
+namespace md2model
+{
+    // Name of the instruction set the kernel was compiled for ("AVX2", "SSE2", "NEON" or "scalar")
+    const char *PoseKernelName();
+
+    // Decodes frames a and b straight from the quantized file data and blends them:
+    // p = lerp(scale_a * q_a + translate_a, scale_b * q_b + translate_b, t).
+    // `positions` receives numPoints * 3 floats. `normals` (optional) receives numPoints * 3
+    // floats, blended from the packed per-frame normals and renormalized.
+    void InterpolatePose(const modData &model, int frameA, int frameB, float t, float *positions, float *normals = nullptr);
+}
@@ -1,59 +1,247 @@
 #include "ShaderProgram.h"
+#include "MemoryTracker.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
 #include <glm/gtc/type_ptr.hpp>
 
+namespace
+{
+    // Without parallel_shader_compile any status query waits for the compiler. Nothing is
+    // queried for FALLBACK_POLLS frames, which gives drivers that compile on their own threads
+    // a head start; then the vertex shader, the fragment shader and the link are waited for
+    // on three separate frames, so no frame waits for the whole build.
+    constexpr int FALLBACK_POLLS = 2;
+    constexpr int FALLBACK_STAGES = 3;
+
+    bool HasParallelCompile()
+    {
+        return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    }
+
+    // Splits a source after its #version line so defines can go in between. The #line
+    // directive keeps compiler messages pointing at the lines of the file.
+    void SpliceDefines(const std::string &source, const std::string &defines, const GLchar *parts[4], GLint lengths[4])
+    {
+        static const char LINE_DIRECTIVE[] = "#line 2\n";
+        size_t version = source.find("#version");
+        size_t split = version == std::string::npos ? 0 : source.find('\n', version);
+        split = split == std::string::npos ? source.size() : split + (version == std::string::npos ? 0 : 1);
+
+        parts[0] = source.c_str();
+        lengths[0] = static_cast<GLint>(split);
+        parts[1] = defines.c_str();
+        lengths[1] = static_cast<GLint>(defines.size());
+        parts[2] = LINE_DIRECTIVE;
+        lengths[2] = defines.empty() || version == std::string::npos ? 0 : static_cast<GLint>(sizeof(LINE_DIRECTIVE) - 1);
+        parts[3] = source.c_str() + split;
+        lengths[3] = static_cast<GLint>(source.size() - split);
+    }
+}
+
 ShaderProgram::ShaderProgram()
-    : _handle(0)
+    : _handle(0),
+      _generation(0),
+      _pending{0, 0, 0, 0}
 {
 }
 
 ShaderProgram::~ShaderProgram()
 {
     // Delete the program
+    discardBuild(_pending);
     glDeleteProgram(_handle);
 }
 
-bool ShaderProgram::loadShaders(const char *vsFilename, const char *fsFilename)
+bool ShaderProgram::loadShaders(const char *vsFilename, const char *fsFilename, const std::string &defines)
+{
+    _vsFilename = vsFilename;
+    _fsFilename = fsFilename;
+    _defines = defines;
+    discardBuild(_pending);
+
+    Build build{0, 0, 0, 0};
+    if (!startBuild(build) || !finishBuild(build))
+    {
+        return false;
+    }
+    swapProgram(build.program);
+    return true;
+}
+
+bool ShaderProgram::loadShadersAsync(const char *vsFilename, const char *fsFilename, const std::string &defines)
+{
+    _vsFilename = vsFilename;
+    _fsFilename = fsFilename;
+    _defines = defines;
+    return reload();
+}
+
+bool ShaderProgram::reload()
 {
-    std::string vsString = fileToString(vsFilename);
-    std::string fsString = fileToString(fsFilename);
-    const GLchar *vsSourcePtr = vsString.c_str();
-    const GLchar *fsSourcePtr = fsString.c_str();
+    // A newer edit replaces a build that is still compiling
+    discardBuild(_pending);
+    return startBuild(_pending);
+}
 
-    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+void ShaderProgram::updateReload()
+{
+    if (_pending.program == 0)
+    {
+        return;
+    }
+    if (!pollBuild(_pending))
+    {
+        return;
+    }
 
-    glShaderSource(vs, 1, &vsSourcePtr, NULL);
-    glShaderSource(fs, 1, &fsSourcePtr, NULL);
+    finishReload();
+}
 
-    glCompileShader(vs);
-    checkCompileErrors(vs, VERTEX);
+void ShaderProgram::finishReload()
+{
+    if (_pending.program == 0)
+    {
+        return;
+    }
+
+    Build build = _pending;
+    _pending = {0, 0, 0, 0};
+    if (finishBuild(build))
+    {
+        // The first build of a program is not a reload
+        if (_handle != 0)
+        {
+            std::cout << "Reloaded " << _vsFilename << " + " << _fsFilename << std::endl;
+        }
+        swapProgram(build.program);
+    }
+    else
+    {
+        std::cerr << "Keeping the previous program for " << _vsFilename << " + " << _fsFilename << std::endl;
+    }
+}
 
-    glCompileShader(fs);
-    checkCompileErrors(fs, FRAGMENT);
+bool ShaderProgram::startBuild(Build &build)
+{
+    static bool parallelCompileEnabled = false;
+    if (!parallelCompileEnabled && HasParallelCompile())
+    {
+        // Let the driver pick the number of compiler threads
+        if (GLEW_KHR_parallel_shader_compile)
+        {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        }
+        else
+        {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        }
+        parallelCompileEnabled = true;
+    }
 
-    _handle = glCreateProgram();
-    if (_handle == 0)
+    std::string vsString = fileToString(_vsFilename);
+    std::string fsString = fileToString(_fsFilename);
+    if (vsString.empty() || fsString.empty())
+    {
+        std::cerr << "Error! Unable to read " << (vsString.empty() ? _vsFilename : _fsFilename) << std::endl;
+        return false;
+    }
+    MemoryTracker::Transient sourceMemory(MemoryTracker::SHADER, _vsFilename, vsString.capacity() + fsString.capacity());
+    const GLchar *vsParts[4];
+    const GLchar *fsParts[4];
+    GLint vsLengths[4];
+    GLint fsLengths[4];
+    SpliceDefines(vsString, _defines, vsParts, vsLengths);
+    SpliceDefines(fsString, _defines, fsParts, fsLengths);
+
+    build.program = glCreateProgram();
+    if (build.program == 0)
     {
         std::cerr << "Unable to create shader program!" << std::endl;
         return false;
     }
+    build.vs = glCreateShader(GL_VERTEX_SHADER);
+    build.fs = glCreateShader(GL_FRAGMENT_SHADER);
+    build.polls = 0;
 
-    glAttachShader(_handle, vs);
-    glAttachShader(_handle, fs);
+    glShaderSource(build.vs, 4, vsParts, vsLengths);
+    glShaderSource(build.fs, 4, fsParts, fsLengths);
 
-    glLinkProgram(_handle);
-    checkCompileErrors(_handle, PROGRAM);
+    // No status queries until the build is complete, any of them would wait for the compiler
+    glCompileShader(build.vs);
+    glCompileShader(build.fs);
 
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+    glAttachShader(build.program, build.vs);
+    glAttachShader(build.program, build.fs);
+    glLinkProgram(build.program);
+    return true;
+}
 
-    mUniformLocations.clear();
+bool ShaderProgram::pollBuild(Build &build)
+{
+    if (HasParallelCompile())
+    {
+        GLint complete = GL_FALSE;
+        glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &complete);
+        return complete == GL_TRUE;
+    }
 
-    return true;
+    // One blocking query per frame, each one for a stage the driver has had frames to finish
+    const int stage = build.polls++ - FALLBACK_POLLS;
+    GLint status = GL_FALSE;
+    if (stage == 0)
+    {
+        glGetShaderiv(build.vs, GL_COMPILE_STATUS, &status);
+    }
+    else if (stage == 1)
+    {
+        glGetShaderiv(build.fs, GL_COMPILE_STATUS, &status);
+    }
+    else if (stage == 2)
+    {
+        glGetProgramiv(build.program, GL_LINK_STATUS, &status);
+    }
+    return stage + 1 >= FALLBACK_STAGES;
+}
+
+// Reports the errors of a build and releases its shaders; a failed program is deleted
+bool ShaderProgram::finishBuild(Build &build)
+{
+    bool compiled = checkCompileErrors(build.vs, VERTEX);
+    compiled = checkCompileErrors(build.fs, FRAGMENT) && compiled;
+    bool linked = compiled && checkCompileErrors(build.program, PROGRAM);
+
+    glDetachShader(build.program, build.vs);
+    glDetachShader(build.program, build.fs);
+    glDeleteShader(build.vs);
+    glDeleteShader(build.fs);
+    if (!linked)
+    {
+        glDeleteProgram(build.program);
+        build.program = 0;
+    }
+    return linked;
+}
+
+// Drops a build without asking for its status, which would wait for the compiler
+void ShaderProgram::discardBuild(Build &build)
+{
+    if (build.program != 0)
+    {
+        glDeleteShader(build.vs);
+        glDeleteShader(build.fs);
+        glDeleteProgram(build.program);
+    }
+    build = {0, 0, 0, 0};
+}
+
+void ShaderProgram::swapProgram(GLuint program)
+{
+    glDeleteProgram(_handle);
+    _handle = program;
+    mUniformLocations.clear();
+    _generation++;
 }
 
 std::string ShaderProgram::fileToString(const std::string &filename)
@@ -91,7 +279,7 @@ void ShaderProgram::use()
 }
 
 // Checks for shader compiler errors
-void ShaderProgram::checkCompileErrors(GLuint shader, ShaderType type)
+bool ShaderProgram::checkCompileErrors(GLuint shader, ShaderType type)
 {
     GLint status;
 
@@ -123,6 +311,7 @@ void ShaderProgram::checkCompileErrors(GLuint shader, ShaderType type)
             std::cerr << "Error! Shader failed to compile. " << errorLog << std::endl;
         }
     }
+    return status == GL_TRUE;
 }
 
 // Returns the active shader program
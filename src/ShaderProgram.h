@@ -18,12 +18,34 @@ public:
         PROGRAM
     };
 
-    // Only supports vertex and fragment (this series will only have those two)
-    bool loadShaders(const char *vsFilename, const char *fsFilename);
+    // Only supports vertex and fragment (this series will only have those two).
+    // `defines` (e.g. "#define FEATURE_FOG 1\n") is inserted after the #version line of
+    // both sources. Blocks until the program is linked; on failure the previous program
+    // stays in use.
+    bool loadShaders(const char *vsFilename, const char *fsFilename, const std::string &defines = "");
+    // Same, without waiting: the program is swapped in by a later updateReload() or finishReload()
+    bool loadShadersAsync(const char *vsFilename, const char *fsFilename, const std::string &defines = "");
     void use();
 
     GLuint getProgram() const;
 
+    // Hot reload: reload() starts compiling the current source files and returns without
+    // waiting. updateReload() is called once per frame; the old program is used until the
+    // new one has linked, then the two are swapped and the generation goes up. A failed
+    // build is reported and dropped.
+    // Only with KHR/ARB_parallel_shader_compile is no frame ever stalled: without it the
+    // status has to be queried blindly, and updateReload() spreads that wait over three
+    // frames (vertex shader, fragment shader, link) after a two-frame head start.
+    bool reload();
+    void updateReload();
+    // Waits for a pending build
+    void finishReload();
+    bool isReloading() const { return _pending.program != 0; }
+    // Incremented on every program swap, users caching uniform locations compare it
+    unsigned int getGeneration() const { return _generation; }
+    const std::string &getVertexFile() const { return _vsFilename; }
+    const std::string &getFragmentFile() const { return _fsFilename; }
+
     void setUniform(const GLchar *name, const float &f);
     void setUniform(const GLchar *name, const glm::vec2 &v);
     void setUniform(const GLchar *name, const glm::vec3 &v);
@@ -34,9 +56,32 @@ public:
     GLint getUniformLocation(const GLchar *name);
 
 private:
+    ShaderProgram(const ShaderProgram &rhs) = delete;
+    ShaderProgram &operator=(const ShaderProgram &rhs) = delete;
+
+    // A program being compiled, the shaders are kept until the result is known for their logs
+    struct Build
+    {
+        GLuint program;
+        GLuint vs;
+        GLuint fs;
+        int polls;
+    };
+
     std::string fileToString(const std::string &filename);
-    void checkCompileErrors(GLuint shader, ShaderType type);
+    bool checkCompileErrors(GLuint shader, ShaderType type);
+    bool startBuild(Build &build);
+    // Once per frame; true when the build's status can be read without waiting
+    bool pollBuild(Build &build);
+    bool finishBuild(Build &build);
+    void discardBuild(Build &build);
+    void swapProgram(GLuint program);
 
     GLuint _handle;
+    unsigned int _generation;
+    Build _pending;
+    std::string _vsFilename;
+    std::string _fsFilename;
+    std::string _defines;
     std::map<std::string, GLint> mUniformLocations;
 };
@@ -0,0 +1,84 @@
+#include "ShaderVariants.h"
+#include "ShaderProgram.h"
+#include <cassert>
+
+ShaderVariants::ShaderVariants(const char *vsFilename, const char *fsFilename)
+    : _vsFilename(vsFilename),
+      _fsFilename(fsFilename)
+{
+}
+
+ShaderVariants::~ShaderVariants() = default;
+
+ShaderProgram &ShaderVariants::get(ShaderKey key)
+{
+    assert(key < SHADER_VARIANT_COUNT);
+    if (!_variants[key])
+    {
+        _variants[key] = std::make_unique<ShaderProgram>();
+        _variants[key]->loadShaders(_vsFilename.c_str(), _fsFilename.c_str(), getDefines(key));
+    }
+    return *_variants[key];
+}
+
+void ShaderVariants::precompile(const std::vector<ShaderKey> &keys)
+{
+    for (ShaderKey key : keys)
+    {
+        assert(key < SHADER_VARIANT_COUNT);
+        if (!_variants[key])
+        {
+            _variants[key] = std::make_unique<ShaderProgram>();
+            _variants[key]->loadShadersAsync(_vsFilename.c_str(), _fsFilename.c_str(), getDefines(key));
+        }
+    }
+    for (ShaderKey key : keys)
+    {
+        _variants[key]->finishReload();
+    }
+}
+
+void ShaderVariants::reload()
+{
+    for (std::unique_ptr<ShaderProgram> &variant : _variants)
+    {
+        if (variant)
+        {
+            variant->reload();
+        }
+    }
+}
+
+void ShaderVariants::updateReload()
+{
+    for (std::unique_ptr<ShaderProgram> &variant : _variants)
+    {
+        if (variant)
+        {
+            variant->updateReload();
+        }
+    }
+}
+
+int ShaderVariants::getCompiledCount() const
+{
+    int count = 0;
+    for (const std::unique_ptr<ShaderProgram> &variant : _variants)
+    {
+        count += variant ? 1 : 0;
+    }
+    return count;
+}
+
+std::string ShaderVariants::getDefines(ShaderKey key)
+{
+    std::string defines;
+    for (int feature = 0; feature < SHADER_FEATURE_COUNT; feature++)
+    {
+        if (key & (1u << feature))
+        {
+            defines += std::string("#define ") + SHADER_FEATURE_NAMES[feature] + " 1\n";
+        }
+    }
+    return defines;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class ShaderProgram;
+
+// Feature bits of a shader variant. Every bit has a FEATURE_<NAME> block in the shader
+// sources, enabled by a #define that ShaderVariants injects. A new feature needs a bit
+// here, a name in SHADER_FEATURE_NAMES and its #ifdef blocks.
+using ShaderKey = unsigned int;
+
+constexpr ShaderKey FEATURE_FOG = 1u << 0;        // exponential fog on view distance
+constexpr ShaderKey FEATURE_INSTANCING = 1u << 1; // model matrix and interpolation from per-instance attributes 3-7 (Md2::DrawCrowd)
+constexpr ShaderKey FEATURE_POSE_BUFFER = 1u << 2; // positions from a buffer texture of CPU poses, with FEATURE_INSTANCING
+constexpr int SHADER_FEATURE_COUNT = 3;
+constexpr ShaderKey SHADER_VARIANT_COUNT = 1u << SHADER_FEATURE_COUNT;
+
+constexpr const char *SHADER_FEATURE_NAMES[SHADER_FEATURE_COUNT] = {"FEATURE_FOG", "FEATURE_INSTANCING", "FEATURE_POSE_BUFFER"};
+
+// All feature combinations of one vertex/fragment shader pair. Variants are compiled on
+// first use, or up front with precompile() so the first draw does not wait for the
+// compiler. Lookup is an array index.
+class ShaderVariants
+{
+public:
+    ShaderVariants(const char *vsFilename, const char *fsFilename);
+    ~ShaderVariants();
+
+    // Compiles the variant if needed (blocking)
+    ShaderProgram &get(ShaderKey key);
+    bool isCompiled(ShaderKey key) const { return _variants[key] != nullptr; }
+    // Starts every build before waiting for any, so drivers with parallel compilation
+    // overlap them
+    void precompile(const std::vector<ShaderKey> &keys);
+
+    // Hot reload of every compiled variant (see ShaderWatcher)
+    void reload();
+    void updateReload();
+
+    const std::string &getVertexFile() const { return _vsFilename; }
+    const std::string &getFragmentFile() const { return _fsFilename; }
+    int getCompiledCount() const;
+
+    static std::string getDefines(ShaderKey key);
+
+private:
+    ShaderVariants(const ShaderVariants &rhs) = delete;
+    ShaderVariants &operator=(const ShaderVariants &rhs) = delete;
+
+    std::string _vsFilename;
+    std::string _fsFilename;
+    std::unique_ptr<ShaderProgram> _variants[SHADER_VARIANT_COUNT];
+};
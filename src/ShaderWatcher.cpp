@@ -0,0 +1,184 @@
+#include "ShaderWatcher.h"
+#include "ShaderProgram.h"
+#include "ShaderVariants.h"
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#ifdef __linux__
+    // Editors either rewrite the file or write a temporary one and rename it over the original
+    constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO;
+    constexpr size_t EVENT_BUFFER_SIZE = 4096;
+#else
+    constexpr std::chrono::milliseconds POLL_INTERVAL(250);
+#endif
+}
+
+ShaderWatcher::ShaderWatcher()
+{
+#ifdef __linux__
+    _inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify < 0)
+    {
+        std::cerr << "Unable to watch shader files, hot reload is disabled" << std::endl;
+    }
+#else
+    _lastPoll = std::chrono::steady_clock::now();
+#endif
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+#ifdef __linux__
+    if (_inotify >= 0)
+    {
+        // Closing the descriptor removes every watch
+        close(_inotify);
+    }
+#endif
+}
+
+void ShaderWatcher::watch(ShaderProgram &program)
+{
+    WatchedProgram watched{&program, nullptr, {watchFile(program.getVertexFile()), watchFile(program.getFragmentFile())}, false};
+    _programs.push_back(watched);
+}
+
+void ShaderWatcher::watch(ShaderVariants &variants)
+{
+    WatchedProgram watched{nullptr, &variants, {watchFile(variants.getVertexFile()), watchFile(variants.getFragmentFile())}, false};
+    _programs.push_back(watched);
+}
+
+void ShaderWatcher::unwatch(ShaderVariants &variants)
+{
+    _programs.erase(std::remove_if(_programs.begin(), _programs.end(), [&variants](const WatchedProgram &watched)
+                                   { return watched.variants == &variants; }),
+                    _programs.end());
+}
+
+void ShaderWatcher::unwatch(ShaderProgram &program)
+{
+    _programs.erase(std::remove_if(_programs.begin(), _programs.end(), [&program](const WatchedProgram &watched)
+                                   { return watched.program == &program; }),
+                    _programs.end());
+}
+
+void ShaderWatcher::update()
+{
+    collectChanges();
+    for (WatchedProgram &watched : _programs)
+    {
+        if (watched.program)
+        {
+            if (watched.changed)
+            {
+                watched.program->reload();
+            }
+            watched.program->updateReload();
+        }
+        else
+        {
+            if (watched.changed)
+            {
+                watched.variants->reload();
+            }
+            watched.variants->updateReload();
+        }
+        watched.changed = false;
+    }
+}
+
+#ifdef __linux__
+
+ShaderWatcher::WatchedFile ShaderWatcher::watchFile(const std::string &filename)
+{
+    size_t slash = filename.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : filename.substr(0, slash);
+    std::string name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+
+    // Adding the same directory twice returns the existing descriptor
+    int descriptor = _inotify >= 0 ? inotify_add_watch(_inotify, directory.c_str(), WATCH_EVENTS) : -1;
+    if (_inotify >= 0 && descriptor < 0)
+    {
+        std::cerr << "Unable to watch " << directory << " for changes to " << name << std::endl;
+    }
+    return {descriptor, name};
+}
+
+void ShaderWatcher::collectChanges()
+{
+    if (_inotify < 0)
+    {
+        return;
+    }
+
+    // Non-blocking, read() fails with EAGAIN once the queue is empty
+    alignas(inotify_event) char buffer[EVENT_BUFFER_SIZE];
+    ssize_t length;
+    while ((length = read(_inotify, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *position = buffer; position < buffer + length;)
+        {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(position);
+            position += sizeof(inotify_event) + event->len;
+            if (event->len == 0)
+            {
+                continue;
+            }
+            for (WatchedProgram &watched : _programs)
+            {
+                for (const WatchedFile &file : watched.files)
+                {
+                    if (file.directory == event->wd && file.name == event->name)
+                    {
+                        watched.changed = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+#else
+
+ShaderWatcher::WatchedFile ShaderWatcher::watchFile(const std::string &filename)
+{
+    std::error_code error;
+    std::filesystem::path path(filename);
+    std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(path, error);
+    return {path, writeTime};
+}
+
+void ShaderWatcher::collectChanges()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now - _lastPoll < POLL_INTERVAL)
+    {
+        return;
+    }
+    _lastPoll = now;
+
+    for (WatchedProgram &watched : _programs)
+    {
+        for (WatchedFile &file : watched.files)
+        {
+            std::error_code error;
+            std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(file.path, error);
+            if (!error && writeTime != file.writeTime)
+            {
+                file.writeTime = writeTime;
+                watched.changed = true;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#ifndef __linux__
+#include <chrono>
+#include <filesystem>
+#endif
+
+class ShaderProgram;
+class ShaderVariants;
+
+// Watches the source files of shader programs and reloads a program when one of them is
+// saved. Uses inotify on Linux and polls modification times elsewhere. Reloads compile in
+// the background (see ShaderProgram::reload), so a frame never waits for the compiler.
+//
+//     ShaderWatcher watcher;
+//     watcher.watch(program);
+//     while (running)
+//     {
+//         watcher.update(); // once per frame, on the GL thread
+//         ...
+//     }
+class ShaderWatcher
+{
+public:
+    ShaderWatcher();
+    ~ShaderWatcher();
+
+    // The program must outlive the watcher or be unwatched first
+    void watch(ShaderProgram &program);
+    void unwatch(ShaderProgram &program);
+    // Every compiled variant is reloaded when the shared sources change
+    void watch(ShaderVariants &variants);
+    void unwatch(ShaderVariants &variants);
+    void update();
+
+private:
+    ShaderWatcher(const ShaderWatcher &rhs) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher &rhs) = delete;
+
+    struct WatchedFile
+    {
+#ifdef __linux__
+        int directory;      // inotify watch descriptor of the containing directory
+        std::string name;   // file name inside it
+#else
+        std::filesystem::path path;
+        std::filesystem::file_time_type writeTime;
+#endif
+    };
+
+    // Either a single program or a set of variants
+    struct WatchedProgram
+    {
+        ShaderProgram *program;
+        ShaderVariants *variants;
+        WatchedFile files[2]; // vertex, fragment
+        bool changed;
+    };
+
+    WatchedFile watchFile(const std::string &filename);
+    void collectChanges();
+
+    std::vector<WatchedProgram> _programs;
+#ifdef __linux__
+    int _inotify;
+#else
+    std::chrono::steady_clock::time_point _lastPoll;
+#endif
+};
@@ -0,0 +1,97 @@
+#include "SoftwareMd2.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "PoseKernel.h"
+#include "TgaLoader.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+using namespace md2model;
+
+SoftwareMd2::SoftwareMd2(const char *md2FileName, const char *textureFileName, SoftwareRasterizer &target)
+    : _target(target),
+      _texture(),
+      _boundingRadius(0.0f),
+      _boundsMin(std::numeric_limits<float>::max()),
+      _boundsMax(-std::numeric_limits<float>::max()),
+      _position(DEFAULT_MODEL_POSITION),
+      _forcedLod(-1),
+      _shaderFeatures(0),
+      _poseCache(nullptr)
+{
+    _model = LoadModelData(md2FileName);
+    unsigned short width = 0, height = 0;
+    if (!_model || !LoadTGA(textureFileName, _texels, width, height) || width == 0 || height == 0)
+    {
+        std::cerr << "Error loading '" << md2FileName << "' or '" << textureFileName << "' for software rendering" << std::endl;
+        _model.reset();
+        _texels.clear();
+        return;
+    }
+    _texture = {_texels.data(), width, height, static_cast<int>(_texels.size() / (static_cast<size_t>(width) * height))};
+
+    for (const md2model::vector &point : _model->pointList)
+    {
+        glm::vec3 position(point.point[0], point.point[1], point.point[2]);
+        _boundingRadius = std::max(_boundingRadius, glm::length(position));
+        _boundsMin = glm::min(_boundsMin, position);
+        _boundsMax = glm::max(_boundsMax, position);
+    }
+
+    // The same levels Md2 builds, indexing one set of wedges
+    MeshSimplifier simplifier(*_model);
+    std::vector<LodLevel> levels = simplifier.BuildLods(LOD_LEVELS, LOD_REDUCTION_RATIO);
+    _wedges = BuildWedges(levels[0].triangles);
+    for (const LodLevel &level : levels)
+    {
+        _lodIndices.push_back(BuildIndices(level.triangles, _wedges));
+    }
+
+    _pose.resize(static_cast<size_t>(_model->numPoints) * POSITION_COMPONENTS);
+    _vertices.resize(_wedges.size());
+}
+
+void SoftwareMd2::Draw(int frame, float angle, float interpolation, const glm::mat4 &view, const glm::mat4 &projection)
+{
+    if (!isValid())
+    {
+        return;
+    }
+    if (frame < 0 || frame >= _model->numFrames)
+    {
+        std::cerr << "Error: Invalid frame index " << frame << " (valid range: 0-" << _model->numFrames - 1 << ")" << std::endl;
+        return;
+    }
+
+    // The last frame blends back into the first one, as in the GL vertex buffers
+    const int nextFrame = frame + 1 == _model->numFrames ? 0 : frame + 1;
+    const float *pose = _pose.data();
+    if (_poseCache)
+    {
+        pose = _poseCache->GetPositions(_poseCache->Acquire(*_model, frame, nextFrame, interpolation));
+    }
+    else
+    {
+        InterpolatePose(*_model, frame, nextFrame, interpolation, _pose.data());
+    }
+
+    // basic.vert
+    const glm::mat4 modelView = view * ModelTransform(_position, angle);
+    for (size_t i = 0; i < _wedges.size(); i++)
+    {
+        const float *point = &pose[_wedges[i].meshIndex * POSITION_COMPONENTS];
+        const glm::vec4 viewPosition = modelView * glm::vec4(point[0], point[1], point[2], 1.0f);
+        const textcoord &st = _model->st[_wedges[i].stIndex];
+        _vertices[i] = {projection * viewPosition, glm::vec2(st.s, st.t), glm::length(glm::vec3(viewPosition.x, viewPosition.y, viewPosition.z))};
+    }
+
+    const int lod = _forcedLod >= 0 ? std::min(_forcedLod, GetLodCount() - 1) : SelectLod(view, projection);
+    const std::vector<unsigned short> &indices = _lodIndices[lod];
+    _target.drawIndexed(_vertices.data(), indices.data(), static_cast<int>(indices.size()), _texture, (_shaderFeatures & FEATURE_FOG) != 0);
+}
+
+int SoftwareMd2::SelectLod(const glm::mat4 &view, const glm::mat4 &projection) const
+{
+    return md2model::SelectLod(_position, _boundingRadius, DEFAULT_LOD_SCREEN_SIZES, GetLodCount(), view, projection);
+}
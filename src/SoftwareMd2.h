@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Md2.h"
+#include "PoseCache.h"
+#include "SoftwareRasterizer.h"
+
+namespace md2model
+{
+    // Md2 for the software rasterizer: same Draw() call, same LOD levels and selection, same
+    // transforms and fog, but no GL context. The pose comes from the CPU kernel
+    // (PoseKernel.h) and the basic.vert transform runs on the CPU. Draws are queued on
+    // the target, SoftwareRasterizer::finish() produces the image.
+    class SoftwareMd2
+    {
+    public:
+        SoftwareMd2(const char *md2FileName, const char *textureFileName, SoftwareRasterizer &target);
+
+        // The frame parameter start at 0
+        void Draw(int frame, float angle, float interpolation, const glm::mat4 &view, const glm::mat4 &projection);
+        bool isValid() const { return _model != nullptr && !_texels.empty(); }
+        void SetPosition(const glm::vec3 &position) { _position = position; }
+        const glm::vec3 &GetPosition() const { return _position; }
+        float GetBoundingRadius() const { return _boundingRadius * MODEL_SCALE; }
+        void GetBounds(float angle, glm::vec3 &min, glm::vec3 &max) const { ModelBounds(_boundsMin, _boundsMax, _position, angle, min, max); }
+
+        int SelectLod(const glm::mat4 &view, const glm::mat4 &projection) const;
+        // -1 restores automatic selection
+        void SetForcedLod(int lod) { _forcedLod = lod; }
+        int GetLodCount() const { return static_cast<int>(_lodIndices.size()); }
+        // Only FEATURE_FOG changes the output
+        void SetShaderFeatures(ShaderKey features) { _shaderFeatures = features; }
+        int GetFrameCount() const { return _model ? _model->numFrames : 0; }
+        // Poses come from the cache, shared with other draws at the same keyframes and
+        // quantized phase. nullptr evaluates the exact pose for every draw.
+        void SetPoseCache(PoseCache *cache) { _poseCache = cache; }
+
+    private:
+        SoftwareMd2(const SoftwareMd2 &rhs) = delete;
+        SoftwareMd2 &operator=(const SoftwareMd2 &rhs) = delete;
+
+        SoftwareRasterizer &_target;
+        std::unique_ptr<modData> _model;
+        std::vector<unsigned char> _texels;
+        SoftwareTexture _texture;
+        std::vector<wedge> _wedges;
+        std::vector<std::vector<unsigned short>> _lodIndices;
+        float _boundingRadius;
+        glm::vec3 _boundsMin; // model space
+        glm::vec3 _boundsMax;
+        glm::vec3 _position;
+        int _forcedLod;
+        ShaderKey _shaderFeatures;
+        PoseCache *_poseCache;
+
+        // Per draw, kept to avoid allocations
+        std::vector<float> _pose;
+        std::vector<SoftwareVertex> _vertices;
+    };
+}
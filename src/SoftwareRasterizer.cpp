@@ -0,0 +1,556 @@
+#include "SoftwareRasterizer.h"
+#include "TgaLoader.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RASTER_SSE2 1
+#endif
+
+namespace
+{
+    constexpr int CLIP_PLANES = 6;
+    constexpr int MAX_CLIPPED_VERTICES = 3 + CLIP_PLANES; // every plane adds at most one
+    constexpr int SUBPIXELS = 1 << SoftwareRasterizer::SUBPIXEL_BITS;
+    constexpr int HALF_PIXEL = SUBPIXELS / 2;
+    constexpr int LANES = 4;
+
+    // Non-negative inside the plane: -w <= x, y, z <= w
+    float PlaneDistance(const glm::vec4 &p, int plane)
+    {
+        switch (plane)
+        {
+        case 0:
+            return p.w + p.x;
+        case 1:
+            return p.w - p.x;
+        case 2:
+            return p.w + p.y;
+        case 3:
+            return p.w - p.y;
+        case 4:
+            return p.w + p.z;
+        default:
+            return p.w - p.z;
+        }
+    }
+
+    unsigned int OutCode(const glm::vec4 &p)
+    {
+        unsigned int code = 0;
+        for (int plane = 0; plane < CLIP_PLANES; plane++)
+        {
+            if (PlaneDistance(p, plane) < 0.0f)
+            {
+                code |= 1u << plane;
+            }
+        }
+        return code;
+    }
+
+    SoftwareVertex Lerp(const SoftwareVertex &a, const SoftwareVertex &b, float t)
+    {
+        return {a.position + (b.position - a.position) * t, a.texCoord + (b.texCoord - a.texCoord) * t, a.viewDistance + (b.viewDistance - a.viewDistance) * t};
+    }
+
+    // Sutherland-Hodgman against one plane, attributes are linear in clip space
+    int ClipPolygon(const SoftwareVertex *in, int count, SoftwareVertex *out, int plane)
+    {
+        int written = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const SoftwareVertex &a = in[i];
+            const SoftwareVertex &b = in[(i + 1) % count];
+            float da = PlaneDistance(a.position, plane);
+            float db = PlaneDistance(b.position, plane);
+            if (da >= 0.0f)
+            {
+                out[written++] = a;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                out[written++] = Lerp(a, b, da / (da - db));
+            }
+        }
+        return written;
+    }
+
+    int Wrap(int i, int n)
+    {
+        i %= n;
+        return i < 0 ? i + n : i;
+    }
+
+    uint32_t PackColor(float b, float g, float r, float a)
+    {
+        auto channel = [](float value)
+        {
+            return static_cast<uint32_t>(std::min(std::max(value, 0.0f), 255.0f) + 0.5f);
+        };
+        return channel(b) | channel(g) << 8 | channel(r) << 16 | channel(a) << 24;
+    }
+}
+
+SoftwareRasterizer::SoftwareRasterizer(int threadCount)
+    : _width(0),
+      _height(0),
+      _tilesX(0),
+      _tilesY(0),
+      _fogColor(0.25f, 0.2f, 0.15f),
+      _fogDensity(0.02f),
+      _stats(),
+      _generation(0),
+      _busy(0),
+      _stop(false),
+      _nextTile(0),
+      _fragments(0)
+{
+    if (threadCount <= 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // The thread calling finish() takes part, so one less worker
+    for (int i = 1; i < threadCount; i++)
+    {
+        _workers.emplace_back(&SoftwareRasterizer::work, this);
+    }
+}
+
+SoftwareRasterizer::~SoftwareRasterizer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread &worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+bool SoftwareRasterizer::init(int width, int height)
+{
+    if (width <= 0 || height <= 0 || width > MAX_SIZE || height > MAX_SIZE)
+    {
+        std::cerr << "Error: software render target " << width << "x" << height << " is not supported (at most " << MAX_SIZE << " pixels per side)" << std::endl;
+        return false;
+    }
+
+    _width = width;
+    _height = height;
+    _tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    _tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    _color.assign(static_cast<size_t>(width) * height, 0);
+    _depth.assign(static_cast<size_t>(width) * height, 1.0f);
+    _bins.resize(static_cast<size_t>(_tilesX) * _tilesY);
+    return true;
+}
+
+void SoftwareRasterizer::clear(const glm::vec4 &color, float depth)
+{
+    std::fill(_color.begin(), _color.end(), PackColor(color.z * 255.0f, color.y * 255.0f, color.x * 255.0f, color.w * 255.0f));
+    std::fill(_depth.begin(), _depth.end(), depth);
+}
+
+void SoftwareRasterizer::setFog(const glm::vec3 &color, float density)
+{
+    _fogColor = color;
+    _fogDensity = density;
+}
+
+void SoftwareRasterizer::drawIndexed(const SoftwareVertex *vertices, const unsigned short *indices, int indexCount, const SoftwareTexture &texture, bool fog)
+{
+    const uint32_t textureIndex = static_cast<uint32_t>(_textures.size());
+    _textures.push_back(texture);
+
+    for (int i = 0; i + 2 < indexCount; i += 3)
+    {
+        const SoftwareVertex &v0 = vertices[indices[i]];
+        const SoftwareVertex &v1 = vertices[indices[i + 1]];
+        const SoftwareVertex &v2 = vertices[indices[i + 2]];
+        _stats.triangles++;
+
+        unsigned int codes[3] = {OutCode(v0.position), OutCode(v1.position), OutCode(v2.position)};
+        if (codes[0] & codes[1] & codes[2])
+        {
+            continue; // outside one plane
+        }
+        unsigned int crossed = codes[0] | codes[1] | codes[2];
+        if (crossed == 0)
+        {
+            setupTriangle(v0, v1, v2, textureIndex, fog);
+            continue;
+        }
+
+        SoftwareVertex polygons[2][MAX_CLIPPED_VERTICES] = {{v0, v1, v2}};
+        int count = 3;
+        int current = 0;
+        for (int plane = 0; plane < CLIP_PLANES && count >= 3; plane++)
+        {
+            if (crossed & (1u << plane))
+            {
+                count = ClipPolygon(polygons[current], count, polygons[1 - current], plane);
+                current = 1 - current;
+            }
+        }
+        for (int k = 1; k + 1 < count; k++)
+        {
+            setupTriangle(polygons[current][0], polygons[current][k], polygons[current][k + 1], textureIndex, fog);
+            _stats.clippedTriangles++;
+        }
+    }
+}
+
+void SoftwareRasterizer::setupTriangle(const SoftwareVertex &v0, const SoftwareVertex &v1, const SoftwareVertex &v2, uint32_t texture, bool fog)
+{
+    const SoftwareVertex *vertices[3] = {&v0, &v1, &v2};
+    int32_t x[3], y[3];
+    float z[3], inverseW[3];
+    for (int i = 0; i < 3; i++)
+    {
+        const glm::vec4 &p = vertices[i]->position;
+        inverseW[i] = 1.0f / p.w;
+        // Snapped to the subpixel grid, the last subpixel of the target is the limit
+        float sx = (p.x * inverseW[i] * 0.5f + 0.5f) * _width * SUBPIXELS;
+        float sy = (p.y * inverseW[i] * 0.5f + 0.5f) * _height * SUBPIXELS;
+        x[i] = std::min(std::max(static_cast<int32_t>(std::lround(sx)), 0), _width * SUBPIXELS - 1);
+        y[i] = std::min(std::max(static_cast<int32_t>(std::lround(sy)), 0), _height * SUBPIXELS - 1);
+        z[i] = p.z * inverseW[i] * 0.5f + 0.5f;
+    }
+
+    int64_t area = static_cast<int64_t>(x[1] - x[0]) * (y[2] - y[0]) - static_cast<int64_t>(x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0)
+    {
+        return;
+    }
+    // No face culling, clockwise triangles are turned around
+    int order[3] = {0, 1, 2};
+    if (area < 0)
+    {
+        std::swap(order[1], order[2]);
+        area = -area;
+    }
+
+    Triangle triangle;
+    int32_t minX = INT32_MAX, minY = INT32_MAX, maxX = 0, maxY = 0;
+    int64_t edgeSum = area; // of the biased edge functions, the same at every pixel
+    for (int i = 0; i < 3; i++)
+    {
+        const int a = order[(i + 1) % 3];
+        const int b = order[(i + 2) % 3];
+        triangle.a[i] = y[a] - y[b];
+        triangle.b[i] = x[b] - x[a];
+        triangle.c[i] = -(static_cast<int64_t>(triangle.a[i]) * x[a] + static_cast<int64_t>(triangle.b[i]) * y[a]);
+        // Pixels exactly on an edge belong to the triangle on its top or left side only
+        bool topLeft = triangle.a[i] > 0 || (triangle.a[i] == 0 && triangle.b[i] < 0);
+        if (!topLeft)
+        {
+            triangle.c[i] -= 1;
+            edgeSum -= 1;
+        }
+
+        const int v = order[i];
+        const SoftwareVertex &vertex = *vertices[v];
+        triangle.z[i] = z[v];
+        triangle.inverseW[i] = inverseW[v];
+        triangle.u[i] = vertex.texCoord.x * inverseW[v];
+        triangle.v[i] = vertex.texCoord.y * inverseW[v];
+        triangle.fog[i] = vertex.viewDistance * inverseW[v];
+        minX = std::min(minX, x[v]);
+        minY = std::min(minY, y[v]);
+        maxX = std::max(maxX, x[v]);
+        maxY = std::max(maxY, y[v]);
+    }
+
+    // Pixels whose center lies within the bounds
+    triangle.minX = (minX - HALF_PIXEL + SUBPIXELS - 1) >> SUBPIXEL_BITS;
+    triangle.minY = (minY - HALF_PIXEL + SUBPIXELS - 1) >> SUBPIXEL_BITS;
+    triangle.maxX = std::min((maxX - HALF_PIXEL) >> SUBPIXEL_BITS, _width - 1);
+    triangle.maxY = std::min((maxY - HALF_PIXEL) >> SUBPIXEL_BITS, _height - 1);
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+    {
+        return;
+    }
+    // Normalizing by the biased sum keeps the weights summing to one; on small, distant
+    // triangles the bias would otherwise pull depth visibly towards the camera
+    if (edgeSum <= 0)
+    {
+        return;
+    }
+    triangle.inverseArea = 1.0f / static_cast<float>(edgeSum);
+    triangle.texture = texture;
+    triangle.fogEnabled = fog;
+    _triangles.push_back(triangle);
+}
+
+void SoftwareRasterizer::finish()
+{
+    if (!_triangles.empty())
+    {
+        binTriangles();
+        _nextTile.store(0);
+        _fragments.store(0);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _busy = static_cast<int>(_workers.size());
+            _generation++;
+        }
+        _wake.notify_all();
+        rasterizeTiles();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [this]
+                       { return _busy == 0; });
+        }
+        _stats.rasterized += _triangles.size();
+        _stats.fragments += _fragments.load();
+    }
+    _triangles.clear();
+    _textures.clear();
+}
+
+void SoftwareRasterizer::binTriangles()
+{
+    for (std::vector<uint32_t> &bin : _bins)
+    {
+        bin.clear();
+    }
+
+    for (uint32_t index = 0; index < _triangles.size(); index++)
+    {
+        const Triangle &triangle = _triangles[index];
+        for (int ty = triangle.minY / TILE_SIZE; ty <= triangle.maxY / TILE_SIZE; ty++)
+        {
+            for (int tx = triangle.minX / TILE_SIZE; tx <= triangle.maxX / TILE_SIZE; tx++)
+            {
+                // Edge functions are linear, so a tile is outside an edge when all four corner
+                // pixel centers are
+                const int64_t x0 = static_cast<int64_t>(tx * TILE_SIZE) * SUBPIXELS + HALF_PIXEL;
+                const int64_t y0 = static_cast<int64_t>(ty * TILE_SIZE) * SUBPIXELS + HALF_PIXEL;
+                const int64_t x1 = static_cast<int64_t>(std::min((tx + 1) * TILE_SIZE, _width) - 1) * SUBPIXELS + HALF_PIXEL;
+                const int64_t y1 = static_cast<int64_t>(std::min((ty + 1) * TILE_SIZE, _height) - 1) * SUBPIXELS + HALF_PIXEL;
+                bool outside = false;
+                for (int i = 0; i < 3 && !outside; i++)
+                {
+                    int64_t x = triangle.a[i] > 0 ? x1 : x0;
+                    int64_t y = triangle.b[i] > 0 ? y1 : y0;
+                    outside = triangle.a[i] * x + triangle.b[i] * y + triangle.c[i] < 0;
+                }
+                if (!outside)
+                {
+                    _bins[ty * _tilesX + tx].push_back(index);
+                    _stats.tileBins++;
+                }
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::work()
+{
+    unsigned int seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this, seen]
+                       { return _stop || _generation != seen; });
+            if (_stop)
+            {
+                return;
+            }
+            seen = _generation;
+        }
+        rasterizeTiles();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (--_busy == 0)
+            {
+                _done.notify_one();
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::rasterizeTiles()
+{
+    const int tileCount = _tilesX * _tilesY;
+    unsigned long long fragments = 0;
+    while (true)
+    {
+        int tile = _nextTile.fetch_add(1);
+        if (tile >= tileCount)
+        {
+            break;
+        }
+        rasterizeTile(tile, fragments);
+    }
+    _fragments.fetch_add(fragments);
+}
+
+void SoftwareRasterizer::rasterizeTile(int tile, unsigned long long &fragments)
+{
+    const int tileX = (tile % _tilesX) * TILE_SIZE;
+    const int tileY = (tile / _tilesX) * TILE_SIZE;
+    const int tileMaxX = std::min(tileX + TILE_SIZE, _width) - 1;
+    const int tileMaxY = std::min(tileY + TILE_SIZE, _height) - 1;
+    for (uint32_t index : _bins[tile])
+    {
+        const Triangle &triangle = _triangles[index];
+        rasterizeTriangle(triangle, std::max(tileX, triangle.minX), std::max(tileY, triangle.minY), std::min(tileMaxX, triangle.maxX), std::min(tileMaxY, triangle.maxY), fragments);
+    }
+}
+
+void SoftwareRasterizer::rasterizeTriangle(const Triangle &triangle, int x0, int y0, int x1, int y1, unsigned long long &fragments)
+{
+    if (x0 > x1 || y0 > y1)
+    {
+        return;
+    }
+
+    int32_t stepX[3];
+    for (int i = 0; i < 3; i++)
+    {
+        stepX[i] = triangle.a[i] * SUBPIXELS;
+    }
+#if RASTER_SSE2
+    __m128i laneOffset[3], blockStep[3];
+    for (int i = 0; i < 3; i++)
+    {
+        laneOffset[i] = _mm_setr_epi32(0, stepX[i], 2 * stepX[i], 3 * stepX[i]);
+        blockStep[i] = _mm_set1_epi32(LANES * stepX[i]);
+    }
+#endif
+
+    for (int y = y0; y <= y1; y++)
+    {
+        // Inside the bounding box the edge functions fit in 32 bits (see MAX_SIZE)
+        const int64_t sampleX = static_cast<int64_t>(x0) * SUBPIXELS + HALF_PIXEL;
+        const int64_t sampleY = static_cast<int64_t>(y) * SUBPIXELS + HALF_PIXEL;
+        int32_t rowStart[3];
+        for (int i = 0; i < 3; i++)
+        {
+            rowStart[i] = static_cast<int32_t>(triangle.a[i] * sampleX + triangle.b[i] * sampleY + triangle.c[i]);
+        }
+
+#if RASTER_SSE2
+        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(rowStart[0]), laneOffset[0]);
+        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(rowStart[1]), laneOffset[1]);
+        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(rowStart[2]), laneOffset[2]);
+#endif
+        for (int x = x0; x <= x1; x += LANES)
+        {
+            const int lanes = std::min(LANES, x1 - x + 1);
+            alignas(16) int32_t edge0[LANES], edge1[LANES], edge2[LANES];
+            unsigned int covered;
+#if RASTER_SSE2
+            // Inside where no edge function has its sign bit set
+            __m128i any = _mm_or_si128(_mm_or_si128(e0, e1), e2);
+            covered = ~static_cast<unsigned int>(_mm_movemask_ps(_mm_castsi128_ps(any))) & ((1u << lanes) - 1);
+            if (covered)
+            {
+                _mm_store_si128(reinterpret_cast<__m128i *>(edge0), e0);
+                _mm_store_si128(reinterpret_cast<__m128i *>(edge1), e1);
+                _mm_store_si128(reinterpret_cast<__m128i *>(edge2), e2);
+            }
+            e0 = _mm_add_epi32(e0, blockStep[0]);
+            e1 = _mm_add_epi32(e1, blockStep[1]);
+            e2 = _mm_add_epi32(e2, blockStep[2]);
+#else
+            covered = 0;
+            for (int lane = 0; lane < lanes; lane++)
+            {
+                const int32_t offset = x - x0 + lane;
+                edge0[lane] = rowStart[0] + offset * stepX[0];
+                edge1[lane] = rowStart[1] + offset * stepX[1];
+                edge2[lane] = rowStart[2] + offset * stepX[2];
+                if ((edge0[lane] | edge1[lane] | edge2[lane]) >= 0)
+                {
+                    covered |= 1u << lane;
+                }
+            }
+#endif
+            for (int lane = 0; covered; lane++, covered >>= 1)
+            {
+                if ((covered & 1u) == 0)
+                {
+                    continue;
+                }
+                const float l0 = edge0[lane] * triangle.inverseArea;
+                const float l1 = edge1[lane] * triangle.inverseArea;
+                const float l2 = edge2[lane] * triangle.inverseArea;
+                const float depth = l0 * triangle.z[0] + l1 * triangle.z[1] + l2 * triangle.z[2];
+                const size_t pixel = static_cast<size_t>(y) * _width + x + lane;
+                if (depth < _depth[pixel])
+                {
+                    _depth[pixel] = depth;
+                    _color[pixel] = shade(triangle, l0, l1, l2);
+                    fragments++;
+                }
+            }
+        }
+    }
+}
+
+uint32_t SoftwareRasterizer::shade(const Triangle &triangle, float l0, float l1, float l2) const
+{
+    // Perspective-correct attributes
+    const float w = 1.0f / (l0 * triangle.inverseW[0] + l1 * triangle.inverseW[1] + l2 * triangle.inverseW[2]);
+    const float u = (l0 * triangle.u[0] + l1 * triangle.u[1] + l2 * triangle.u[2]) * w;
+    const float v = (l0 * triangle.v[0] + l1 * triangle.v[1] + l2 * triangle.v[2]) * w;
+
+    // Bilinear with GL_REPEAT, texel centers at half coordinates
+    const SoftwareTexture &texture = _textures[triangle.texture];
+    const float sx = u * texture.width - 0.5f;
+    const float sy = v * texture.height - 0.5f;
+    const float fx = sx - std::floor(sx);
+    const float fy = sy - std::floor(sy);
+    const int ix = static_cast<int>(std::floor(sx));
+    const int iy = static_cast<int>(std::floor(sy));
+    const int columns[2] = {Wrap(ix, texture.width), Wrap(ix + 1, texture.width)};
+    const int rows[2] = {Wrap(iy, texture.height), Wrap(iy + 1, texture.height)};
+    const float weights[4] = {(1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy};
+
+    float color[3] = {0.0f, 0.0f, 0.0f}; // BGR, 0 to 255
+    for (int corner = 0; corner < 4; corner++)
+    {
+        const size_t texel = static_cast<size_t>(rows[corner >> 1]) * texture.width + columns[corner & 1];
+        const unsigned char *bgr = texture.texels + texel * texture.bytesPerPixel;
+        for (int c = 0; c < 3; c++)
+        {
+            color[c] += bgr[c] * weights[corner];
+        }
+    }
+
+    if (triangle.fogEnabled)
+    {
+        const float distance = (l0 * triangle.fog[0] + l1 * triangle.fog[1] + l2 * triangle.fog[2]) * w;
+        const float visibility = std::min(std::max(std::exp(-_fogDensity * distance), 0.0f), 1.0f);
+        const float fog[3] = {_fogColor.z * 255.0f, _fogColor.y * 255.0f, _fogColor.x * 255.0f};
+        for (int c = 0; c < 3; c++)
+        {
+            color[c] = fog[c] + (color[c] - fog[c]) * visibility;
+        }
+    }
+    // GL_RGB textures read back with an alpha of one
+    return PackColor(color[0], color[1], color[2], 255.0f);
+}
+
+uint64_t SoftwareRasterizer::getChecksum() const
+{
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(_color.data());
+    for (size_t i = 0; i < _color.size() * sizeof(uint32_t); i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+bool SoftwareRasterizer::save(const char *filename) const
+{
+    return SaveTGA(filename, reinterpret_cast<const unsigned char *>(_color.data()), static_cast<unsigned short>(_width), static_cast<unsigned short>(_height), 4);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// BGR(A) texels with the bottom row first, as returned by LoadTGA. Sampled bilinearly with
+// repeat wrapping, like the GL textures. The texels must stay alive until finish().
+struct SoftwareTexture
+{
+    const unsigned char *texels;
+    int width;
+    int height;
+    int bytesPerPixel;
+};
+
+// Output of the vertex stage: what basic.vert hands to the rasterizer
+struct SoftwareVertex
+{
+    glm::vec4 position; // clip space
+    glm::vec2 texCoord;
+    float viewDistance; // only read with fog
+};
+
+struct RasterStats
+{
+    unsigned long long triangles;        // submitted
+    unsigned long long clippedTriangles; // produced by clipping against the view volume
+    unsigned long long rasterized;       // set up and binned, after clipping and degenerate removal
+    unsigned long long tileBins;         // triangle references over all tiles
+    unsigned long long fragments;        // passed the depth test
+};
+
+// CPU reference for the GL path, for machines without a GPU. Follows the GL 3.3 rules the
+// app relies on: clipping against the view volume, no face culling, depth test GL_LESS,
+// perspective-correct texture coordinates and bilinear filtering.
+//
+// drawIndexed() transforms nothing; it clips, snaps to 1/16 pixel and sets up the triangles.
+// finish() bins them into TILE_SIZE tiles and rasterizes the tiles on a thread pool, four
+// pixels at a time with integer edge functions (SSE2 when available). Triangles keep their
+// submission order within a tile, so the image does not depend on the thread count.
+//
+// The color buffer is BGRA with the bottom row first, the layout SaveTGA and glReadPixels use.
+class SoftwareRasterizer
+{
+public:
+    static constexpr int TILE_SIZE = 32;
+    static constexpr int MAX_SIZE = 2048; // keeps the edge functions within 32 bits
+    static constexpr int SUBPIXEL_BITS = 4;
+
+    // 0 threads uses every hardware thread
+    explicit SoftwareRasterizer(int threadCount = 0);
+    ~SoftwareRasterizer();
+
+    bool init(int width, int height);
+    void clear(const glm::vec4 &color, float depth = 1.0f);
+    // basic.frag's fog, applied to draws with fog enabled
+    void setFog(const glm::vec3 &color, float density);
+
+    void drawIndexed(const SoftwareVertex *vertices, const unsigned short *indices, int indexCount, const SoftwareTexture &texture, bool fog = false);
+    // Rasterizes everything drawn since the last call
+    void finish();
+
+    int getWidth() const { return _width; }
+    int getHeight() const { return _height; }
+    int getThreadCount() const { return static_cast<int>(_workers.size()) + 1; }
+    const uint32_t *getColor() const { return _color.data(); }
+    const float *getDepth() const { return _depth.data(); }
+    // FNV-1a of the color buffer, for comparing against a golden image
+    uint64_t getChecksum() const;
+    bool save(const char *filename) const;
+    const RasterStats &getStats() const { return _stats; }
+
+private:
+    SoftwareRasterizer(const SoftwareRasterizer &rhs) = delete;
+    SoftwareRasterizer &operator=(const SoftwareRasterizer &rhs) = delete;
+
+    // E_i(x, y) = a[i] * x + b[i] * y + c[i] in subpixels; edge i is opposite vertex i and
+    // is non-negative inside, with the top-left rule folded into c
+    struct Triangle
+    {
+        int32_t a[3];
+        int32_t b[3];
+        int64_t c[3];
+        int minX, minY, maxX, maxY; // pixel bounds, inclusive
+        float inverseArea;
+        float z[3]; // window depth, linear in screen space
+        float inverseW[3];
+        float u[3], v[3], fog[3]; // divided by w
+        uint32_t texture;         // index into _textures
+        bool fogEnabled;
+    };
+
+    void setupTriangle(const SoftwareVertex &v0, const SoftwareVertex &v1, const SoftwareVertex &v2, uint32_t texture, bool fog);
+    void binTriangles();
+    void rasterizeTiles();
+    void rasterizeTile(int tile, unsigned long long &fragments);
+    void rasterizeTriangle(const Triangle &triangle, int x0, int y0, int x1, int y1, unsigned long long &fragments);
+    uint32_t shade(const Triangle &triangle, float l0, float l1, float l2) const;
+    void work();
+
+    int _width;
+    int _height;
+    int _tilesX;
+    int _tilesY;
+    std::vector<uint32_t> _color;
+    std::vector<float> _depth;
+    glm::vec3 _fogColor;
+    float _fogDensity;
+
+    // Kept between frames so steady-state frames do not allocate
+    std::vector<Triangle> _triangles;
+    std::vector<SoftwareTexture> _textures;
+    std::vector<std::vector<uint32_t>> _bins; // triangle indices per tile
+    RasterStats _stats;
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    unsigned int _generation; // bumped for every finish()
+    int _busy;
+    bool _stop;
+    std::atomic<int> _nextTile;
+    std::atomic<unsigned long long> _fragments;
+};
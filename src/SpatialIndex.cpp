@@ -0,0 +1,635 @@
+#include "SpatialIndex.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+    constexpr int STACK_SIZE = 256; // far above the height of a balanced tree of any size that fits in memory
+
+    Aabb Combine(const Aabb &a, const Aabb &b)
+    {
+        return {glm::min(a.min, b.min), glm::max(a.max, b.max)};
+    }
+
+    float SurfaceArea(const Aabb &box)
+    {
+        glm::vec3 d = box.max - box.min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    bool Contains(const Aabb &outer, const Aabb &inner)
+    {
+        return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+               inner.max.x <= outer.max.x && inner.max.y <= outer.max.y && inner.max.z <= outer.max.z;
+    }
+
+    Aabb SphereBox(const Sphere &sphere)
+    {
+        glm::vec3 r(sphere.radius, sphere.radius, sphere.radius);
+        return {sphere.center - r, sphere.center + r};
+    }
+
+    float PlaneDistance(const glm::vec4 &plane, const glm::vec3 &p)
+    {
+        return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w;
+    }
+
+    enum class Containment
+    {
+        OUTSIDE,
+        INTERSECTS,
+        INSIDE
+    };
+
+    Containment TestBox(const Frustum &frustum, const Aabb &box)
+    {
+        bool inside = true;
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            // Corner furthest along the normal, and the one furthest against it
+            glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x, plane.y >= 0.0f ? box.max.y : box.min.y, plane.z >= 0.0f ? box.max.z : box.min.z);
+            glm::vec3 negative(plane.x >= 0.0f ? box.min.x : box.max.x, plane.y >= 0.0f ? box.min.y : box.max.y, plane.z >= 0.0f ? box.min.z : box.max.z);
+            if (PlaneDistance(plane, positive) < 0.0f)
+            {
+                return Containment::OUTSIDE;
+            }
+            inside = inside && PlaneDistance(plane, negative) >= 0.0f;
+        }
+        return inside ? Containment::INSIDE : Containment::INTERSECTS;
+    }
+
+    bool TestSphere(const Frustum &frustum, const Sphere &sphere)
+    {
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            if (PlaneDistance(plane, sphere.center) < -sphere.radius)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Overlaps(const Sphere &sphere, const Aabb &box)
+    {
+        glm::vec3 d = sphere.center - glm::clamp(sphere.center, box.min, box.max);
+        return d.x * d.x + d.y * d.y + d.z * d.z <= sphere.radius * sphere.radius;
+    }
+
+    bool Overlaps(const Sphere &a, const Sphere &b)
+    {
+        glm::vec3 d = a.center - b.center;
+        float r = a.radius + b.radius;
+        return d.x * d.x + d.y * d.y + d.z * d.z <= r * r;
+    }
+
+    // Slab test, true if the ray enters the box before maxDistance
+    bool Intersects(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance, const Aabb &box)
+    {
+        float tMin = 0.0f, tMax = maxDistance;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t1 = (box.min[axis] - origin[axis]) * inverseDirection[axis];
+            float t2 = (box.max[axis] - origin[axis]) * inverseDirection[axis];
+            tMin = std::max(tMin, std::min(t1, t2));
+            tMax = std::min(tMax, std::max(t1, t2));
+        }
+        return tMin <= tMax;
+    }
+
+    // Distance along the ray to the sphere, 0 when starting inside, negative on a miss
+    float Intersects(const Ray &ray, const Sphere &sphere)
+    {
+        glm::vec3 m = ray.origin - sphere.center;
+        float b = glm::dot(m, ray.direction);
+        float c = glm::dot(m, m) - sphere.radius * sphere.radius;
+        if (c > 0.0f && b > 0.0f)
+        {
+            return -1.0f;
+        }
+        float discriminant = b * b - c;
+        if (discriminant < 0.0f)
+        {
+            return -1.0f;
+        }
+        return std::max(-b - std::sqrt(discriminant), 0.0f);
+    }
+
+    int LowestBit(uint32_t mask)
+    {
+        int bit = 0;
+        while (!(mask & 1u))
+        {
+            mask >>= 1;
+            bit++;
+        }
+        return bit;
+    }
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4 &m)
+{
+    // Rows of the matrix, glm stores columns
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    }
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[3] + rows[2];
+    frustum.planes[5] = rows[3] - rows[2];
+    for (glm::vec4 &plane : frustum.planes)
+    {
+        plane = plane * (1.0f / glm::length(glm::vec3(plane.x, plane.y, plane.z)));
+    }
+    return frustum;
+}
+
+SpatialIndex::SpatialIndex()
+    : _root(-1),
+      _freeList(-1),
+      _leafCount(0),
+      _stats()
+{
+}
+
+int SpatialIndex::allocateNode()
+{
+    int node;
+    if (_freeList >= 0)
+    {
+        node = _freeList;
+        _freeList = _nodes[node].parent;
+    }
+    else
+    {
+        node = static_cast<int>(_nodes.size());
+        _nodes.emplace_back();
+    }
+    _nodes[node].parent = -1;
+    _nodes[node].child1 = -1;
+    _nodes[node].child2 = -1;
+    _nodes[node].height = 0;
+    _nodes[node].userData = 0;
+    return node;
+}
+
+void SpatialIndex::freeNode(int node)
+{
+    _nodes[node].parent = _freeList;
+    _nodes[node].height = -1;
+    _freeList = node;
+}
+
+int SpatialIndex::insert(const Sphere &bounds, uint32_t userData)
+{
+    int leaf = allocateNode();
+    Node &node = _nodes[leaf];
+    glm::vec3 margin(MARGIN, MARGIN, MARGIN);
+    Aabb tight = SphereBox(bounds);
+    node.box = {tight.min - margin, tight.max + margin};
+    node.sphere = bounds;
+    node.userData = userData;
+    insertLeaf(leaf);
+    _leafCount++;
+    _stats.inserts++;
+    return leaf;
+}
+
+void SpatialIndex::remove(int handle)
+{
+    assert(handle >= 0 && handle < static_cast<int>(_nodes.size()) && isLeaf(handle) && _nodes[handle].height == 0);
+    removeLeaf(handle);
+    freeNode(handle);
+    _leafCount--;
+}
+
+bool SpatialIndex::move(int handle, const Sphere &bounds)
+{
+    assert(handle >= 0 && handle < static_cast<int>(_nodes.size()) && isLeaf(handle) && _nodes[handle].height == 0);
+    _stats.moves++;
+    Aabb tight = SphereBox(bounds);
+    glm::vec3 displacement = bounds.center - _nodes[handle].sphere.center;
+    _nodes[handle].sphere = bounds;
+    if (Contains(_nodes[handle].box, tight))
+    {
+        return false;
+    }
+
+    // Enlarge by the margin and by the motion expected over the next few moves, so
+    // steadily walking characters reinsert every few frames rather than every frame
+    removeLeaf(handle);
+    glm::vec3 margin(MARGIN, MARGIN, MARGIN);
+    Aabb box = {tight.min - margin, tight.max + margin};
+    glm::vec3 predicted = displacement * MOTION_PREDICTION;
+    box.min += glm::min(predicted, glm::vec3(0.0f));
+    box.max += glm::max(predicted, glm::vec3(0.0f));
+    _nodes[handle].box = box;
+    insertLeaf(handle);
+    _stats.reinserts++;
+    return true;
+}
+
+void SpatialIndex::insertLeaf(int leaf)
+{
+    if (_root < 0)
+    {
+        _root = leaf;
+        _nodes[leaf].parent = -1;
+        return;
+    }
+
+    // Descend towards the sibling that adds the least surface area; pairing with the
+    // current node costs its combined area, every level walked through inherits the growth
+    const Aabb leafBox = _nodes[leaf].box;
+    int index = _root;
+    while (!isLeaf(index))
+    {
+        const Node &node = _nodes[index];
+        float area = SurfaceArea(node.box);
+        float combinedArea = SurfaceArea(Combine(node.box, leafBox));
+        float cost = 2.0f * combinedArea;
+        float inheritedCost = 2.0f * (combinedArea - area);
+
+        float childCosts[2];
+        const int children[2] = {node.child1, node.child2};
+        for (int i = 0; i < 2; i++)
+        {
+            const Node &child = _nodes[children[i]];
+            float childArea = SurfaceArea(Combine(leafBox, child.box));
+            childCosts[i] = (isLeaf(children[i]) ? childArea : childArea - SurfaceArea(child.box)) + inheritedCost;
+        }
+
+        if (cost < childCosts[0] && cost < childCosts[1])
+        {
+            break;
+        }
+        index = childCosts[0] < childCosts[1] ? children[0] : children[1];
+    }
+
+    const int sibling = index;
+    const int oldParent = _nodes[sibling].parent;
+    const int newParent = allocateNode(); // may reallocate _nodes, so no references are held across it
+    _nodes[newParent].parent = oldParent;
+    _nodes[newParent].box = Combine(leafBox, _nodes[sibling].box);
+    _nodes[newParent].height = _nodes[sibling].height + 1;
+    _nodes[newParent].child1 = sibling;
+    _nodes[newParent].child2 = leaf;
+    _nodes[sibling].parent = newParent;
+    _nodes[leaf].parent = newParent;
+    if (oldParent >= 0)
+    {
+        if (_nodes[oldParent].child1 == sibling)
+        {
+            _nodes[oldParent].child1 = newParent;
+        }
+        else
+        {
+            _nodes[oldParent].child2 = newParent;
+        }
+    }
+    else
+    {
+        _root = newParent;
+    }
+
+    refit(newParent);
+}
+
+void SpatialIndex::removeLeaf(int leaf)
+{
+    if (leaf == _root)
+    {
+        _root = -1;
+        return;
+    }
+
+    const int parent = _nodes[leaf].parent;
+    const int grandParent = _nodes[parent].parent;
+    const int sibling = _nodes[parent].child1 == leaf ? _nodes[parent].child2 : _nodes[parent].child1;
+    freeNode(parent);
+    if (grandParent >= 0)
+    {
+        if (_nodes[grandParent].child1 == parent)
+        {
+            _nodes[grandParent].child1 = sibling;
+        }
+        else
+        {
+            _nodes[grandParent].child2 = sibling;
+        }
+        _nodes[sibling].parent = grandParent;
+        refit(grandParent);
+    }
+    else
+    {
+        _root = sibling;
+        _nodes[sibling].parent = -1;
+    }
+}
+
+void SpatialIndex::refit(int index)
+{
+    while (index >= 0)
+    {
+        index = balance(index);
+        Node &node = _nodes[index];
+        const Node &child1 = _nodes[node.child1];
+        const Node &child2 = _nodes[node.child2];
+        node.height = 1 + std::max(child1.height, child2.height);
+        node.box = Combine(child1.box, child2.box);
+        index = node.parent;
+    }
+}
+
+// Rotates the taller child up when the heights of the children of A differ by more than one.
+// Returns the node now at A's place
+int SpatialIndex::balance(int iA)
+{
+    Node &a = _nodes[iA];
+    if (isLeaf(iA) || a.height < 2)
+    {
+        return iA;
+    }
+
+    const int iB = a.child1;
+    const int iC = a.child2;
+    Node &b = _nodes[iB];
+    Node &c = _nodes[iC];
+    const int difference = c.height - b.height;
+    if (difference >= -1 && difference <= 1)
+    {
+        return iA;
+    }
+
+    // The taller child takes A's place, A keeps the shorter child and the shorter grandchild
+    const bool promoteC = difference > 1;
+    const int iUp = promoteC ? iC : iB;
+    Node &up = promoteC ? c : b;
+    Node &kept = promoteC ? b : c;
+    const int iF = up.child1;
+    const int iG = up.child2;
+    Node &f = _nodes[iF];
+    Node &g = _nodes[iG];
+
+    up.child1 = iA;
+    up.parent = a.parent;
+    a.parent = iUp;
+    if (up.parent >= 0)
+    {
+        if (_nodes[up.parent].child1 == iA)
+        {
+            _nodes[up.parent].child1 = iUp;
+        }
+        else
+        {
+            _nodes[up.parent].child2 = iUp;
+        }
+    }
+    else
+    {
+        _root = iUp;
+    }
+
+    const bool keepF = f.height > g.height; // the taller grandchild stays with the promoted node
+    const int iTall = keepF ? iF : iG;
+    const int iShort = keepF ? iG : iF;
+    Node &tall = keepF ? f : g;
+    Node &shortNode = keepF ? g : f;
+
+    up.child2 = iTall;
+    if (promoteC)
+    {
+        a.child2 = iShort;
+    }
+    else
+    {
+        a.child1 = iShort;
+    }
+    shortNode.parent = iA;
+    a.box = Combine(kept.box, shortNode.box);
+    a.height = 1 + std::max(kept.height, shortNode.height);
+    up.box = Combine(a.box, tall.box);
+    up.height = 1 + std::max(a.height, tall.height);
+    return iUp;
+}
+
+void SpatialIndex::beginResults(size_t count, QueryResults &results)
+{
+    _hits.clear();
+    results.offsets.assign(count + 1, 0);
+}
+
+void SpatialIndex::endResults(size_t count, QueryResults &results)
+{
+    // Counting sort by query, keeping the traversal order within each query
+    for (const Hit &hit : _hits)
+    {
+        results.offsets[hit.query + 1]++;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        results.offsets[i + 1] += results.offsets[i];
+    }
+    results.items.resize(_hits.size());
+    for (const Hit &hit : _hits)
+    {
+        results.items[results.offsets[hit.query]++] = hit.userData;
+    }
+    // The scatter advanced every offset to the start of the next query
+    for (size_t i = count; i > 0; i--)
+    {
+        results.offsets[i] = results.offsets[i - 1];
+    }
+    results.offsets[0] = 0;
+}
+
+void SpatialIndex::queryFrusta(const Frustum *frusta, size_t count, QueryResults &results)
+{
+    beginResults(count, results);
+    struct Entry
+    {
+        int node;
+        uint32_t active; // queries the node may be visible to
+        uint32_t inside; // queries that contain the node completely, a subset of active
+    };
+    Entry stack[STACK_SIZE];
+
+    for (size_t first = 0; _root >= 0 && first < count; first += PACKET_SIZE)
+    {
+        const size_t packet = std::min(count - first, static_cast<size_t>(PACKET_SIZE));
+        const Frustum *queries = frusta + first;
+        int top = 0;
+        stack[top++] = {_root, packet == PACKET_SIZE ? ~0u : (1u << packet) - 1, 0u};
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node &node = _nodes[entry.node];
+            const bool leaf = isLeaf(entry.node);
+            for (uint32_t pending = entry.active & ~entry.inside; pending != 0; pending &= pending - 1)
+            {
+                const int query = LowestBit(pending);
+                const uint32_t bit = 1u << query;
+                _stats.nodeTests++;
+                if (leaf)
+                {
+                    if (!TestSphere(queries[query], node.sphere))
+                    {
+                        entry.active &= ~bit;
+                    }
+                    continue;
+                }
+                Containment containment = TestBox(queries[query], node.box);
+                if (containment == Containment::OUTSIDE)
+                {
+                    entry.active &= ~bit;
+                }
+                else if (containment == Containment::INSIDE)
+                {
+                    entry.inside |= bit;
+                }
+            }
+            if (entry.active == 0)
+            {
+                continue;
+            }
+            if (leaf)
+            {
+                for (uint32_t found = entry.active; found != 0; found &= found - 1)
+                {
+                    _hits.push_back({static_cast<uint32_t>(first + LowestBit(found)), node.userData});
+                }
+                continue;
+            }
+            assert(top + 2 <= STACK_SIZE);
+            stack[top++] = {node.child2, entry.active, entry.inside};
+            stack[top++] = {node.child1, entry.active, entry.inside};
+        }
+    }
+    endResults(count, results);
+}
+
+void SpatialIndex::querySpheres(const Sphere *spheres, size_t count, QueryResults &results)
+{
+    beginResults(count, results);
+    struct Entry
+    {
+        int node;
+        uint32_t active;
+    };
+    Entry stack[STACK_SIZE];
+
+    for (size_t first = 0; _root >= 0 && first < count; first += PACKET_SIZE)
+    {
+        const size_t packet = std::min(count - first, static_cast<size_t>(PACKET_SIZE));
+        const Sphere *queries = spheres + first;
+        int top = 0;
+        stack[top++] = {_root, packet == PACKET_SIZE ? ~0u : (1u << packet) - 1};
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node &node = _nodes[entry.node];
+            const bool leaf = isLeaf(entry.node);
+            for (uint32_t pending = entry.active; pending != 0; pending &= pending - 1)
+            {
+                const int query = LowestBit(pending);
+                _stats.nodeTests++;
+                if (leaf ? !Overlaps(queries[query], node.sphere) : !Overlaps(queries[query], node.box))
+                {
+                    entry.active &= ~(1u << query);
+                }
+            }
+            if (entry.active == 0)
+            {
+                continue;
+            }
+            if (leaf)
+            {
+                for (uint32_t found = entry.active; found != 0; found &= found - 1)
+                {
+                    _hits.push_back({static_cast<uint32_t>(first + LowestBit(found)), node.userData});
+                }
+                continue;
+            }
+            assert(top + 2 <= STACK_SIZE);
+            stack[top++] = {node.child2, entry.active};
+            stack[top++] = {node.child1, entry.active};
+        }
+    }
+    endResults(count, results);
+}
+
+void SpatialIndex::raycast(const Ray *rays, size_t count, RayHit *hits)
+{
+    struct Entry
+    {
+        int node;
+        uint32_t active;
+    };
+    Entry stack[STACK_SIZE];
+    glm::vec3 inverseDirections[PACKET_SIZE];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        hits[i] = {-1, 0, rays[i].maxDistance};
+    }
+
+    for (size_t first = 0; _root >= 0 && first < count; first += PACKET_SIZE)
+    {
+        const size_t packet = std::min(count - first, static_cast<size_t>(PACKET_SIZE));
+        const Ray *queries = rays + first;
+        RayHit *closest = hits + first;
+        for (size_t i = 0; i < packet; i++)
+        {
+            // Division by zero gives infinities, which the slab test handles
+            inverseDirections[i] = glm::vec3(1.0f / queries[i].direction.x, 1.0f / queries[i].direction.y, 1.0f / queries[i].direction.z);
+        }
+
+        int top = 0;
+        stack[top++] = {_root, packet == PACKET_SIZE ? ~0u : (1u << packet) - 1};
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node &node = _nodes[entry.node];
+            const bool leaf = isLeaf(entry.node);
+            for (uint32_t pending = entry.active; pending != 0; pending &= pending - 1)
+            {
+                const int query = LowestBit(pending);
+                _stats.nodeTests++;
+                if (leaf)
+                {
+                    float distance = Intersects(queries[query], node.sphere);
+                    if (distance >= 0.0f && distance < closest[query].distance)
+                    {
+                        closest[query] = {entry.node, node.userData, distance};
+                    }
+                }
+                else if (!Intersects(queries[query].origin, inverseDirections[query], closest[query].distance, node.box))
+                {
+                    entry.active &= ~(1u << query);
+                }
+            }
+            if (leaf || entry.active == 0)
+            {
+                continue;
+            }
+
+            // Visit the child nearer to the first active ray first, so its hit shortens the others
+            const Ray &lead = queries[LowestBit(entry.active)];
+            const Aabb &box1 = _nodes[node.child1].box;
+            const Aabb &box2 = _nodes[node.child2].box;
+            glm::vec3 d1 = (box1.min + box1.max) * 0.5f - lead.origin;
+            glm::vec3 d2 = (box2.min + box2.max) * 0.5f - lead.origin;
+            const bool firstNearer = glm::dot(d1, d1) <= glm::dot(d2, d2);
+            assert(top + 2 <= STACK_SIZE);
+            stack[top++] = {firstNearer ? node.child2 : node.child1, entry.active};
+            stack[top++] = {firstNearer ? node.child1 : node.child2, entry.active};
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+struct Aabb
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct Sphere
+{
+    glm::vec3 center;
+    float radius;
+};
+
+// Planes point inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all six
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    // Left, right, bottom, top, near and far planes of projection * view
+    static Frustum fromMatrix(const glm::mat4 &viewProjection);
+};
+
+struct Ray
+{
+    glm::vec3 origin;
+    glm::vec3 direction; // normalized
+    float maxDistance;
+};
+
+struct RayHit
+{
+    int handle; // -1 when nothing was hit
+    uint32_t userData;
+    float distance;
+};
+
+// Results of a batch of queries, laid out back to back: the user data of everything found
+// by query i is items[offsets[i]] to items[offsets[i + 1] - 1]. Reuse one instance so
+// repeated queries stop allocating.
+struct QueryResults
+{
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> items;
+
+    size_t size(size_t query) const { return offsets[query + 1] - offsets[query]; }
+    const uint32_t *begin(size_t query) const { return items.data() + offsets[query]; }
+    const uint32_t *end(size_t query) const { return items.data() + offsets[query + 1]; }
+};
+
+struct SpatialStats
+{
+    unsigned long long inserts;
+    unsigned long long moves;
+    unsigned long long reinserts; // moves that left the enlarged box and changed the tree
+    unsigned long long nodeTests; // bounding volume tests done by queries
+};
+
+// Dynamic AABB tree over bounding spheres, for culling and picking in scenes with many
+// entities. Leaves store an enlarged box (MARGIN plus the predicted motion), so a moving
+// entity only changes the tree when it leaves that box; otherwise move() just updates
+// the leaf sphere. Insertion picks the sibling by surface area cost and the tree is kept
+// balanced with AVL rotations, which bounds the height to about 1.44 log2(N).
+//
+// Queries are batched: up to 32 frusta, spheres or rays share one traversal, each node is
+// tested only against the queries whose parent tests passed, and frusta that contain a
+// node completely skip the tests for its subtree. Leaves are tested against the exact
+// sphere. Handles stay valid until remove().
+class SpatialIndex
+{
+public:
+    static constexpr float MARGIN = 1.0f;            // world units added around every leaf
+    static constexpr float MOTION_PREDICTION = 8.0f; // leaf boxes cover this many moves ahead
+    static constexpr int PACKET_SIZE = 32;           // queries per traversal
+
+    SpatialIndex();
+
+    int insert(const Sphere &bounds, uint32_t userData);
+    void remove(int handle);
+    // Returns true when the leaf had to be reinserted
+    bool move(int handle, const Sphere &bounds);
+    const Sphere &getBounds(int handle) const { return _nodes[handle].sphere; }
+    uint32_t getUserData(int handle) const { return _nodes[handle].userData; }
+
+    void queryFrusta(const Frustum *frusta, size_t count, QueryResults &results);
+    void querySpheres(const Sphere *spheres, size_t count, QueryResults &results);
+    // Closest hit per ray
+    void raycast(const Ray *rays, size_t count, RayHit *hits);
+
+    int getCount() const { return _leafCount; }
+    int getHeight() const { return _root < 0 ? 0 : _nodes[_root].height; }
+    const SpatialStats &getStats() const { return _stats; }
+
+private:
+    struct Node
+    {
+        Aabb box;       // enlarged for leaves
+        Sphere sphere;  // leaves only
+        int parent;     // next free node while on the free list
+        int child1;     // -1 for leaves
+        int child2;
+        int height;     // 0 for leaves, -1 while free
+        uint32_t userData;
+    };
+
+    bool isLeaf(int node) const { return _nodes[node].child1 < 0; }
+    int allocateNode();
+    void freeNode(int node);
+    void insertLeaf(int leaf);
+    void removeLeaf(int leaf);
+    int balance(int node);
+    void refit(int node);
+
+    // Collects (query, user data) pairs of a packet and sorts them into `results`
+    void beginResults(size_t count, QueryResults &results);
+    void endResults(size_t count, QueryResults &results);
+
+    std::vector<Node> _nodes;
+    int _root;
+    int _freeList;
+    int _leafCount;
+    SpatialStats _stats;
+
+    struct Hit
+    {
+        uint32_t query;
+        uint32_t userData;
+    };
+    std::vector<Hit> _hits; // reused between queries
+};
@@ -0,0 +1,214 @@
+#include "StreamBuffer.h"
+#include "MemoryTracker.h"
+#include <iostream>
+
+namespace
+{
+    // How long beginFrame() waits for the GPU per attempt before trying again
+    constexpr GLuint64 FENCE_TIMEOUT_NS = 1000000; // 1 ms
+
+    const char *const MEMORY_ASSET = "GpuRingBuffer";
+}
+
+GpuRingBuffer::GpuRingBuffer()
+    : _target(GL_ARRAY_BUFFER),
+      _buffer(0),
+      _frameSize(0),
+      _frame(0),
+      _writeOffset(0),
+      _mapped(nullptr),
+      _fences{}
+{
+}
+
+GpuRingBuffer::~GpuRingBuffer()
+{
+    release();
+}
+
+void GpuRingBuffer::release()
+{
+    for (GLsync &fence : _fences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+        }
+    }
+
+    if (_mapped)
+    {
+        glBindBuffer(_target, _buffer);
+        glUnmapBuffer(_target);
+        glBindBuffer(_target, 0);
+    }
+    MemoryTracker &memory = MemoryTracker::global();
+    memory.untrackBuffer(_buffer);
+    memory.release(MemoryTracker::STREAM, MEMORY_ASSET, MemoryTracker::CPU, _staging.capacity());
+    glDeleteBuffers(1, &_buffer);
+    _buffer = 0;
+    _mapped = nullptr;
+    std::vector<unsigned char>().swap(_staging);
+}
+
+bool GpuRingBuffer::init(GLenum target, GLsizeiptr bytesPerFrame, bool allowPersistent)
+{
+    _target = target;
+    _frameSize = bytesPerFrame;
+
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(_target, _buffer);
+
+    if (allowPersistent && GLEW_ARB_buffer_storage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        // Errors left by earlier calls would be taken for a storage failure
+        while (glGetError() != GL_NO_ERROR)
+        {
+        }
+        glBufferStorage(_target, _frameSize * FRAME_COUNT, nullptr, flags);
+        if (glGetError() != GL_NO_ERROR)
+        {
+            std::cerr << "Error: Could not allocate persistent stream buffer storage" << std::endl;
+            glBindBuffer(_target, 0);
+            release();
+            return false;
+        }
+        MemoryTracker::global().trackBuffer(_buffer, _frameSize * FRAME_COUNT, MemoryTracker::STREAM, MEMORY_ASSET);
+        _mapped = static_cast<unsigned char *>(glMapBufferRange(_target, 0, _frameSize * FRAME_COUNT, flags));
+        if (!_mapped)
+        {
+            std::cerr << "Error: Could not map persistent stream buffer" << std::endl;
+            glBindBuffer(_target, 0);
+            release();
+            return false;
+        }
+    }
+    else
+    {
+        // GL 3.3 path, the whole buffer is orphaned every frame
+        glBufferData(_target, _frameSize, nullptr, GL_STREAM_DRAW);
+        _staging.resize(_frameSize);
+        MemoryTracker::global().trackBuffer(_buffer, _frameSize, MemoryTracker::STREAM, MEMORY_ASSET);
+        MemoryTracker::global().allocate(MemoryTracker::STREAM, MEMORY_ASSET, MemoryTracker::CPU, _staging.capacity());
+    }
+
+    glBindBuffer(_target, 0);
+    return true;
+}
+
+void GpuRingBuffer::beginFrame()
+{
+    _frame = (_frame + 1) % FRAME_COUNT;
+    _writeOffset.store(0, std::memory_order_relaxed);
+
+    // Don't write into a region the GPU may still be reading
+    GLsync &fence = _fences[_frame];
+    if (fence)
+    {
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+        while (result == GL_TIMEOUT_EXPIRED)
+        {
+            result = glClientWaitSync(fence, 0, FENCE_TIMEOUT_NS);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+void *GpuRingBuffer::allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset)
+{
+    GLsizeiptr current = _writeOffset.load(std::memory_order_relaxed);
+    GLsizeiptr aligned;
+    do
+    {
+        aligned = (current + alignment - 1) / alignment * alignment;
+        if (aligned + size > _frameSize)
+        {
+            return nullptr;
+        }
+    } while (!_writeOffset.compare_exchange_weak(current, aligned + size, std::memory_order_relaxed));
+
+    offset = getFrameOffset() + aligned;
+    return isPersistent() ? _mapped + offset : _staging.data() + aligned;
+}
+
+void GpuRingBuffer::flush()
+{
+    if (isPersistent())
+    {
+        // Coherent mapping, the writes are visible to the next draw call
+        return;
+    }
+
+    GLsizeiptr used = getUsedBytes();
+    glBindBuffer(_target, _buffer);
+    glBufferData(_target, _frameSize, nullptr, GL_STREAM_DRAW); // orphan
+    if (used > 0)
+    {
+        glBufferSubData(_target, 0, used, _staging.data());
+    }
+    glBindBuffer(_target, 0);
+}
+
+void GpuRingBuffer::endFrame()
+{
+    if (isPersistent())
+    {
+        _fences[_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+bool IndirectDrawBuffer::isSupported()
+{
+    return GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+}
+
+IndirectDrawBuffer::IndirectDrawBuffer()
+    : _commandCount(0),
+      _drawCallCount(0)
+{
+}
+
+bool IndirectDrawBuffer::init(GLsizei maxDrawsPerFrame)
+{
+    if (!isSupported())
+    {
+        std::cerr << "Error: Multi-draw indirect needs ARB_multi_draw_indirect and ARB_base_instance" << std::endl;
+        return false;
+    }
+    return _ring.init(GL_DRAW_INDIRECT_BUFFER, maxDrawsPerFrame * static_cast<GLsizeiptr>(sizeof(DrawElementsIndirectCommand)));
+}
+
+void IndirectDrawBuffer::beginFrame()
+{
+    _ring.beginFrame();
+    _commandCount = 0;
+    _drawCallCount = 0;
+}
+
+DrawElementsIndirectCommand *IndirectDrawBuffer::allocate(GLsizei count, GLintptr &offset)
+{
+    // Aligned to whole commands, so the ones of one allocation are tightly packed
+    const GLsizeiptr size = count * static_cast<GLsizeiptr>(sizeof(DrawElementsIndirectCommand));
+    return static_cast<DrawElementsIndirectCommand *>(_ring.allocate(size, sizeof(DrawElementsIndirectCommand), offset));
+}
+
+void IndirectDrawBuffer::flush()
+{
+    _ring.flush();
+}
+
+void IndirectDrawBuffer::draw(GLenum mode, GLenum indexType, GLintptr offset, GLsizei count)
+{
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _ring.getBuffer());
+    glMultiDrawElementsIndirect(mode, indexType, (GLvoid *)(offset), count, sizeof(DrawElementsIndirectCommand));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    _commandCount += count;
+    _drawCallCount++;
+}
+
+void IndirectDrawBuffer::endFrame()
+{
+    _ring.endFrame();
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "GL/glew.h"
+
+#include <atomic>
+#include <vector>
+
+// Layout mandated by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Triple-buffered ring for data that is rewritten every frame (the instance data and draw
+// commands of Md2::DrawCrowd). With ARB_buffer_storage the buffer is persistently mapped and every
+// frame region is protected by a fence. On plain GL 3.3 writes go to a CPU staging copy
+// that is uploaded with buffer orphaning in flush(); draws issued before a later flush keep
+// the storage they were issued with.
+//
+// Frame protocol: beginFrame() -> allocate() from any thread -> flush() -> draw -> endFrame(),
+// with allocate/flush/draw repeated as often as needed within the frame
+class GpuRingBuffer
+{
+public:
+    static constexpr int FRAME_COUNT = 3;
+
+    GpuRingBuffer();
+    ~GpuRingBuffer();
+
+    bool init(GLenum target, GLsizeiptr bytesPerFrame, bool allowPersistent = true);
+    void beginFrame();
+    // Thread safe. Returns nullptr when the frame region is full. `offset` is the
+    // byte offset inside the GL buffer to use for attribute pointers or draw calls.
+    void *allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset);
+    void flush();
+    void endFrame();
+
+    GLuint getBuffer() const { return _buffer; }
+    GLenum getTarget() const { return _target; }
+    bool isPersistent() const { return _mapped != nullptr; }
+    GLsizeiptr getUsedBytes() const { return _writeOffset.load(std::memory_order_relaxed); }
+    // Start of the current frame's region inside the GL buffer
+    GLintptr getFrameOffset() const { return isPersistent() ? _frame * _frameSize : 0; }
+
+private:
+    GpuRingBuffer(const GpuRingBuffer &rhs) = delete;
+    GpuRingBuffer &operator=(const GpuRingBuffer &rhs) = delete;
+
+    // Deletes the GL buffer, fences and staging copy; also undoes a failed init()
+    void release();
+
+    GLenum _target;
+    GLuint _buffer;
+    GLsizeiptr _frameSize;
+    int _frame;
+    std::atomic<GLsizeiptr> _writeOffset;
+    unsigned char *_mapped;
+    std::vector<unsigned char> _staging;
+    GLsync _fences[FRAME_COUNT];
+};
+
+// Draw commands for glMultiDrawElementsIndirect, in a GpuRingBuffer on GL_DRAW_INDIRECT_BUFFER.
+// The baseInstance of a command offsets the instance attributes, so besides
+// ARB_multi_draw_indirect this needs ARB_base_instance; without them isSupported() is false
+// and callers keep one draw per command.
+//
+// Frame protocol as for GpuRingBuffer: beginFrame() -> allocate() -> flush() -> draw() -> endFrame()
+class IndirectDrawBuffer
+{
+public:
+    static bool isSupported();
+
+    IndirectDrawBuffer();
+
+    bool init(GLsizei maxDrawsPerFrame);
+    void beginFrame();
+    // Thread safe. Room for `count` consecutive commands, nullptr when the frame is full.
+    // `offset` is the byte offset of the first one inside the GL buffer, for draw().
+    DrawElementsIndirectCommand *allocate(GLsizei count, GLintptr &offset);
+    void flush();
+    // One glMultiDrawElementsIndirect over `count` commands starting at `offset`. The VAO with
+    // the index buffer and the instance attributes has to be bound.
+    void draw(GLenum mode, GLenum indexType, GLintptr offset, GLsizei count);
+    void endFrame();
+
+    bool isPersistent() const { return _ring.isPersistent(); }
+    GLsizeiptr getUsedBytes() const { return _ring.getUsedBytes(); }
+    // Since beginFrame()
+    GLsizei getCommandCount() const { return _commandCount; }
+    GLsizei getDrawCallCount() const { return _drawCallCount; }
+
+private:
+    GpuRingBuffer _ring;
+    GLsizei _commandCount;
+    GLsizei _drawCallCount;
+};
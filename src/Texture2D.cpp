@@ -2,6 +2,14 @@
 #include <iostream>
 #include <cassert>
 #include "TgaLoader.h"
+#include "MemoryTracker.h"
+#include "Arena.h"
+
+namespace
+{
+    // Drivers pad GL_RGB8 to four bytes per texel
+    constexpr size_t BYTES_PER_TEXEL = 4;
+}
 
 Texture2D::Texture2D()
     : mTexture(0)
@@ -10,19 +18,35 @@ Texture2D::Texture2D()
 
 Texture2D::~Texture2D()
 {
+    MemoryTracker::global().untrackTexture(mTexture);
     glDeleteTextures(1, &mTexture);
 }
 
 bool Texture2D::loadTexture(const string &fileName, bool generateMipMaps)
 {
     unsigned short width, height;
-    std::vector<unsigned char> imageData;
-    
-    if (!LoadTGA(fileName.c_str(), imageData, width, height))
+    unsigned char *imageData = nullptr;
+    size_t imageSize = 0;
+
+    // The pixels are released as soon as they are uploaded
+    ArenaScope scope(LinearArena::loadArena());
+    if (!LoadTGA(fileName.c_str(), scope.arena(), imageData, imageSize, width, height))
     {
         std::cerr << "Error loading texture '" << fileName << "'" << std::endl;
         return false;
     }
+    MemoryTracker::Transient imageMemory(MemoryTracker::TEXTURE, fileName, imageSize);
+
+    // A full mipmap chain adds a third of the base level
+    size_t textureBytes = static_cast<size_t>(width) * height * BYTES_PER_TEXEL;
+    if (generateMipMaps)
+    {
+        textureBytes += textureBytes / 3;
+    }
+    if (!MemoryTracker::global().fitsBudget(MemoryTracker::TEXTURE, MemoryTracker::GPU_TEXTURE, textureBytes, fileName))
+    {
+        return false;
+    }
 
     glGenTextures(1, &mTexture);
     glBindTexture(GL_TEXTURE_2D, mTexture);
@@ -34,12 +58,13 @@ bool Texture2D::loadTexture(const string &fileName, bool generateMipMaps)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // TGA files are in BGR format
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, imageData.data());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, imageData);
 
     if (generateMipMaps)
     {
         glGenerateMipmap(GL_TEXTURE_2D);
     }
+    MemoryTracker::global().trackTexture(mTexture, textureBytes, MemoryTracker::TEXTURE, fileName);
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
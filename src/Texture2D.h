@@ -12,6 +12,7 @@ public:
 
     bool loadTexture(const string& fileName, bool generateMipMaps = true);
     void bind(GLuint texUnit = 0);
+    GLuint getTexture() const { return mTexture; }
 
 private:
     Texture2D(const Texture2D& rhs) = default;
@@ -1,88 +1,152 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include "TgaLoader.h"
+#include "Arena.h"
 #include <cstring>
 
 constexpr int SIGNATURE_SIZE = 12;
 constexpr int BITS_PER_BYTE = 8;
+constexpr unsigned char ALPHA_BITS_MASK = 0x0F; // image descriptor bits 0-3
+constexpr unsigned char TOP_LEFT_ORIGIN = 0x20;  // image descriptor bit 5
 
-bool LoadTGA(const char *filename, std::vector<unsigned char> &data, unsigned short &width, unsigned short &height)
+namespace
 {
-    std::ifstream file(filename, std::ios::binary);
-
-    if (!file.is_open())
+    // `allocate(size)` returns where the pixels go, so both overloads share the parser
+    template <typename Allocate>
+    bool ReadTGA(const char *filename, Allocate allocate, unsigned char *&data, size_t &dataSize, unsigned short &width, unsigned short &height)
     {
-        std::cerr << "Could not open file " << filename << "." << std::endl;
-        return false;
-    }
+        std::ifstream file(filename, std::ios::binary);
 
-    // Read and validate TGA signature
-    constexpr unsigned char CORRECT_SIGNATURE[] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    unsigned char signature[SIGNATURE_SIZE];
+        if (!file.is_open())
+        {
+            std::cerr << "Could not open file " << filename << "." << std::endl;
+            return false;
+        }
 
-    file.read(reinterpret_cast<char *>(signature), SIGNATURE_SIZE);
+        // Read and validate TGA signature
+        constexpr unsigned char CORRECT_SIGNATURE[] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        unsigned char signature[SIGNATURE_SIZE];
 
-    if (!file || memcmp(signature, CORRECT_SIGNATURE, SIGNATURE_SIZE) != 0)
-    {
-        std::cerr << filename << " is an invalid TGA file." << std::endl;
-        return false;
-    }
+        file.read(reinterpret_cast<char *>(signature), SIGNATURE_SIZE);
 
-    // Read image dimensions and bits per pixel
-    unsigned short bpp; // bits per pixel
-    unsigned char imageDescriptor;
+        if (!file || memcmp(signature, CORRECT_SIGNATURE, SIGNATURE_SIZE) != 0)
+        {
+            std::cerr << filename << " is an invalid TGA file." << std::endl;
+            return false;
+        }
 
-    file.read(reinterpret_cast<char *>(&width), sizeof(unsigned short));
-    file.read(reinterpret_cast<char *>(&height), sizeof(unsigned short));
-    file.read(reinterpret_cast<char *>(&bpp), sizeof(unsigned char));             // bpp is 1 byte in TGA format
-    file.read(reinterpret_cast<char *>(&imageDescriptor), sizeof(unsigned char)); // Read image descriptor
+        // Read image dimensions and bits per pixel
+        unsigned short bpp = 0; // bits per pixel, only the low byte is read from the file
+        unsigned char imageDescriptor;
 
-    if (!file)
-    {
-        std::cerr << "Could not read TGA header data." << std::endl;
-        return false;
-    }
+        file.read(reinterpret_cast<char *>(&width), sizeof(unsigned short));
+        file.read(reinterpret_cast<char *>(&height), sizeof(unsigned short));
+        file.read(reinterpret_cast<char *>(&bpp), sizeof(unsigned char));             // bpp is 1 byte in TGA format
+        file.read(reinterpret_cast<char *>(&imageDescriptor), sizeof(unsigned char)); // Read image descriptor
+
+        if (!file)
+        {
+            std::cerr << "Could not read TGA header data." << std::endl;
+            return false;
+        }
+
+        bpp /= BITS_PER_BYTE; // Convert bits per pixel to bytes per pixel
+
+        // Allocate memory for pixel data
+        unsigned int dataLength = width * height * bpp;
+        data = allocate(dataLength);
+        dataSize = dataLength;
+
+        // Read pixel data
+        file.read(reinterpret_cast<char *>(data), dataLength);
+
+        // Check if we read the expected amount of data
+        if (file.gcount() != static_cast<std::streamsize>(dataLength))
+        {
+            std::cerr << "Could not read TGA pixel data. Expected " << dataLength
+                      << " bytes, got " << file.gcount() << " bytes." << std::endl;
+            return false;
+        }
 
-    bpp /= BITS_PER_BYTE; // Convert bits per pixel to bytes per pixel
+        // Bit 5 of image descriptor: 0 = origin at bottom-left, 1 = origin at top-left.
+        // The texture coordinates expect the top row first, so bottom-left images are flipped.
+        bool hasBottomLeftOrigin = (imageDescriptor & TOP_LEFT_ORIGIN) == 0;
 
-    // Allocate memory for pixel data using vector
-    unsigned int dataLength = width * height * bpp;
-    data.resize(dataLength);
+        if (hasBottomLeftOrigin)
+        {
+            // Flip the image vertically to convert bottom-left to top-left
+            unsigned int rowSize = width * bpp;
+
+            for (unsigned int y = 0; y < height / 2; ++y)
+            {
+                unsigned int topRowOffset = y * rowSize;
+                unsigned int bottomRowOffset = (height - 1 - y) * rowSize;
 
-    // Read pixel data
-    file.read(reinterpret_cast<char *>(data.data()), dataLength);
+                // Swap rows in place, no temporary row needed
+                std::swap_ranges(&data[topRowOffset], &data[topRowOffset] + rowSize, &data[bottomRowOffset]);
+            }
+        }
 
-    // Check if we read the expected amount of data
-    if (file.gcount() != static_cast<std::streamsize>(dataLength))
+        return true;
+    }
+}
+
+bool LoadTGA(const char *filename, std::vector<unsigned char> &data, unsigned short &width, unsigned short &height)
+{
+    unsigned char *pixels = nullptr;
+    size_t size = 0;
+    bool loaded = ReadTGA(filename, [&data](size_t length)
+                          {
+                              data.resize(length);
+                              return data.data(); },
+                          pixels, size, width, height);
+    if (!loaded)
     {
-        std::cerr << "Could not read TGA pixel data. Expected " << dataLength
-                  << " bytes, got " << file.gcount() << " bytes." << std::endl;
         data.clear();
-        return false;
     }
+    return loaded;
+}
 
-    // Check if image needs vertical flip based on origin
-    // Bit 5 of image descriptor: 0 = Origin at top-left (need flip), 1 = Origin at bottom-left (no flip needed for OpenGL)
-    bool hasTopLeftOrigin = (imageDescriptor & 0x20) == 0;
+bool LoadTGA(const char *filename, LinearArena &arena, unsigned char *&data, size_t &size, unsigned short &width, unsigned short &height)
+{
+    return ReadTGA(filename, [&arena](size_t length)
+                   { return arena.allocateArray<unsigned char>(length); },
+                   data, size, width, height);
+}
 
-    if (hasTopLeftOrigin)
+bool SaveTGA(const char *filename, const unsigned char *data, unsigned short width, unsigned short height, int bytesPerPixel, bool topRowFirst)
+{
+    if (bytesPerPixel != 3 && bytesPerPixel != 4)
     {
-        // Flip the image vertically to convert bottom-left to top-left for OpenGL
-        unsigned int rowSize = width * bpp;
-        std::vector<unsigned char> tempRow(rowSize);
-
-        for (unsigned int y = 0; y < height / 2; ++y)
-        {
-            unsigned int topRowOffset = y * rowSize;
-            unsigned int bottomRowOffset = (height - 1 - y) * rowSize;
+        std::cerr << "Cannot write " << bytesPerPixel * BITS_PER_BYTE << " bit TGA " << filename << "." << std::endl;
+        return false;
+    }
 
-            // Swap rows
-            std::memcpy(tempRow.data(), &data[topRowOffset], rowSize);
-            std::memcpy(&data[topRowOffset], &data[bottomRowOffset], rowSize);
-            std::memcpy(&data[bottomRowOffset], tempRow.data(), rowSize);
-        }
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not create file " << filename << "." << std::endl;
+        return false;
     }
 
+    // Same signature ReadTGA checks: uncompressed true color, no color map, origin 0,0
+    unsigned char header[SIGNATURE_SIZE + 6] = {0, 0, 2};
+    header[SIGNATURE_SIZE] = static_cast<unsigned char>(width & 0xFF);
+    header[SIGNATURE_SIZE + 1] = static_cast<unsigned char>(width >> 8);
+    header[SIGNATURE_SIZE + 2] = static_cast<unsigned char>(height & 0xFF);
+    header[SIGNATURE_SIZE + 3] = static_cast<unsigned char>(height >> 8);
+    header[SIGNATURE_SIZE + 4] = static_cast<unsigned char>(bytesPerPixel * BITS_PER_BYTE);
+    // Origin of the first row, plus the number of alpha bits
+    header[SIGNATURE_SIZE + 5] = static_cast<unsigned char>((topRowFirst ? TOP_LEFT_ORIGIN : 0) | (bytesPerPixel == 4 ? (BITS_PER_BYTE & ALPHA_BITS_MASK) : 0));
+
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(width) * height * bytesPerPixel);
+    if (!file)
+    {
+        std::cerr << "Could not write TGA pixel data to " << filename << "." << std::endl;
+        return false;
+    }
     return true;
 }
@@ -1,5 +1,17 @@
 #pragma once
 
+#include <cstddef>
 #include <vector>
 
+class LinearArena;
+
 bool LoadTGA(const char *filename, std::vector<unsigned char> &data, unsigned short &width, unsigned short &height);
+// Same, with the pixels allocated from `arena` (`size` bytes at `data`)
+bool LoadTGA(const char *filename, LinearArena &arena, unsigned char *&data, size_t &size, unsigned short &width, unsigned short &height);
+
+// LoadTGA returns the top row first, flipping files stored with a bottom-left origin.
+
+// Writes an uncompressed 24 or 32 bit TGA. `data` is BGR(A) with the bottom row first,
+// which is what glReadPixels returns with GL_BGR(A), unless `topRowFirst` is set; then
+// the file gets a top-left origin and LoadTGA reads back exactly `data` without a flip.
+bool SaveTGA(const char *filename, const unsigned char *data, unsigned short width, unsigned short height, int bytesPerPixel, bool topRowFirst = false);
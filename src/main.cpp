@@ -1,6 +1,16 @@
 #include "OpenGLHandler.h"
+#include <cstdio>
+#include <filesystem>
 #include <iostream>
 #include "Md2.h"
+#include "KeyframeResidency.h"
+#include "MemoryTracker.h"
+#include "Arena.h"
+#include "CommandList.h"
+#include "FrameCapture.h"
+#include "ShaderVariants.h"
+#include "ShaderWatcher.h"
+#include "StreamBuffer.h"
 
 // Animation constants
 namespace
@@ -8,6 +18,18 @@ namespace
     constexpr float MODEL_SCALE = 0.3f;
     constexpr float ROTATION_SPEED = 50.0f; // degrees per second
     constexpr float ANIMATION_VELOCITY = 5.0f;
+    constexpr const char *CAPTURE_DIRECTORY = "captures";
+
+    // F5 crowd behind the player, drawn with Md2::DrawCrowd
+    constexpr int CROWD_COLUMNS = 8;
+    constexpr int CROWD_ROWS = 6;
+    constexpr float CROWD_SPACING = 6.0f;
+    constexpr float CROWD_FRONT_Z = -40.0f;
+    // The crowd plays `stand` in a few phases one keyframe apart, so each phase is one
+    // instanced draw per LOD and only one clip is resident for it
+    constexpr int CROWD_CLIP_FIRST = 0;
+    constexpr int CROWD_CLIP_LAST = 39;
+    constexpr int CROWD_PHASES = 4;
 }
 
 void display(OpenGLHandler &openGL);
@@ -68,17 +90,25 @@ void display(OpenGLHandler &openGL)
 
     */
 
+    // Keyframes are uploaded per clip on first use and evicted least recently used first
+    // once the budget is reached, e.g. KeyframeResidency::Global().SetBudget(1024 * 1024)
+
     // Running animation frames (See the chart above to change animation)
     constexpr int startFrame = 0;
     constexpr int endFrame = 197;
 
+    // Every feature combination of shaders/basic.* the session toggles between (F3 for fog,
+    // F5 for the instanced crowd), compiled up front so switching never waits for the compiler
+    ShaderVariants basicShaders("shaders/basic.vert", "shaders/basic.frag");
+    basicShaders.precompile({0, FEATURE_FOG, FEATURE_INSTANCING, FEATURE_FOG | FEATURE_INSTANCING});
+
     // Uncomment the lines below one by one to load new models and textures
-    md2model::Md2 player("data/cyborg.md2", "data/cyborg1.tga");
-    // md2model::Md2 player("data/cyborg.md2", "data/cyborg2.tga");
-    // md2model::Md2 player("data/cyborg.md2", "data/cyborg3.tga");
-    // md2model::Md2 player("data/female.md2", "data/female.tga");
-    // md2model::Md2 player("data/grunt.md2", "data/grunt.tga");
-    // md2model::Md2 player("data/tris.md2", "data/tris.tga");
+    md2model::Md2 player("data/cyborg.md2", "data/cyborg1.tga", &basicShaders);
+    // md2model::Md2 player("data/cyborg.md2", "data/cyborg2.tga", &basicShaders);
+    // md2model::Md2 player("data/cyborg.md2", "data/cyborg3.tga", &basicShaders);
+    // md2model::Md2 player("data/female.md2", "data/female.tga", &basicShaders);
+    // md2model::Md2 player("data/grunt.md2", "data/grunt.tga", &basicShaders);
+    // md2model::Md2 player("data/tris.md2", "data/tris.tga", &basicShaders);
 
     if (!player.isValid())
     {
@@ -86,6 +116,34 @@ void display(OpenGLHandler &openGL)
         return;
     }
 
+    // The crowd's instance data is streamed through a ring, one region per frame in flight
+    std::vector<md2model::CrowdInstance> crowd;
+    for (int row = 0; row < CROWD_ROWS; row++)
+    {
+        for (int column = 0; column < CROWD_COLUMNS; column++)
+        {
+            crowd.push_back({glm::vec3(0.0f, (column - (CROWD_COLUMNS - 1) * 0.5f) * CROWD_SPACING, CROWD_FRONT_Z - row * CROWD_SPACING), 0.0f, startFrame, 0.0f});
+        }
+    }
+    GpuRingBuffer crowdRing;
+    if (!crowdRing.init(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(crowd.size()) * md2model::CROWD_INSTANCE_BYTES))
+    {
+        std::cerr << "Failed to create the crowd stream buffer" << std::endl;
+        return;
+    }
+    // With multi-draw indirect the crowd is one draw call per clip, on GL 3.3 one per frame and LOD
+    IndirectDrawBuffer crowdCommands;
+    const bool crowdMultiDraw = IndirectDrawBuffer::isSupported() && crowdCommands.init(static_cast<GLsizei>(crowd.size()));
+
+    // Saving shaders/basic.* while the program runs rebuilds every variant in the background
+    ShaderWatcher shaderWatcher;
+    shaderWatcher.watch(basicShaders);
+
+    // F4 writes every frame to captures/ without stalling the render loop
+    FrameCapture frameCapture;
+    unsigned int captureIndex = 0;
+    char captureFilename[FrameCapture::MAX_FILENAME];
+
     double lastTime = glfwGetTime();
     float angle = 0.0f;
 
@@ -103,9 +161,23 @@ void display(OpenGLHandler &openGL)
     // Create the projection matrix
     projection = glm::perspective(glm::radians(45.0f), (float)OpenGLHandler::getWindowWidth() / (float)OpenGLHandler::getWindowHeight(), 0.1f, 100.0f);
 
+    // The player is recorded into a command list and replayed into GL, the path worker
+    // threads would use; the list and the executor keep their capacity between frames
+    CommandList commandList;
+    const CommandList *commandLists[] = {&commandList};
+    CommandExecutor commandExecutor;
+    GlCommandBackend glBackend;
+
+    // Frames that upload nothing should not touch the heap. The FPS title is excluded,
+    // formatting it allocates a few times per second.
+    unsigned long long steadyFrames = 0;
+    unsigned long long steadyAllocations = 0;
+
     while (!glfwWindowShouldClose(openGL.getWindow()))
     {
         openGL.showFPS();
+        unsigned long long allocationsBefore = getHeapAllocationCount();
+        LinearArena::frameArena().reset();
         float currentTime = glfwGetTime();
         float deltaTime = currentTime - lastTime;
         lastTime = currentTime;
@@ -123,11 +195,60 @@ void display(OpenGLHandler &openGL)
 
         // Poll for and process events
         glfwPollEvents();
+        shaderWatcher.update();
+
+        md2model::KeyframeResidency::Global().BeginFrame();
 
         // Clear the screen
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        player.Draw(renderFrame, angle, interpolation, view, projection);
+        player.SetForcedLod(OpenGLHandler::getForcedLod());
+        player.SetShaderFeatures(OpenGLHandler::isFogEnabled() ? FEATURE_FOG : 0);
+        commandList.reset();
+        // The GPU time of the draw goes into the per-LOD report printed at exit
+        GLuint timerQuery = 0;
+        if (player.PrepareRecord(renderFrame, view, projection, &timerQuery))
+        {
+            player.RecordDraw(commandList, renderFrame, angle, interpolation, view, projection, timerQuery);
+        }
+        commandExecutor.execute(commandLists, 1, glBackend);
+        glBindVertexArray(0);
+
+        if (OpenGLHandler::isCrowdEnabled())
+        {
+            for (size_t i = 0; i < crowd.size(); i++)
+            {
+                crowd[i].angle = angle;
+                crowd[i].frame = CROWD_CLIP_FIRST + (renderFrame - startFrame + static_cast<int>(i) % CROWD_PHASES) % (CROWD_CLIP_LAST - CROWD_CLIP_FIRST + 1);
+                crowd[i].interpolation = interpolation;
+            }
+            crowdRing.beginFrame();
+            if (crowdMultiDraw)
+            {
+                crowdCommands.beginFrame();
+            }
+            player.DrawCrowd(crowd.data(), static_cast<int>(crowd.size()), view, projection, crowdRing, crowdMultiDraw ? &crowdCommands : nullptr);
+            crowdRing.endFrame();
+            if (crowdMultiDraw)
+            {
+                crowdCommands.endFrame();
+            }
+        }
+
+        if (OpenGLHandler::isCapturing())
+        {
+            const int width = OpenGLHandler::getWindowWidth();
+            const int height = OpenGLHandler::getWindowHeight();
+            if (frameCapture.getWidth() != width || frameCapture.getHeight() != height)
+            {
+                std::filesystem::create_directories(CAPTURE_DIRECTORY);
+                frameCapture.init(width, height);
+            }
+            std::snprintf(captureFilename, sizeof(captureFilename), "%s/frame_%05u.tga", CAPTURE_DIRECTORY, captureIndex++);
+            frameCapture.capture(captureFilename);
+        }
+        frameCapture.update();
+
         // Swap front and back buffers
         glfwSwapBuffers(openGL.getWindow());
 
@@ -137,5 +258,23 @@ void display(OpenGLHandler &openGL)
             renderFrame = renderFrame == endFrame ? startFrame : renderFrame + 1;
         }
         interpolation += ANIMATION_VELOCITY * deltaTime;
+
+        if (md2model::KeyframeResidency::Global().GetStats().uploadsThisFrame == 0)
+        {
+            steadyFrames++;
+            steadyAllocations += getHeapAllocationCount() - allocationsBefore;
+        }
+    }
+
+    if (frameCapture.isInitialized())
+    {
+        frameCapture.finish();
+        frameCapture.printReport();
     }
+    player.PrintLodReport();
+    std::cout << "Heap allocations per frame without uploads: "
+              << (steadyFrames > 0 ? static_cast<double>(steadyAllocations) / steadyFrames : 0.0)
+              << " (" << steadyFrames << " frames)" << std::endl;
+    md2model::KeyframeResidency::Global().PrintReport();
+    MemoryTracker::global().printReport();
 }
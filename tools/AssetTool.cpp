@@ -0,0 +1,387 @@
+// Batch asset validation and conversion. Run from the repository root:
+//
+//     bin/assettool.exe data build/data --threads=8
+//
+// Every .md2 and .tga file in the input directory is loaded and validated on a pool of
+// worker threads. Models get cache and overdraw optimized triangle order and simplified
+// LOD levels (<name>_lod<N>.md2); frame and skin names are kept, the GL commands are
+// rebuilt as strips, and every output is reloaded and compared with the input. TGAs are
+// normalized (uncompressed, top-left origin, which LoadTGA reads without flipping). A
+// per-file report is printed and written as report.csv next to the converted assets.
+// The exit code is non-zero when any file failed.
+#include "../src/Arena.h"
+#include "../src/Md2.h"
+#include "../src/MeshOptimizer.h"
+#include "../src/MeshSimplifier.h"
+#include "../src/TgaLoader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    struct FileReport
+    {
+        fs::path input;
+        bool ok;
+        std::string message; // first error, or warnings
+        double loadMilliseconds;
+        double processMilliseconds;
+        uintmax_t bytesBefore;
+        uintmax_t bytesAfter; // of the converted file, LOD files are not included
+        int triangles;
+        int frames;
+        int vertices;
+        std::vector<int> lodTriangles;
+        float acmrBefore;
+        float acmrAfter;
+    };
+
+    std::string LowerExtension(const fs::path &path)
+    {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        return extension;
+    }
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void AddMessage(FileReport &report, const std::string &message)
+    {
+        report.message += report.message.empty() ? message : "; " + message;
+    }
+
+    // Runs on the workers, where an exception would terminate the whole batch
+    bool FileSize(const fs::path &path, uintmax_t &size, FileReport &report)
+    {
+        std::error_code error;
+        size = fs::file_size(path, error);
+        if (error)
+        {
+            size = 0;
+            AddMessage(report, "could not stat " + path.filename().string() + ": " + error.message());
+            return false;
+        }
+        return true;
+    }
+
+    // Triangles in the order Md2::OptimizeIndices would draw them
+    std::vector<md2model::mesh> OptimizeTriangles(const md2model::modData &model, const std::vector<md2model::mesh> &triangles, md2model::CacheStats &before, md2model::CacheStats &after)
+    {
+        using namespace md2model;
+        std::vector<wedge> wedges = BuildWedges(triangles);
+        const int wedgeCount = static_cast<int>(wedges.size());
+        std::vector<glm::vec3> averagePositions(wedgeCount, glm::vec3(0.0f));
+        for (int i = 0; i < wedgeCount; i++)
+        {
+            for (int f = 0; f < model.numFrames; f++)
+            {
+                const float *point = model.pointList[static_cast<size_t>(model.numPoints) * f + wedges[i].meshIndex].point;
+                averagePositions[i] += glm::vec3(point[0], point[1], point[2]);
+            }
+            averagePositions[i] = averagePositions[i] / static_cast<float>(model.numFrames);
+        }
+
+        std::vector<unsigned short> indices = BuildIndices(triangles, wedges);
+        before = SimulateVertexCache(indices, wedgeCount);
+        OptimizeVertexCache(indices, wedgeCount);
+        OptimizeOverdraw(indices, averagePositions);
+        after = SimulateVertexCache(indices, wedgeCount);
+
+        std::vector<mesh> optimized(triangles.size());
+        for (size_t t = 0; t < optimized.size(); t++)
+        {
+            for (int k = 0; k < VERTICES_PER_TRIANGLE; k++)
+            {
+                const wedge &corner = wedges[indices[t * VERTICES_PER_TRIANGLE + k]];
+                optimized[t].meshIndex[k] = corner.meshIndex;
+                optimized[t].stIndex[k] = corner.stIndex;
+            }
+        }
+        return optimized;
+    }
+
+    // The loader already rejects counts, offsets and indices that do not fit the file
+    bool ValidateModel(const md2model::modData &model, FileReport &report)
+    {
+        int degenerate = 0;
+        for (const md2model::mesh &triangle : model.triIndx)
+        {
+            if (triangle.meshIndex[0] == triangle.meshIndex[1] || triangle.meshIndex[1] == triangle.meshIndex[2] || triangle.meshIndex[0] == triangle.meshIndex[2])
+            {
+                degenerate++;
+            }
+        }
+        if (model.triIndx.empty() || model.numPoints == 0)
+        {
+            AddMessage(report, "no geometry");
+            return false;
+        }
+        if (model.twidth <= 0 || model.theight <= 0)
+        {
+            AddMessage(report, "invalid skin size");
+            return false;
+        }
+        if (degenerate > 0)
+        {
+            AddMessage(report, std::to_string(degenerate) + " degenerate triangles");
+        }
+        return true;
+    }
+
+    // The converted file has to be a drop-in replacement: same frame and skin names, and
+    // the same counts apart from the triangles of a LOD
+    bool CheckReloaded(const md2model::modData &input, const fs::path &output, size_t triangleCount, FileReport &report)
+    {
+        std::unique_ptr<md2model::modData> reloaded = md2model::LoadModelData(output.string().c_str());
+        std::string name = output.filename().string();
+        if (!reloaded)
+        {
+            AddMessage(report, name + " does not load");
+            return false;
+        }
+        if (reloaded->numFrames != input.numFrames || reloaded->numPoints != input.numPoints || reloaded->numST != input.numST ||
+            reloaded->numSkins != input.numSkins || reloaded->numTriangles != static_cast<int>(triangleCount) || reloaded->clips.size() != input.clips.size())
+        {
+            AddMessage(report, name + " has different counts");
+            return false;
+        }
+        if (reloaded->frameNames != input.frameNames || reloaded->skinNames != input.skinNames)
+        {
+            AddMessage(report, name + " has different frame or skin names");
+            return false;
+        }
+        if (reloaded->numGLCommands == 0)
+        {
+            AddMessage(report, name + " has no GL commands");
+            return false;
+        }
+        return true;
+    }
+
+    void ProcessModel(const fs::path &input, const fs::path &outputDirectory, FileReport &report)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<md2model::modData> model = md2model::LoadModelData(input.string().c_str());
+        report.loadMilliseconds = MillisecondsSince(start);
+        if (!model)
+        {
+            AddMessage(report, "could not be loaded");
+            return;
+        }
+        report.triangles = model->numTriangles;
+        report.frames = model->numFrames;
+        report.vertices = model->numPoints;
+        if (!ValidateModel(*model, report))
+        {
+            return;
+        }
+
+        start = std::chrono::steady_clock::now();
+        md2model::MeshSimplifier simplifier(*model);
+        std::vector<md2model::LodLevel> levels = simplifier.BuildLods(md2model::LOD_LEVELS, md2model::LOD_REDUCTION_RATIO);
+        for (size_t lod = 0; lod < levels.size(); lod++)
+        {
+            md2model::CacheStats before, after;
+            std::vector<md2model::mesh> triangles = OptimizeTriangles(*model, levels[lod].triangles, before, after);
+            if (lod == 0)
+            {
+                report.acmrBefore = before.acmr;
+                report.acmrAfter = after.acmr;
+            }
+            report.lodTriangles.push_back(static_cast<int>(triangles.size()));
+
+            std::string name = input.stem().string() + (lod == 0 ? "" : "_lod" + std::to_string(lod)) + ".md2";
+            fs::path output = outputDirectory / name;
+            if (!md2model::SaveModelData(output.string().c_str(), *model, triangles))
+            {
+                AddMessage(report, "could not write " + name);
+                return;
+            }
+            if (!CheckReloaded(*model, output, triangles.size(), report))
+            {
+                return;
+            }
+            if (lod == 0 && !FileSize(output, report.bytesAfter, report))
+            {
+                return;
+            }
+        }
+        report.processMilliseconds = MillisecondsSince(start);
+        report.ok = true;
+    }
+
+    void ProcessTexture(const fs::path &input, const fs::path &outputDirectory, FileReport &report)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<unsigned char> pixels;
+        unsigned short width = 0, height = 0;
+        bool loaded = LoadTGA(input.string().c_str(), pixels, width, height);
+        report.loadMilliseconds = MillisecondsSince(start);
+        if (!loaded || width == 0 || height == 0)
+        {
+            AddMessage(report, "could not be loaded");
+            return;
+        }
+        const int bytesPerPixel = static_cast<int>(pixels.size() / (static_cast<size_t>(width) * height));
+        if ((width & (width - 1)) != 0 || (height & (height - 1)) != 0)
+        {
+            AddMessage(report, "not a power of two");
+        }
+
+        start = std::chrono::steady_clock::now();
+        fs::path output = outputDirectory / input.filename();
+        if (!SaveTGA(output.string().c_str(), pixels.data(), width, height, bytesPerPixel, true))
+        {
+            AddMessage(report, "could not be written");
+            return;
+        }
+        report.processMilliseconds = MillisecondsSince(start);
+
+        // The converted file must load as the same image
+        std::vector<unsigned char> reloaded;
+        unsigned short reloadedWidth = 0, reloadedHeight = 0;
+        if (!LoadTGA(output.string().c_str(), reloaded, reloadedWidth, reloadedHeight) || reloadedWidth != width || reloadedHeight != height || reloaded != pixels)
+        {
+            AddMessage(report, "converted file does not load as the same image");
+            return;
+        }
+        if (!FileSize(output, report.bytesAfter, report))
+        {
+            return;
+        }
+        report.ok = true;
+    }
+
+    void ProcessFile(const fs::path &input, const fs::path &outputDirectory, FileReport &report)
+    {
+        if (!FileSize(input, report.bytesBefore, report))
+        {
+            return;
+        }
+        if (LowerExtension(input) == ".md2")
+        {
+            ProcessModel(input, outputDirectory, report);
+        }
+        else
+        {
+            ProcessTexture(input, outputDirectory, report);
+        }
+        // Load temporaries are only needed for one file
+        LinearArena::loadArena().reset();
+    }
+
+    void WriteReport(const std::vector<FileReport> &reports, const fs::path &csvPath)
+    {
+        std::printf("%-24s %-6s %9s %9s %10s %10s %9s %7s %9s %6s  %s\n", "file", "status", "load_ms", "proc_ms", "bytes_in", "bytes_out", "triangles", "frames", "lods", "acmr", "notes");
+        std::ofstream csv(csvPath);
+        csv << "file,status,load_ms,process_ms,bytes_before,bytes_after,triangles,frames,vertices,lod_triangles,acmr_before,acmr_after,notes\n";
+        for (const FileReport &report : reports)
+        {
+            std::string lods;
+            for (size_t lod = 0; lod < report.lodTriangles.size(); lod++)
+            {
+                lods += (lod == 0 ? "" : "/") + std::to_string(report.lodTriangles[lod]);
+            }
+            const char *status = report.ok ? "ok" : "FAILED";
+            std::string name = report.input.filename().string();
+            std::printf("%-24s %-6s %9.2f %9.2f %10ju %10ju %9d %7d %9s %6.3f  %s\n", name.c_str(), status, report.loadMilliseconds, report.processMilliseconds,
+                        report.bytesBefore, report.bytesAfter, report.triangles, report.frames, lods.c_str(), report.acmrAfter, report.message.c_str());
+            csv << name << ',' << status << ',' << report.loadMilliseconds << ',' << report.processMilliseconds << ',' << report.bytesBefore << ',' << report.bytesAfter << ','
+                << report.triangles << ',' << report.frames << ',' << report.vertices << ',' << lods << ',' << report.acmrBefore << ',' << report.acmrAfter << ",\"" << report.message << "\"\n";
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> paths;
+    int threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument.rfind("--threads=", 0) == 0)
+        {
+            threadCount = std::max(1, std::atoi(argument.c_str() + 10));
+        }
+        else
+        {
+            paths.push_back(argument);
+        }
+    }
+    if (paths.size() != 2)
+    {
+        std::cerr << "usage: assettool <input directory> <output directory> [--threads=N]" << std::endl;
+        return 2;
+    }
+
+    const fs::path inputDirectory = paths[0];
+    const fs::path outputDirectory = paths[1];
+    std::error_code error;
+    if (!fs::is_directory(inputDirectory, error))
+    {
+        std::cerr << "Error: " << inputDirectory.string() << " is not a directory" << std::endl;
+        return 2;
+    }
+    fs::create_directories(outputDirectory, error);
+    if (error)
+    {
+        std::cerr << "Error: could not create " << outputDirectory.string() << ": " << error.message() << std::endl;
+        return 2;
+    }
+
+    // Sorted, so the report does not depend on the directory order
+    std::vector<FileReport> reports;
+    for (const fs::directory_entry &entry : fs::directory_iterator(inputDirectory))
+    {
+        std::string extension = LowerExtension(entry.path());
+        if (entry.is_regular_file() && (extension == ".md2" || extension == ".tga"))
+        {
+            reports.push_back({entry.path(), false, "", 0.0, 0.0, 0, 0, 0, 0, 0, {}, 0.0f, 0.0f});
+        }
+    }
+    std::sort(reports.begin(), reports.end(), [](const FileReport &a, const FileReport &b)
+              { return a.input < b.input; });
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next(0);
+    auto work = [&]()
+    {
+        for (size_t i = next.fetch_add(1); i < reports.size(); i = next.fetch_add(1))
+        {
+            ProcessFile(reports[i].input, outputDirectory, reports[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < std::min<int>(threadCount, static_cast<int>(reports.size())); i++)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    double totalMilliseconds = MillisecondsSince(start);
+
+    WriteReport(reports, outputDirectory / "report.csv");
+    size_t failed = std::count_if(reports.begin(), reports.end(), [](const FileReport &report)
+                                  { return !report.ok; });
+    std::printf("%zu files, %zu failed, %.1f ms on %d threads\n", reports.size(), failed, totalMilliseconds, static_cast<int>(workers.size()) + 1);
+    return failed == 0 ? 0 : 1;
+}